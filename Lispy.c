@@ -11,6 +11,10 @@ valgrind --tool=memcheck --leak-check=yes --show-reachable=yes --num-callers=20
 
 For more debugging use gdb
 
+For profiling Lisp functions, writing collapsed stacks for flamegraph.pl:
+Input> (profile-start)
+Input> (profile-stop "out.folded")
+
 For Loading in prompt:
 Input> "file.lspy"
 
@@ -24,7 +28,38 @@ This is pretty much the basis of the language I've made
 the functionality and implementation shall be modified iteratively
 */
 
+/* Images are mapped into memory, caches written under names made from */
+/* the process id and the profiler driven by SIGPROF, where POSIX is available */
+#if defined(__unix__) || defined(__APPLE__)
+    #ifndef _POSIX_C_SOURCE
+    #define _POSIX_C_SOURCE 200809L
+    #endif
+    #define LISPY_HAVE_MMAP
+    #define LISPY_HAVE_SIGPROF
+#endif
+
 #include "mpc.h"
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef LISPY_HAVE_MMAP
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#ifdef LISPY_HAVE_SIGPROF
+    #include <signal.h>
+    #include <sys/time.h>
+#endif
+
+#define LISPY_VERSION "0.0.0.1.1"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define LISPY_X86
+    #include <immintrin.h>
+#endif
 
 #ifdef _WIN32
     #include <string.h>
@@ -70,13 +105,34 @@ the functionality and implementation shall be modified iteratively
         return err;\
     }
 
+#define LASSERT_NUMBER(func, args, num) \
+    if(args->cell[num]->type != LVAL_NUM && args->cell[num]->type != LVAL_DBL \
+        && args->cell[num]->type != LVAL_BIG){ \
+        lval* err = lval_err("Function '%s' passed incorrect type for argument %i. " \
+                            "Got %s, Expected %s.",  \
+                            func, num,ltype_name(args->cell[num]->type), "Number, Double or Bignum"); \
+        lval_del(args); \
+        return err;\
+    }
+
 struct lval;
 struct lenv;
+struct lmap;
+struct lbig;
+struct lvec;
+struct lrope;
 typedef struct lval lval; 
 typedef struct lenv lenv;
+typedef struct lmap lmap;
+typedef struct lbig lbig;
+typedef struct lvec lvec;
+typedef struct lrope lrope;
 
 enum { LVAL_ERR, LVAL_NUM, LVAL_SYM, LVAL_STR,
-       LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR};
+       LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR, LVAL_MAP, LVAL_DBL, LVAL_BIG,
+       LVAL_VEC};
+
+#define LVAL_IS_NUMBER(t) ((t) == LVAL_NUM || (t) == LVAL_DBL || (t) == LVAL_BIG)
 
 typedef lval* (*lbuiltin) (lenv*, lval*);
 
@@ -89,14 +145,32 @@ typedef lval* (*lbuiltin) (lenv*, lval*);
     mpc_parser_t* Expr;
     mpc_parser_t* Lispy;
 
+/* Trees read with the mpc grammar are built here and freed all at once */
+    mpc_ast_arena_t* LispyArena;
+
+/* Rule ids mpca_lang gives AST nodes, in the order the parsers are passed */
+enum { LRULE_NONE, LRULE_NUMBER, LRULE_SYMBOL, LRULE_STRING, LRULE_COMMENT,
+       LRULE_SEXPR, LRULE_QEXPR, LRULE_EXPR, LRULE_LISPY };
+
 struct lval{
     int type;
 
+    /* Type and function it was allocated as and in, for mem-report */
+    unsigned short mem_type;
+    unsigned short mem_site;
+
     /* Basic */
     long num;
+    double dbl;
     char* sym;
     char* err;
+
+    /* String, always NUL terminated but may also hold NULs. */
+    /* Large concatenations are held as a rope instead, with str NULL */
     char* str;
+    int len;
+    int cap;
+    lrope* rope;
 
     /* Function */
     lbuiltin builtin;
@@ -107,6 +181,15 @@ struct lval{
     /* Expression */
     int count;
     lval** cell;
+
+    /* Map */
+    lmap* map;
+
+    /* Bignum */
+    lbig* big;
+
+    /* Vector */
+    lvec* vec;
 };
 
 struct lenv{
@@ -116,22 +199,115 @@ struct lenv{
     char** syms;
 };
 
+/* Open addressing hash table shared by reference between Map lvals */
+struct lmap{
+    int refs;
+    int count;
+    int used;
+    int slots;
+    unsigned long* hashes;
+    lval** keys;
+    lval** vals;
+};
+
+/* Marks a slot whose entry was deleted so probing continues past it */
+static lval lmap_tomb;
+#define LMAP_LIVE(m, i) ((m)->keys[i] != NULL && (m)->keys[i] != &lmap_tomb)
+
+/* Sign and magnitude integer with little endian base 2^32 digits. */
+/* Only used for values that do not fit in a long */
+struct lbig{
+    int neg;
+    int len;
+    uint32_t* d;
+};
+
+/* Operand size in digits above which multiplication uses Karatsuba */
+#define LBIG_KARATSUBA 32
+
+/* Immutable String tree shared by reference. Leaves hold bytes, inner */
+/* nodes are kept height balanced so appending stays logarithmic */
+struct lrope{
+    int refs;
+    int len;
+    int depth;
+    lrope* left;
+    lrope* right;
+    char* leaf;
+};
+
+/* Strings shorter than this stay flat, and adjacent leaves merge below it */
+#define LROPE_LEAF 512
+
+/* Packed array of either 64 bit integers or Doubles, i and d alias the data */
+struct lvec{
+    int dbl;
+    int count;
+    int64_t* i;
+    double* d;
+};
+
+/* Image mapped by --image. Values inside it are shared and never freed */
+static char* limage_base;
+static size_t limage_size;
+#define LIMAGE_OWNS(p) ((uintptr_t)(p) - (uintptr_t)limage_base < limage_size)
+
+/* Instruction sets the vector kernels can be built for */
+enum { LCPU_SCALAR, LCPU_SSE2, LCPU_AVX2 };
+
+/* Kernels for one instruction set, picked once at runtime */
+typedef struct {
+    char* name;
+    void (*add_i64)(int64_t* r, const int64_t* a, const int64_t* b, int n);
+    void (*mul_i64)(int64_t* r, const int64_t* a, const int64_t* b, int n);
+    int64_t (*sum_i64)(const int64_t* a, int n);
+    int64_t (*dot_i64)(const int64_t* a, const int64_t* b, int n);
+    void (*add_f64)(double* r, const double* a, const double* b, int n);
+    void (*mul_f64)(double* r, const double* a, const double* b, int n);
+    double (*sum_f64)(const double* a, int n);
+    double (*dot_f64)(const double* a, const double* b, int n);
+} lvec_kernels;
+
 lval* lval_num(long x);
+lval* lval_dbl(double x);
+lval* lval_big(lbig* b);
+lval* lval_vec(int dbl, int count);
 lval* lval_err(char* fmt, ...);
 lval* lval_sym(char* s);
 lval* lval_str(char* s);
+lval* lval_strn(char* s, int len);
+void lval_str_append(lval* v, char* s, int len);
+void lval_str_cat(lval* x, lval* y);
+char* lval_str_bytes(lval* v);
 lval* lval_sexpr(void);
 lval* lval_qexpr(void);
 lval* lval_fun(lbuiltin func);
+lval* lval_map(void);
 int lval_eq(lval* x, lval* y);
+unsigned long lval_hash(lval* v);
 void lval_del(lval* v);
 lval* lval_copy(lval* v);
+lval* lval_new(int type);
+void lval_free(lval* v);
+lval* lval_parse_num(char* s);
 lval* lval_read_num(mpc_ast_t* t);
 lval* lval_add(lval* v,lval* x);
 lval* lval_read_str(mpc_ast_t* t);
+lval* lval_str_unescape(char* s, int n);
 lval* lval_read(mpc_ast_t* t);
+lval* lval_read_mpc(char* filename, char* input);
+lval* lval_read_src(char* filename, char* s);
+void lout_reserve(int n);
+void lout_write(char* s, int n);
+void lout_puts(char* s);
+void lout_long(long x);
+void lout_flush(void);
 void lval_expr_print(lval* v,char open, char close);
+void lval_map_print(lval* v);
 void lval_print_str(lval* v);
+void lval_print_dbl(lval* v);
+void lval_print_big(lval* v);
+void lval_vec_print(lval* v);
 void lval_print(lval* v);
 void lval_println(lval* v);
 lval* lval_pop(lval* v, int i);
@@ -141,6 +317,44 @@ long lval_len(lval* y);
 lval* lval_init(lval* x, lval* y);
 char* ltype_name(int t);
 
+lmap* lmap_new(int slots);
+void lmap_release(lmap* m);
+int lmap_find(lmap* m, lval* k, unsigned long h);
+void lmap_put(lmap* m, lval* k, lval* v);
+int lmap_del(lmap* m, lval* k);
+int lmap_eq(lmap* x, lmap* y);
+int lmap_reached(lmap* m, lval* v);
+int lval_has_map(lval* v);
+
+lbig* lbig_new(int len);
+lbig* lbig_copy(lbig* b);
+lbig* lbig_read(char* s);
+lbig* lbig_from_dbl(double x);
+lbig* lbig_add(lbig* a, lbig* b, int sub);
+lbig* lbig_mul(lbig* a, lbig* b);
+lbig* lbig_div(lbig* a, lbig* b, int rem);
+int lbig_cmp(lbig* a, lbig* b);
+double lbig_to_dbl(lbig* b);
+lbig* lval_to_big(lval* v, lbig* tmp, uint32_t* buf);
+void lval_set_big(lval* v, lbig* b);
+double lval_to_dbl(lval* v);
+int lval_num_cmp(lval* x, lval* y);
+
+int lcpu_level(void);
+lvec_kernels* lvec_select(void);
+char* lmemchr(char* s, int c, int n);
+int lstr_find(char* s, int n, char* needle, int nn, int from);
+
+lrope* lrope_leaf(char* s, int len);
+lrope* lrope_ref(lrope* r);
+void lrope_release(lrope* r);
+lrope* lrope_join(lrope* l, lrope* r);
+char* lrope_flatten(lrope* r);
+lvec* lvec_new(int dbl, int count);
+lvec* lvec_copy(lvec* v);
+lvec* lvec_promote(lvec* v);
+lval* lvec_from_cells(lval** cells, int count, char* func);
+
 lenv* lenv_new(void);
 void lenv_del(lenv* e);
 lval* lval_lambda(lval* formals, lval* body);
@@ -149,6 +363,7 @@ lenv* lenv_copy(lenv* e);
 void lenv_put(lenv* e, lval* k, lval* v);
 void lenv_def(lenv* e,lval* k, lval* v);
 lval* lval_call(lenv* e, lval* f, lval* a);
+lval* lval_apply(lenv* e, lval* f, lval* a);
 
 lval* builtin_var(lenv* e, lval* a, char* func);
 lval* builtin_def(lenv* e, lval* a);
@@ -157,6 +372,8 @@ lval* builtin_lambda(lenv* e, lval* a);
 lval* builtin_fun(lenv* e, lval* a);
 lval* builtin_if(lenv* e, lval* a);
 
+char* lval_arith(lval* x, lval* y, char op);
+char* lval_arith_big(lval* x, lval* y, char op);
 lval* builtin_op(lenv* e, lval* a,char* op);
 lval* builtin_add(lenv* e, lval* a);
 lval* builtin_sub(lenv* e, lval* a);
@@ -164,6 +381,20 @@ lval* builtin_mul(lenv* e, lval* a);
 lval* builtin_div(lenv* e, lval* a);
 lval* builtin_mod(lenv* e, lval* a);
 
+lval* builtin_math(lenv* e, lval* a, char* func, double (*f)(double));
+lval* builtin_sqrt(lenv* e, lval* a);
+lval* builtin_exp(lenv* e, lval* a);
+lval* builtin_log(lenv* e, lval* a);
+lval* builtin_sin(lenv* e, lval* a);
+lval* builtin_cos(lenv* e, lval* a);
+lval* builtin_tan(lenv* e, lval* a);
+lval* builtin_atan(lenv* e, lval* a);
+lval* builtin_round(lenv* e, lval* a, char* func, double (*f)(double));
+lval* builtin_floor(lenv* e, lval* a);
+lval* builtin_ceil(lenv* e, lval* a);
+lval* builtin_trunc(lenv* e, lval* a);
+lval* builtin_pow(lenv* e, lval* a);
+
 lval* builtin_list(lenv* e, lval* a);
 lval* builtin_head(lenv* e,lval* a);
 lval* builtin_tail(lenv* e, lval* a);
@@ -187,26 +418,150 @@ lval* builtin_lt(lenv* e, lval* a);
 lval* builtin_ge(lenv* e, lval* a);
 lval* builtin_le(lenv* e, lval* a);
 
+lval* builtin_map_new(lenv* e, lval* a);
+lval* builtin_map_get(lenv* e, lval* a);
+lval* builtin_map_put(lenv* e, lval* a);
+lval* builtin_map_del(lenv* e, lval* a);
+lval* builtin_map_keys(lenv* e, lval* a);
+lval* builtin_map_size(lenv* e, lval* a);
+
+lval* builtin_vec(lenv* e, lval* a);
+lval* builtin_vec_list(lenv* e, lval* a);
+lval* builtin_vec_op(lenv* e, lval* a, char* func, char op);
+lval* builtin_vec_add(lenv* e, lval* a);
+lval* builtin_vec_mul(lenv* e, lval* a);
+lval* builtin_vec_sum(lenv* e, lval* a);
+lval* builtin_vec_dot(lenv* e, lval* a);
+lval* builtin_vec_map(lenv* e, lval* a);
+
+lval* builtin_str_len(lenv* e, lval* a);
+lval* builtin_str_concat(lenv* e, lval* a);
+lval* builtin_substr(lenv* e, lval* a);
+lval* builtin_str_find(lenv* e, lval* a);
+lval* builtin_str_split(lenv* e, lval* a);
+lval* builtin_str_join(lenv* e, lval* a);
+lval* builtin_str_num(lenv* e, lval* a);
+
 lval* builtin_print(lenv* e, lval* a);
 lval* builtin_eval(lenv* e, lval* a);
+lval* builtin_profile_start(lenv* e, lval* a);
+lval* builtin_profile_stop(lenv* e, lval* a);
+lval* builtin_mem_report(lenv* e, lval* a);
 void lenv_add_builtin(lenv* e, char* name, lbuiltin func);
 void lenv_add_builtins(lenv* e);
+char* lbuiltin_name(lbuiltin func);
+int lbuiltin_alone(lbuiltin func);
 lval* lval_eval_sexpr(lenv* e,lval* v);
 lval* lval_eval(lenv* e, lval* v);
 lval* builtin_load(lenv* e, lval* a);
+lval* llazy_load(lenv* e, char* filename);
+lval* llazy_define(char* name);
+void llazy_define_all(void);
+void llazy_free(void);
+lval* limage_dump(lenv* e, char* filename);
+lval* limage_load(lenv* e, char* filename);
+void limage_close(void);
+
+/*
+Allocation accounting. Every lval is allocated by lval_new and freed by
+lval_free, which count allocations, bytes and live objects for each type,
+and environments alongside them. Constructors add the bytes an lval holds
+with lmem_bytes. With LISPY_MEM_REPORT set the same is counted for each
+Lisp function, under whichever was running at the time.
+*/
+
+/* Environments are counted after the lval types */
+#define LMEM_ENV (LVAL_VEC+1)
+#define LMEM_KINDS (LVAL_VEC+2)
+
+typedef struct {
+    long allocs;
+    long bytes;
+    long live;
+} lmem_count;
+
+/* Set by LISPY_MEM_REPORT */
+static int lmem_on = 0;
+
+/* Counts by kind, and by function from site 0 for the top level up, */
+/* with the site currently running and an open addressing table of sites */
+static struct {
+    lmem_count kinds[LMEM_KINDS];
+    lmem_count* sites;
+    char** names;
+    int sites_num;
+    int* slots;
+    int site;
+} lmem;
+
+/* Count n more bytes held by a value of kind k */
+static void lmem_bytes(int k, size_t n){
+    lmem.kinds[k].bytes += n;
+    if(lmem_on){ lmem.sites[lmem.site].bytes += n; }
+}
+
+/* Count a new value of kind k taking n bytes. Only lvals know their */
+/* site, so only they are counted as live by function */
+static void lmem_alloc(int k, size_t n){
+    lmem.kinds[k].allocs++;
+    lmem.kinds[k].live++;
+    lmem.kinds[k].bytes += n;
+    if(lmem_on){
+        lmem.sites[lmem.site].allocs++;
+        lmem.sites[lmem.site].bytes += n;
+    }
+}
+
+lval* lval_new(int type){
+    lval* v = malloc(sizeof(lval));
+    v->type = type;
+    v->mem_type = type;
+    v->mem_site = lmem.site;
+    lmem_alloc(type, sizeof(lval));
+    if(lmem_on){ lmem.sites[lmem.site].live++; }
+    return v;
+}
+
+/* Free v itself, once what it holds has been freed or handed on */
+void lval_free(lval* v){
+    lmem.kinds[v->mem_type].live--;
+    if(lmem_on){ lmem.sites[v->mem_site].live--; }
+    free(v);
+}
 
 /* Construct a pointer to a new Number lval */
 lval* lval_num(long x){
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_NUM;
+    lval* v = lval_new(LVAL_NUM);
     v->num = x;
     return v;
 }
 
+/* Construct a pointer to a new Double lval */
+lval* lval_dbl(double x){
+    lval* v = lval_new(LVAL_DBL);
+    v->dbl = x;
+    return v;
+}
+
+/* Construct a Number from a Bignum, taking ownership of b */
+lval* lval_big(lbig* b){
+    lval* v = lval_new(LVAL_BIG);
+    lval_set_big(v,b);
+    if(v->type == LVAL_BIG){ lmem_bytes(LVAL_BIG, sizeof(lbig) + sizeof(uint32_t) * b->len); }
+    return v;
+}
+
+/* Construct a zeroed Vector of count Numbers, or Doubles if dbl is set */
+lval* lval_vec(int dbl, int count){
+    lval* v = lval_new(LVAL_VEC);
+    v->vec = lvec_new(dbl, count);
+    lmem_bytes(LVAL_VEC, sizeof(lvec) + sizeof(int64_t) * count);
+    return v;
+}
+
 /* Construct a pointer to a new Error lval */
 lval* lval_err(char* fmt, ...){
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_ERR;
+    lval* v = lval_new(LVAL_ERR);
 
     /* Create a va list and initialize it */
     va_list va;
@@ -220,6 +575,7 @@ lval* lval_err(char* fmt, ...){
 
     /* Reallocate to number of bytes actually used */
     v->err = realloc(v->err, strlen(v->err)+1);
+    lmem_bytes(LVAL_ERR, strlen(v->err)+1);
 
     /* Cleanup our va list */
     va_end(va);
@@ -229,26 +585,73 @@ lval* lval_err(char* fmt, ...){
 
 /* Construct a pointer to a new Symbol lval */
 lval* lval_sym(char* s){
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_SYM;
+    lval* v = lval_new(LVAL_SYM);
     v->sym = malloc(strlen(s)+1);
     strcpy(v->sym,s);
+    lmem_bytes(LVAL_SYM, strlen(s)+1);
     return v;
 }
 
 /* Construct a pointer to a String */
 lval* lval_str(char* s){
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_STR;
-    v->str = malloc(strlen(s)+1);
-    strcpy(v->str,s);
+    return lval_strn(s, strlen(s));
+}
+
+/* Construct a String from len bytes, which may include NULs */
+lval* lval_strn(char* s, int len){
+    lval* v = lval_new(LVAL_STR);
+    v->rope = NULL;
+    v->len = len;
+    v->cap = len+1;
+    v->str = malloc(v->cap);
+    lmem_bytes(LVAL_STR, v->cap);
+    memcpy(v->str, s, len);
+    v->str[len] = '\0';
     return v;
 }
 
+/* Append y to x. Short results are copied flat, longer ones join ropes */
+void lval_str_cat(lval* x, lval* y){
+    if(!x->rope && !y->rope && x->len + y->len < LROPE_LEAF){
+        lval_str_append(x, y->str, y->len);
+        return;
+    }
+
+    /* A flat x hands its buffer over to a leaf */
+    if(!x->rope){
+        x->rope = lrope_leaf(NULL, 0);
+        free(x->rope->leaf);
+        x->rope->leaf = x->str;
+        x->rope->len = x->len;
+        x->str = NULL;
+        x->cap = 0;
+    }
+    lrope* r = y->rope ? lrope_ref(y->rope) : lrope_leaf(y->str, y->len);
+    x->rope = lrope_join(x->rope, r);
+    x->len += y->len;
+}
+
+/* Bytes of a String, flattening a rope the first time they are needed */
+char* lval_str_bytes(lval* v){
+    return v->rope ? lrope_flatten(v->rope) : v->str;
+}
+
+/* Append len bytes to a flat String, doubling its capacity as needed */
+void lval_str_append(lval* v, char* s, int len){
+    if(v->len + len + 1 > v->cap){
+        int cap = v->cap;
+        while(v->len + len + 1 > v->cap){ v->cap *= 2; }
+        v->str = realloc(v->str, v->cap);
+        lmem_bytes(LVAL_STR, v->cap - cap);
+    }
+    memcpy(v->str + v->len, s, len);
+    v->len += len;
+    v->str[v->len] = '\0';
+}
+
 /* Sexpr pointer constructor */
 lval* lval_sexpr(void){
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_SEXPR;
+    lval* v = lval_new(LVAL_SEXPR);
     v->count = 0;
     v->cell = NULL;
     return v;
@@ -256,22 +659,32 @@ lval* lval_sexpr(void){
 
 /* Qexpr pointer constructor */
 lval* lval_qexpr(void){
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_QEXPR;
+    lval* v = lval_new(LVAL_QEXPR);
     v->count = 0;
     v->cell = NULL;
     return v;
 }
 
 lval* lval_fun(lbuiltin func){
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_FUN;
+    lval* v = lval_new(LVAL_FUN);
     v->builtin = func;
     return v;
 }
 
+/* Map pointer constructor */
+lval* lval_map(void){
+    lval* v = lval_new(LVAL_MAP);
+    v->map = lmap_new(8);
+    return v;
+}
+
 int lval_eq(lval* x, lval* y){
 
+    /* Numbers of any type are equal when their values are */
+    if(LVAL_IS_NUMBER(x->type) && LVAL_IS_NUMBER(y->type)){
+        return lval_num_cmp(x, y) == 0;
+    }
+
     /*Different types are always unequal */
     if(x->type != y->type) {return 0;}
 
@@ -279,11 +692,26 @@ int lval_eq(lval* x, lval* y){
     switch (x->type) {
         /* Compare Number values */
         case LVAL_NUM: return (x->num == y->num);
+        case LVAL_DBL: return (x->dbl == y->dbl);
+        case LVAL_BIG:
+            return x->big->neg == y->big->neg && x->big->len == y->big->len
+                && memcmp(x->big->d, y->big->d, sizeof(uint32_t) * x->big->len) == 0;
+
+        /* Vectors compare element by element */
+        case LVAL_VEC:
+            if(x->vec->dbl != y->vec->dbl || x->vec->count != y->vec->count){ return 0; }
+            for(int i=0;i<x->vec->count;i++){
+                if(x->vec->dbl ? x->vec->d[i] != y->vec->d[i]
+                               : x->vec->i[i] != y->vec->i[i]){ return 0; }
+            }
+            return 1;
         
         /* Compare String Values */
         case LVAL_ERR: return (strcmp(x->err,y->err) == 0);
         case LVAL_SYM: return (strcmp(x->sym,y->sym) == 0);
-        case LVAL_STR: return (strcmp(x->str,y->str) == 0);
+        case LVAL_STR:
+            return x->len == y->len
+                && memcmp(lval_str_bytes(x), lval_str_bytes(y), x->len) == 0;
         /* If builtin compare, otherwise compare formals and body */
         case LVAL_FUN:
             if (x->builtin || y->builtin){
@@ -304,14 +732,107 @@ int lval_eq(lval* x, lval* y){
             /* Otherwise lists must be equal */
             return 1;
         break;
+
+        /* Maps are equal if they hold equal values for the same keys */
+        case LVAL_MAP: return lmap_eq(x->map, y->map);
     }
     return 0;
 }
 
+/* Mix the bits of a hash so nearby numbers land in distant slots */
+static unsigned long lhash_mix(unsigned long h){
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdUL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* FNV-1a over a NUL terminated string */
+static unsigned long lhash_str(unsigned long h, char* s){
+    while(*s){
+        h ^= (unsigned char)*s++;
+        h *= 0x100000001b3UL;
+    }
+    return h;
+}
+
+/* FNV-1a over n bytes */
+static unsigned long lhash_bytes(unsigned long h, char* s, int n){
+    for(int i=0;i<n;i++){
+        h ^= (unsigned char)s[i];
+        h *= 0x100000001b3UL;
+    }
+    return h;
+}
+
+/* Structural hash, consistent with lval_eq */
+unsigned long lval_hash(lval* v){
+    unsigned long h = 0xcbf29ce484222325UL ^ (unsigned long)v->type;
+
+    switch(v->type){
+        /* Equal numbers of different types must hash alike, so whole */
+        /* values hash their magnitude digits whatever their type */
+        case LVAL_NUM:
+        case LVAL_DBL:
+        case LVAL_BIG: {
+            h = 0xcbf29ce484222325UL ^ (unsigned long)LVAL_NUM;
+            if(v->type == LVAL_DBL && (v->dbl != floor(v->dbl) || isinf(v->dbl))){
+                /* Hash the bits of fractions, infinities and NaN */
+                unsigned long bits = 0;
+                memcpy(&bits, &v->dbl, sizeof(double) < sizeof(bits) ? sizeof(double) : sizeof(bits));
+                return lhash_mix(h ^ bits);
+            }
+            lbig tmp;
+            uint32_t buf[2];
+            lbig* b = v->type == LVAL_DBL ? lbig_from_dbl(v->dbl) : lval_to_big(v, &tmp, buf);
+            h ^= (unsigned long)b->neg;
+            for(int i=0;i<b->len;i++){
+                h = (h ^ b->d[i]) * 0x100000001b3UL;
+            }
+            if(v->type == LVAL_DBL){ free(b); }
+            return lhash_mix(h);
+        }
+        case LVAL_VEC:
+            h ^= (unsigned long)v->vec->dbl;
+            for(int i=0;i<v->vec->count;i++){
+                unsigned long bits = (unsigned long)v->vec->i[i];
+                if(v->vec->dbl && v->vec->d[i] == 0.0){ bits = 0; }
+                h = (h ^ bits) * 0x100000001b3UL;
+            }
+            return lhash_mix(h);
+        case LVAL_ERR: return lhash_str(h, v->err);
+        case LVAL_SYM: return lhash_str(h, v->sym);
+        case LVAL_STR: return lhash_bytes(h, lval_str_bytes(v), v->len);
+        case LVAL_FUN:
+            if(v->builtin){
+                return lhash_mix(h ^ (unsigned long)(size_t)v->builtin);
+            }
+            return lhash_mix(lval_hash(v->formals) * 31 + lval_hash(v->body));
+
+        /* Combine elements in order */
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            for(int i=0;i<v->count;i++){
+                h = (h ^ lval_hash(v->cell[i])) * 0x100000001b3UL;
+            }
+            return lhash_mix(h);
+
+        /* Combine entries independently of slot order */
+        case LVAL_MAP: {
+            unsigned long sum = 0;
+            for(int i=0;i<v->map->slots;i++){
+                if(!LMAP_LIVE(v->map, i)){ continue; }
+                sum += lhash_mix(v->map->hashes[i] ^ lval_hash(v->map->vals[i]));
+            }
+            return lhash_mix(h ^ sum);
+        }
+    }
+    return h;
+}
+
 lval* lval_copy(lval* v){
 
-    lval* x = malloc(sizeof(lval));
-    x->type = v->type;
+    lval* x = lval_new(v->type);
 
     switch(v->type){
         /* Copy Functions and Numbers Directly */
@@ -326,34 +847,64 @@ lval* lval_copy(lval* v){
             }
         break;
         case LVAL_NUM: x->num = v->num; break;
+        case LVAL_DBL: x->dbl = v->dbl; break;
+        case LVAL_BIG:
+            x->big = lbig_copy(v->big);
+            lmem_bytes(LVAL_BIG, sizeof(lbig) + sizeof(uint32_t) * v->big->len); break;
+        case LVAL_VEC:
+            x->vec = lvec_copy(v->vec);
+            lmem_bytes(LVAL_VEC, sizeof(lvec) + sizeof(int64_t) * v->vec->count); break;
 
         /* Copy Strings using malloc and strcpy */
         case LVAL_ERR:
             x->err = malloc(strlen(v->err)+1);
-            strcpy(x->err,v->err); break;
+            strcpy(x->err,v->err);
+            lmem_bytes(LVAL_ERR, strlen(v->err)+1); break;
         
         case LVAL_SYM:
             x->sym = malloc(strlen(v->sym)+1);
-            strcpy(x->sym,v->sym); break;
+            strcpy(x->sym,v->sym);
+            lmem_bytes(LVAL_SYM, strlen(v->sym)+1); break;
         case LVAL_STR:
-            x->str = malloc(strlen(v->str) + 1);
-            strcpy(x->str,v->str); break;
+            x->len = v->len;
+            x->rope = v->rope;
+            /* Ropes are immutable so copies can share them */
+            if(v->rope){
+                lrope_ref(v->rope);
+                x->str = NULL;
+                x->cap = 0;
+                break;
+            }
+            x->cap = v->len + 1;
+            x->str = malloc(x->cap);
+            lmem_bytes(LVAL_STR, x->cap);
+            memcpy(x->str, v->str, x->cap); break;
         /* Copy Lists by copying each sub-expression */
         case LVAL_SEXPR:
         case LVAL_QEXPR:
             x->count = v->count;
             x->cell = malloc(sizeof(lval*) * x->count);
+            lmem_bytes(v->type, sizeof(lval*) * x->count);
             for(int i=0;i<x->count;i++){
                 x->cell[i] = lval_copy(v->cell[i]);
             }
         break;
+        /* Maps are shared by reference */
+        case LVAL_MAP:
+            x->map = v->map;
+            x->map->refs++;
+        break;
     }
     return x;
 }
 
 void lval_del(lval* v){
+    if(LIMAGE_OWNS(v)){ return; }
     switch (v->type){
         case LVAL_NUM: break;
+        case LVAL_DBL: break;
+        case LVAL_BIG: free(v->big); break;
+        case LVAL_VEC: free(v->vec); break;
         case LVAL_FUN: 
             if(!v->builtin){
                 lenv_del(v->env);
@@ -363,7 +914,10 @@ void lval_del(lval* v){
         break;
         case LVAL_ERR: free(v->err); break;
         case LVAL_SYM: free(v->sym); break;
-        case LVAL_STR: free(v->str); break;
+        case LVAL_STR:
+            if(v->rope){ lrope_release(v->rope); }
+            else { free(v->str); }
+        break;
         /*If Qexpr or Sexpr then delete all elements inside*/
         case LVAL_QEXPR:
         case LVAL_SEXPR:
@@ -373,178 +927,2366 @@ void lval_del(lval* v){
             /* Also free the memory allocated to contain the pointers */
             free(v->cell);
         break; 
+        case LVAL_MAP: lmap_release(v->map); break;
     }
-    free(v);
+    lval_free(v);
 }
 
-lval* lval_read_num(mpc_ast_t* t){
+/* Convert text already matching the number syntax */
+lval* lval_parse_num(char* s){
     errno = 0;
-    long x = strtol(t->contents,NULL,10);
+
+    /* A fraction or exponent makes it a Double */
+    if(strpbrk(s,".eE")){
+        double d = strtod(s,NULL);
+        return errno != ERANGE ?
+            lval_dbl(d) : lval_err("invalid number");
+    }
+
+    /* Integers too large for a long become Bignums */
+    long x = strtol(s,NULL,10);
     return errno != ERANGE ? 
-        lval_num(x) : lval_err("invalid number");
+        lval_num(x) : lval_big(lbig_read(s));
+}
+
+lval* lval_read_num(mpc_ast_t* t){
+    return lval_parse_num(t->contents);
 }
 
 lval* lval_add(lval* v,lval* x){
     v->count++;
     v->cell = realloc(v->cell,sizeof(lval*) * v->count);
+    lmem_bytes(v->type, sizeof(lval*));
     v->cell[v->count-1] = x;
     return v;
 }
 
+/* Escape characters and the letters that stand for them after a backslash */
+static char lstr_escapes[] = "\a\b\f\n\r\t\v\\\'\"";
+static char lstr_letters[] = "abfnrtv\\'\"";
+
 lval* lval_read_str(mpc_ast_t* t){
-    /* Cut off the final quote character */
-    t->contents[strlen(t->contents)-1] = '\0';
-    /* Copy the string missing out the first quote character */
-    char* unescaped = malloc(strlen(t->contents+1)+1);
-    strcpy(unescaped, t->contents+1);
-    /* Pass through the unescape function */
-    unescaped = mpcf_unescape(unescaped);
-    /* Construct a new lval using the string */
-    lval* str = lval_str(unescaped);
-    /* Free the string and return */
-    free(unescaped);
+    /* Skip the quote characters at either end */
+    return lval_str_unescape(t->contents+1, strlen(t->contents+1)-1);
+}
+
+/* Unescape n bytes into a String directly so that \0 survives as a byte */
+lval* lval_str_unescape(char* s, int n){
+    lval* str = lval_strn("", 0);
+    str->str = realloc(str->str, n+1);
+    str->cap = n+1;
+    for(int i=0;i<n;i++){
+        char c = s[i];
+        if(c == '\\' && i+1 < n){
+            char* p = strchr(lstr_letters, s[i+1]);
+            if(s[i+1] == '0'){ c = '\0'; i++; }
+            else if(p){ c = lstr_escapes[p - lstr_letters]; i++; }
+        }
+        str->str[str->len++] = c;
+    }
+    str->str[str->len] = '\0';
     return str;
 }
 
 lval* lval_read(mpc_ast_t* t){
     /*If Symbol or Number return conversion to that type*/
-    if(strstr(t->tag,"number")) {return lval_read_num(t);}
-    if(strstr(t->tag,"symbol")) {return lval_sym(t->contents);}
-    if(strstr(t->tag,"string")) {return lval_read_str(t);}
-
-    /*If root(>), sexpr, or qexpr then create empty list*/
-    lval* x = NULL;
-    if(strcmp(t->tag,">") == 0) { x = lval_sexpr();}
-    if(strstr(t->tag,"sexpr"))  { x = lval_sexpr();}
-    if(strstr(t->tag,"qexpr"))  { x = lval_qexpr();}
+    lval* x;
+    switch(t->rule){
+        case LRULE_NUMBER: return lval_read_num(t);
+        case LRULE_SYMBOL: return lval_sym(t->contents);
+        case LRULE_STRING: return lval_read_str(t);
+
+        /*If root(>), sexpr, or qexpr then create empty list*/
+        case LRULE_QEXPR: x = lval_qexpr(); break;
+        default: x = lval_sexpr(); break;
+    }
 
     /*Fill this list with any valid expression contained within*/
     for(int i=0;i<t->children_num;i++){
-        if(strstr(t->children[i]->tag,"comment")){continue;}
-        if(strcmp(t->children[i]->contents,"(") == 0){continue;}
-        if(strcmp(t->children[i]->contents,")") == 0){continue;}
-        if(strcmp(t->children[i]->contents,"{") == 0){continue;}
-        if(strcmp(t->children[i]->contents,"}") == 0){continue;}
-        if(strcmp(t->children[i]->tag,"regex")  == 0){continue;}
-        x = lval_add(x,lval_read(t->children[i]));
+        switch(t->children[i]->rule){
+            case LRULE_NUMBER: case LRULE_SYMBOL: case LRULE_STRING:
+            case LRULE_SEXPR: case LRULE_QEXPR:
+                x = lval_add(x,lval_read(t->children[i]));
+                break;
+
+            /* Comments, brackets and the regexes around the root */
+            default: break;
+        }
     }
 
     return x;
 }
 
-void lval_expr_print(lval* v,char open, char close){
-    putchar(open);
-    for(int i=0;i<v->count;i++){
-        /*Print value contained within*/
-        lval_print(v->cell[i]);
+/* Read with the mpc grammar instead of the reader below. Set by --mpc */
+static int lread_use_mpc = 0;
 
-        /*Don't print trailing space if last element*/
-        if(i != v->count-1){
-            putchar(' ');
-        }
-    }
-    putchar(close);
+/* Build the mpc grammar the first time it is read with, so startup doesn't */
+static void lread_mpc_init(void){
+    if(Lispy){ return; }
+
+    Number = mpc_new("number");
+    Symbol = mpc_new("symbol");
+    String = mpc_new("string");
+    Comment = mpc_new("comment");
+    Sexpr = mpc_new("sexpr");
+    Qexpr = mpc_new("qexpr");
+    Expr = mpc_new("expr");
+    Lispy = mpc_new("lispy");
+
+    mpca_lang(MPCA_LANG_DEFAULT,
+    "                                                        \
+        number  : /-?[0-9]+(\\.[0-9]+)?([eE][-+]?[0-9]+)?/ ; \
+        symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&|]+/;         \
+        string  : /\"(\\\\.|[^\"])*\"/;                      \
+        comment : /;[^\\r\\n]*/ ;                            \
+        sexpr   : '(' <expr>* ')' ;                          \
+        qexpr   : '{' <expr>* '}' ;                          \
+        expr    :  <number> | <symbol> | <string>            \
+                | <comment> |<sexpr> | <qexpr> ;             \
+        lispy   : /^/<expr>*/$/ ;                            \
+    ",
+    Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+    LispyArena = mpc_ast_arena_new();
 }
 
-void lval_print_str(lval* v){
-    /* Make a Copy of the string */
-    char* escaped = malloc(strlen(v->str)+1);
-    strcpy(escaped, v->str);
-    /* Pass it through the escape function */
-    escaped = mpcf_escape(escaped);
-    /* Print it between " characters */
-    printf("\"%s\"", escaped);
-    /* free the copied string */
-    free(escaped);
+static void lread_mpc_cleanup(void){
+    if(!Lispy){ return; }
+    mpc_ast_arena_delete(LispyArena);
+    mpc_cleanup(8,Number, Symbol, String, Comment,Sexpr, Qexpr, Expr, Lispy);
 }
 
-void lval_print(lval* v){
-    switch (v->type) {
-        case LVAL_NUM: printf("%li",v->num); break;
-        case LVAL_ERR: printf("Error: %s",v->err); break;
-        case LVAL_SYM: printf("%s", v->sym); break;
-        case LVAL_STR: lval_print_str(v); break;
-        case LVAL_SEXPR: lval_expr_print(v,'(',')'); break;
-        case LVAL_QEXPR: lval_expr_print(v,'{','}'); break;
-        case LVAL_FUN: 
-            if(v->builtin){
-                printf("<builtin>");
-            } else {
-                printf("\\"); lval_print(v->formals);
-                putchar(' '); lval_print(v->body); putchar(')');
-            } 
-        break;
+/* Parse input, or the file itself if input is NULL, with the mpc grammar */
+lval* lval_read_mpc(char* filename, char* input){
+    lread_mpc_init();
+    mpc_result_t r;
+    int ok = input ? mpc_parse_arena(filename, input, Lispy, LispyArena, &r)
+                   : mpc_parse_contents_arena(filename, Lispy, LispyArena, &r);
+    if(!ok){
+        char* msg = mpc_err_string(r.error);
+        mpc_err_delete(r.error);
+        lval* err = lval_err("%s", msg);
+        free(msg);
+        return err;
     }
+    lval* x = lval_read(r.output);
+    mpc_ast_arena_clear(LispyArena);
+    return x;
 }
 
-void lval_println(lval* v){lval_print(v); putchar('\n');}
-
-lval* lval_pop(lval* v, int i){
-    /* Find the item at i */
-    lval* x = v->cell[i];
+/*
+Forms read from a file are cached beside it in a .lspyc file, keyed by a
+hash of the source and the interpreter version. Loading a file whose
+cache matches reads the forms back from it instead of parsing, and any
+other load writes a new cache as the forms are read. --no-cache turns
+both off.
+*/
 
-    /* Shift memory after the item "i" is over the top */
-    memmove(&v->cell[i],&v->cell[i+1],
-        sizeof(lval*) * (v->count-i-1));
+#define LCACHE_MAGIC "LSPYC"
+#define LCACHE_VERSION 1
+#define LCACHE_CHUNK (64*1024)
+
+/* Follows the last form, so a cache that is cut short is noticed */
+#define LCACHE_END 0xFF
+
+typedef struct {
+    char magic[8];
+    char lispy[16];         /* LISPY_VERSION of the writer */
+    uint32_t version;
+    uint32_t pad;
+    uint64_t hash;          /* Of the source file's contents */
+    uint64_t source;        /* Size of the source file */
+    uint64_t size;          /* Size of the cache file */
+} lcache_header;
+
+typedef struct {
+    FILE* file;
+    char* path;
+    lcache_header h;
+
+    /* Written to tmp and moved to path once done, unless writing failed */
+    int writing;
+    int done;
+    int ok;
+    char* tmp;
+
+    /* Bytes waiting to be written, or read but not yet used */
+    char* buf;
+    int pos;
+    int len;
+} lcache;
+
+/* Set by --no-cache */
+static int lcache_off = 0;
+
+/* Numbers temporary files so nested loads of one file don't share one */
+static int lcache_serial = 0;
+
+/* 64 bit hash of the rest of f, taken 8 bytes at a time. Rewinds f */
+static int lcache_hash(FILE* f, uint64_t* hash, uint64_t* size){
+    char* buf = malloc(LCACHE_CHUNK);
+    uint64_t h = 0x9E3779B97F4A7C15ULL;
+    uint64_t n = 0;
+    size_t got;
+    while((got = fread(buf, 1, LCACHE_CHUNK, f)) > 0){
+        size_t i = 0;
+        for(;i + 8 <= got;i += 8){
+            uint64_t w;
+            memcpy(&w, buf + i, 8);
+            h = (h ^ w) * 0xFF51AFD7ED558CCDULL;
+            h ^= h >> 32;
+        }
+        for(;i < got;i++){ h = (h ^ (unsigned char)buf[i]) * 0x100000001B3ULL; }
+        n += got;
+    }
+    int ok = !ferror(f);
+    free(buf);
+    rewind(f);
+    *hash = h ^ n;
+    *size = n;
+    return ok;
+}
 
-    /* Decrease the count of items in the list */
-    v->count--;
-    
-    /*reallocate the memory used*/
-    v->cell = realloc(v->cell,sizeof(lval*) * v->count);
+static void lcache_flush(lcache* c){
+    if(c->len && fwrite(c->buf, 1, c->len, c->file) != (size_t)c->len){ c->ok = 0; }
+    c->len = 0;
+}
 
-    return x;
+static void lcache_byte(lcache* c, int b){
+    if(c->len == LCACHE_CHUNK){ lcache_flush(c); }
+    c->buf[c->len++] = b;
 }
 
-lval* lval_take(lval* v, int i){
-    lval* x = lval_pop(v,i);
-    lval_del(v);
-    return x;
+static void lcache_write(lcache* c, void* p, uint64_t n){
+    while(n > 0){
+        if(c->len == LCACHE_CHUNK){ lcache_flush(c); }
+        int k = LCACHE_CHUNK - c->len < n ? LCACHE_CHUNK - c->len : (int)n;
+        memcpy(c->buf + c->len, p, k);
+        c->len += k;
+        p = (char*)p + k;
+        n -= k;
+    }
 }
 
-lval* lval_join(lval* x, lval* y){
-    /*For each cell in 'y' add it to 'x'*/
-    while(y->count){
-        x = lval_add(x,lval_pop(y,0));
+/* Seven bits a byte, low bits first */
+static void lcache_uint(lcache* c, uint64_t x){
+    while(x >= 0x80){
+        lcache_byte(c, (x & 0x7F) | 0x80);
+        x >>= 7;
     }
-    lval_del(y);
-    return x;
+    lcache_byte(c, x);
 }
 
-long lval_len(lval* y){
-    long x = 0;
-    while(y->count){
-        lval* temp = lval_pop(y,0);
-        x++; 
-        lval_del(temp);
+/* Append a form. Only what the reader produces can be written, so */
+/* anything else drops the cache */
+static void lcache_put(lcache* c, lval* v){
+    lcache_byte(c, v->type);
+    switch(v->type){
+        /* Zigzag so small negative Numbers stay short */
+        case LVAL_NUM:
+            lcache_uint(c, ((uint64_t)v->num << 1) ^ (v->num < 0 ? ~(uint64_t)0 : 0));
+        break;
+        case LVAL_DBL: lcache_write(c, &v->dbl, sizeof(double)); break;
+        case LVAL_BIG:
+            lcache_byte(c, v->big->neg);
+            lcache_uint(c, v->big->len);
+            lcache_write(c, v->big->d, sizeof(uint32_t) * v->big->len);
+        break;
+        /* Symbols and Errors keep their NUL so they can be used in place */
+        case LVAL_SYM:
+            lcache_uint(c, strlen(v->sym));
+            lcache_write(c, v->sym, strlen(v->sym)+1);
+        break;
+        case LVAL_ERR:
+            lcache_uint(c, strlen(v->err));
+            lcache_write(c, v->err, strlen(v->err)+1);
+        break;
+        case LVAL_STR:
+            lcache_uint(c, v->len);
+            lcache_write(c, lval_str_bytes(v), v->len);
+        break;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            lcache_uint(c, v->count);
+            for(int i=0;i<v->count;i++){ lcache_put(c, v->cell[i]); }
+        break;
+        default: c->ok = 0; break;
     }
-    lval_del(y);
-    return x;
 }
 
-lval* lval_init(lval* x, lval* y){
-    while(y->count-1 != 0){
-        x = lval_add(x,lval_pop(y,0));
+static int lcache_refill(lcache* c){
+    c->pos = 0;
+    c->len = fread(c->buf, 1, LCACHE_CHUNK, c->file);
+    return c->len > 0 ? (unsigned char)c->buf[c->pos++] : -1;
+}
+
+#define lcache_getc(c) \
+    ((c)->pos < (c)->len ? (unsigned char)(c)->buf[(c)->pos++] : lcache_refill(c))
+
+static int lcache_get_uint(lcache* c, uint64_t* x){
+    *x = 0;
+    for(int shift = 0;shift < 64;shift += 7){
+        int b = lcache_getc(c);
+        if(b < 0){ return 0; }
+        *x |= (uint64_t)(b & 0x7F) << shift;
+        if(!(b & 0x80)){ return 1; }
     }
-    lval_del(y);
-    return x;
+    return 0;
 }
 
-char* ltype_name(int t){
-    switch(t){
-        case LVAL_FUN: return "Function";
-        case LVAL_NUM: return "Number";
-        case LVAL_ERR: return "Error";
-        case LVAL_SYM: return "Symbol";
-        case LVAL_STR: return "String";
-        case LVAL_SEXPR: return "S-Expression";
-        case LVAL_QEXPR: return "Q-Expression";
-        default: return "Unknown";
+/* Next n bytes, in place when they are all in the buffer. Otherwise */
+/* they are copied to *owned, which the caller frees */
+static char* lcache_bytes(lcache* c, uint64_t n, char** owned){
+    *owned = NULL;
+    if(n <= (uint64_t)(c->len - c->pos)){
+        char* s = c->buf + c->pos;
+        c->pos += n;
+        return s;
     }
+    if(n > c->h.size){ return NULL; }
+
+    char* s = *owned = malloc(n+1);
+    for(uint64_t got = 0;got < n;){
+        if(c->pos == c->len && lcache_refill(c) >= 0){ c->pos--; }
+        if(c->pos == c->len){ return NULL; }
+        int k = c->len - c->pos < n - got ? c->len - c->pos : (int)(n - got);
+        memcpy(s + got, c->buf + c->pos, k);
+        c->pos += k;
+        got += k;
+    }
+    return s;
 }
 
-lenv* lenv_new(void){
+/* Form of the given type written by lcache_put, or NULL if it is garbled */
+static lval* lcache_get(lcache* c, int type){
+    uint64_t n;
+    if(type != LVAL_DBL && !lcache_get_uint(c, &n)){ return NULL; }
+
+    switch(type){
+        case LVAL_NUM: return lval_num((long)((n >> 1) ^ (0 - (n & 1))));
+        case LVAL_DBL: {
+            double d;
+            char* owned;
+            char* s = lcache_bytes(c, sizeof(double), &owned);
+            if(s){ memcpy(&d, s, sizeof(double)); }
+            free(owned);
+            return s ? lval_dbl(d) : NULL;
+        }
+        /* The sign was read as n, the length follows */
+        case LVAL_BIG: {
+            uint64_t len;
+            if(n > 1 || !lcache_get_uint(c, &len) || len > c->h.size){ return NULL; }
+            char* owned;
+            char* s = lcache_bytes(c, sizeof(uint32_t) * len, &owned);
+            if(!s){ free(owned); return NULL; }
+            lbig* b = lbig_new(len);
+            b->neg = n;
+            memcpy(b->d, s, sizeof(uint32_t) * len);
+            free(owned);
+            return lval_big(b);
+        }
+        case LVAL_SYM:
+        case LVAL_ERR:
+        case LVAL_STR: {
+            if(n >= c->h.size){ return NULL; }
+            char* owned;
+            char* s = lcache_bytes(c, n + (type != LVAL_STR), &owned);
+            lval* x = NULL;
+            if(s && (type == LVAL_STR || s[n] == '\0')){
+                x = type == LVAL_SYM ? lval_sym(s)
+                  : type == LVAL_ERR ? lval_err("%s", s) : lval_strn(s, n);
+            }
+            free(owned);
+            return x;
+        }
+        case LVAL_SEXPR:
+        case LVAL_QEXPR: {
+            if(n > c->h.size){ return NULL; }
+            lval* x = type == LVAL_SEXPR ? lval_sexpr() : lval_qexpr();
+            x->cell = malloc(sizeof(lval*) * (n ? n : 1));
+            while((uint64_t)x->count < n){
+                int t = lcache_getc(c);
+                lval* y = t < 0 ? NULL : lcache_get(c, t);
+                if(!y){ lval_del(x); return NULL; }
+                x->cell[x->count++] = y;
+            }
+            return x;
+        }
+    }
+    return NULL;
+}
+
+static void lcache_close(lcache* c){
+    if(c->file && c->writing){
+        /* The header is rewritten with the final size */
+        if(c->done){
+            lcache_byte(c, LCACHE_END);
+            lcache_flush(c);
+            c->h.size = ftell(c->file);
+            if(fseek(c->file, 0, SEEK_SET) != 0
+                || fwrite(&c->h, sizeof(lcache_header), 1, c->file) != 1){ c->ok = 0; }
+        }
+        if(fclose(c->file) != 0){ c->ok = 0; }
+        if(!c->done || !c->ok || rename(c->tmp, c->path) != 0){ remove(c->tmp); }
+    } else if(c->file){
+        fclose(c->file);
+    }
+    free(c->path);
+    free(c->tmp);
+    free(c->buf);
+    free(c);
+}
+
+/* The cache for filename, open as src, if it matches. Otherwise one to */
+/* write, or NULL if caching is off or nothing can be written */
+static lcache* lcache_open(char* filename, FILE* src){
+    if(lcache_off){ return NULL; }
+
+    lcache* c = calloc(1, sizeof(lcache));
+    memcpy(c->h.magic, LCACHE_MAGIC, sizeof(LCACHE_MAGIC));
+    strncpy(c->h.lispy, LISPY_VERSION, sizeof(c->h.lispy));
+    c->h.version = LCACHE_VERSION;
+    c->ok = 1;
+    c->path = malloc(strlen(filename) + 2);
+    sprintf(c->path, "%sc", filename);
+    c->buf = malloc(LCACHE_CHUNK);
+    if(!lcache_hash(src, &c->h.hash, &c->h.source)){
+        lcache_close(c);
+        return NULL;
+    }
+
+    /* Everything but the size has to match, and the size has to be right */
+    c->file = fopen(c->path, "rb");
+    if(c->file){
+        lcache_header h;
+        if(fread(&h, sizeof(h), 1, c->file) == 1
+            && memcmp(&h, &c->h, offsetof(lcache_header, size)) == 0
+            && fseek(c->file, 0, SEEK_END) == 0
+            && (uint64_t)ftell(c->file) == h.size
+            && fseek(c->file, sizeof(h), SEEK_SET) == 0){
+            c->h.size = h.size;
+            return c;
+        }
+        fclose(c->file);
+    }
+
+    c->writing = 1;
+    c->tmp = malloc(strlen(c->path) + 48);
+#ifdef LISPY_HAVE_MMAP
+    sprintf(c->tmp, "%s.%ld.%d.tmp", c->path, (long)getpid(), lcache_serial++);
+#else
+    sprintf(c->tmp, "%s.%d.tmp", c->path, lcache_serial++);
+#endif
+    c->file = fopen(c->tmp, "wb");
+    if(c->file == NULL){
+        lcache_close(c);
+        return NULL;
+    }
+    lcache_write(c, &c->h, sizeof(lcache_header));
+    return c;
+}
+
+/*
+Reader for the Lispy grammar that builds lvals straight from the input
+with no intermediate AST. It accepts exactly what the mpc grammar in
+main does, trying number, symbol, string, comment, sexpr and qexpr in
+that order. Like mpc it remembers the furthest position any alternative failed at
+and everything that would have been accepted there, so errors read the
+same as mpc's.
+*/
+
+#define LREAD_EXPECT_MAX 32
+#define LREAD_CHUNK (64*1024)
+
+typedef struct {
+    char* filename;
+    char* s;
+    int pos;
+    int len;
+
+    /* Files are read a chunk at a time into s, which is size bytes. */
+    /* file is closed and set to NULL once it has all been read */
+    FILE* file;
+    int size;
+
+    /* Row and column of s[0] within the whole input */
+    int row;
+    int col;
+
+    /* Forms read up front by mpc (--mpc), or an error, handed out in turn */
+    lval* forms;
+    int next;
+
+    /* Cache the forms of a file are read from, or written to as they are read */
+    lcache* cache;
+
+    /* Set once a parse error has been returned */
+    int failed;
+
+    /* Furthest failure and what was expected there */
+    int fail;
+    int expect_count;
+    char* expect[LREAD_EXPECT_MAX];
+
+    /* Children of the lists being read, shared by every level */
+    lval** stack;
+    int top;
+    int cap;
+} lreader;
+
+#define LREAD_SYMCHARS "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_+-*/\\=<>!&|"
+#define LREAD_DIGITS "0123456789"
+
+static char lread_symtab[256];
+
+static void lread_expect(lreader* r, int pos, char* what){
+    if(pos < r->fail){ return; }
+    if(pos > r->fail){
+        r->fail = pos;
+        r->expect_count = 0;
+    }
+    for(int i=0;i<r->expect_count;i++){
+        if(strcmp(r->expect[i], what) == 0){ return; }
+    }
+    if(r->expect_count < LREAD_EXPECT_MAX){
+        r->expect[r->expect_count++] = what;
+    }
+}
+
+static int lread_digit(char c){ return c >= '0' && c <= '9'; }
+
+static void lread_space(lreader* r){
+    for(;;){
+        char c = r->s[r->pos];
+        if(c != ' ' && c != '\n' && c != '\t' && c != '\r' && c != '\f' && c != '\v'){ return; }
+        r->pos++;
+    }
+}
+
+static lval* lread_number(lreader* r){
+    char* s = r->s;
+    int i = r->pos;
+
+    if(s[i] == '-'){ i++; }
+    else { lread_expect(r, i, "'-'"); }
+    if(!lread_digit(s[i])){
+        lread_expect(r, i, "one or more of one of '" LREAD_DIGITS "'");
+        return NULL;
+    }
+    while(lread_digit(s[i])){ i++; }
+    lread_expect(r, i, "one of '" LREAD_DIGITS "'");
+
+    /* Optional fraction, backtracking if the '.' has no digits after it */
+    if(s[i] == '.'){
+        if(lread_digit(s[i+1])){
+            i += 2;
+            while(lread_digit(s[i])){ i++; }
+            lread_expect(r, i, "one of '" LREAD_DIGITS "'");
+        } else {
+            lread_expect(r, i+1, "one or more of one of '" LREAD_DIGITS "'");
+        }
+    } else {
+        lread_expect(r, i, "'.'");
+    }
+
+    /* Optional exponent, likewise */
+    if(s[i] == 'e' || s[i] == 'E'){
+        int j = i+1;
+        if(s[j] == '-' || s[j] == '+'){ j++; }
+        else { lread_expect(r, j, "one of '-+'"); }
+        if(lread_digit(s[j])){
+            while(lread_digit(s[j])){ j++; }
+            lread_expect(r, j, "one of '" LREAD_DIGITS "'");
+            i = j;
+        } else {
+            lread_expect(r, j, "one or more of one of '" LREAD_DIGITS "'");
+        }
+    } else {
+        lread_expect(r, i, "one of 'eE'");
+    }
+
+    /* Convert from a NUL terminated copy of the text */
+    int n = i - r->pos;
+    char buf[64];
+    char* text = n < (int)sizeof(buf) ? buf : malloc(n+1);
+    memcpy(text, s + r->pos, n);
+    text[n] = '\0';
+    lval* x = lval_parse_num(text);
+    if(text != buf){ free(text); }
+
+    r->pos = i;
+    return x;
+}
+
+static lval* lread_symbol(lreader* r){
+    char* s = r->s;
+    int i = r->pos;
+    if(!lread_symtab[(unsigned char)s[i]]){
+        lread_expect(r, i, "one or more of one of '" LREAD_SYMCHARS "'");
+        return NULL;
+    }
+    while(lread_symtab[(unsigned char)s[i]]){ i++; }
+    lread_expect(r, i, "one of '" LREAD_SYMCHARS "'");
+
+    int n = i - r->pos;
+    lval* x = lval_new(LVAL_SYM);
+    x->sym = malloc(n+1);
+    lmem_bytes(LVAL_SYM, n+1);
+    memcpy(x->sym, s + r->pos, n);
+    x->sym[n] = '\0';
+
+    r->pos = i;
+    return x;
+}
+
+static lval* lread_string(lreader* r){
+    char* s = r->s;
+    int i = r->pos;
+    if(s[i] != '"'){
+        lread_expect(r, i, "'\"'");
+        return NULL;
+    }
+    i++;
+
+    for(;;){
+        if(s[i] == '\\'){
+            /* A trailing backslash can only be read as a plain character */
+            if(s[i+1] == '\0'){ lread_expect(r, i+1, "any character"); i++; continue; }
+            i += 2;
+            continue;
+        }
+        if(s[i] == '\0'){
+            lread_expect(r, i, "'\\'");
+            lread_expect(r, i, "none of '\"'");
+            lread_expect(r, i, "'\"'");
+            return NULL;
+        }
+        if(s[i] == '"'){ break; }
+        i++;
+    }
+
+    lval* x = lval_str_unescape(s + r->pos + 1, i - r->pos - 1);
+    r->pos = i+1;
+    return x;
+}
+
+static int lread_comment(lreader* r){
+    char* s = r->s;
+    int i = r->pos;
+    if(s[i] != ';'){
+        lread_expect(r, i, "';'");
+        return 0;
+    }
+    i++;
+    while(s[i] && s[i] != '\r' && s[i] != '\n'){ i++; }
+    lread_expect(r, i, "none of '\r\n'");
+    r->pos = i;
+    return 1;
+}
+
+static void lread_push(lreader* r, lval* x){
+    if(r->top == r->cap){
+        r->cap = r->cap ? r->cap * 2 : 64;
+        r->stack = realloc(r->stack, sizeof(lval*) * r->cap);
+    }
+    r->stack[r->top++] = x;
+}
+
+static int lread_list(lreader* r, lval* x, char close, char* expected);
+
+/* Read one expression, returning 1 and pushing it unless it was a comment. */
+/* Returns 0 if nothing matched, or -1 on a hard error inside a list */
+static int lread_expr(lreader* r){
+    lval* x;
+    if((x = lread_number(r)) || (x = lread_symbol(r)) || (x = lread_string(r))){
+        lread_space(r);
+        lread_push(r, x);
+        return 1;
+    }
+    if(r->s[r->pos] == '"'){ return -1; }
+    if(lread_comment(r)){
+        lread_space(r);
+        return 1;
+    }
+
+    char c = r->s[r->pos];
+    if(c == '('){ r->pos++; lread_space(r); return lread_list(r, lval_sexpr(), ')', "')'"); }
+    lread_expect(r, r->pos, "'('");
+    if(c == '{'){ r->pos++; lread_space(r); return lread_list(r, lval_qexpr(), '}', "'}'"); }
+    lread_expect(r, r->pos, "'{'");
+    return 0;
+}
+
+/* Read expressions up to the closing character into x and push it */
+static int lread_list(lreader* r, lval* x, char close, char* expected){
+    int base = r->top;
+    int res;
+    while((res = lread_expr(r)) == 1){}
+
+    if(res < 0 || r->s[r->pos] != close){
+        if(res == 0){ lread_expect(r, r->pos, expected); }
+        while(r->top > base){ lval_del(r->stack[--r->top]); }
+        lval_del(x);
+        return -1;
+    }
+    r->pos++;
+    lread_space(r);
+
+    /* Move the children over in one go */
+    if(r->top > base){
+        x->count = r->top - base;
+        x->cell = malloc(sizeof(lval*) * x->count);
+        memcpy(x->cell, r->stack + base, sizeof(lval*) * x->count);
+        r->top = base;
+    }
+    lread_push(r, x);
+    return 1;
+}
+
+/* Format the furthest failure the way mpc_err_string does */
+static lval* lread_error(lreader* r){
+    int row = r->row;
+    int col = r->col;
+    for(int i=0;i<r->fail;i++){
+        if(r->s[i] == '\n'){ row++; col = 0; }
+        else { col++; }
+    }
+
+    lval* msg = lval_str("");
+    char buf[64];
+    snprintf(buf, sizeof(buf), ":%i:%i: error: expected ", row+1, col+1);
+    lval_str_append(msg, r->filename, strlen(r->filename));
+    lval_str_append(msg, buf, strlen(buf));
+    for(int i=0;i<r->expect_count;i++){
+        if(i){ lval_str_append(msg, i == r->expect_count-1 ? " or " : ", ", i == r->expect_count-1 ? 4 : 2); }
+        lval_str_append(msg, r->expect[i], strlen(r->expect[i]));
+    }
+
+    char at[4] = {'\'', r->s[r->fail], '\'', '\0'};
+    char* got = at;
+    switch(r->s[r->fail]){
+        case '\a': got = "bell"; break;
+        case '\b': got = "backspace"; break;
+        case '\f': got = "formfeed"; break;
+        case '\r': got = "carriage return"; break;
+        case '\v': got = "vertical tab"; break;
+        case '\0': got = "end of input"; break;
+        case '\n': got = "newline"; break;
+        case '\t': got = "tab"; break;
+        case ' ': got = "space"; break;
+    }
+    lval_str_append(msg, " at ", 4);
+    lval_str_append(msg, got, strlen(got));
+    lval_str_append(msg, "\n", 1);
+
+    lval* err = lval_new(LVAL_ERR);
+    err->err = msg->str;
+    msg->str = NULL;
+    lval_free(msg);
+    return err;
+}
+
+static void lread_tables(void){
+    if(!lread_symtab['a']){
+        for(char* c = LREAD_SYMCHARS; *c; c++){ lread_symtab[(unsigned char)*c] = 1; }
+    }
+}
+
+static void lread_init(lreader* r, char* filename, char* s){
+    lread_tables();
+
+    r->filename = filename;
+    r->s = s;
+    r->pos = 0;
+    r->len = strlen(s);
+    r->file = NULL;
+    r->size = 0;
+    r->row = 0;
+    r->col = 0;
+    r->forms = NULL;
+    r->next = 0;
+    r->cache = NULL;
+    r->failed = 0;
+    r->fail = -1;
+    r->expect_count = 0;
+    r->stack = NULL;
+    r->top = 0;
+    r->cap = 0;
+}
+
+/* Start reading a file one form at a time */
+static void lread_open(lreader* r, char* filename){
+    lread_init(r, filename, "");
+
+    if(lread_use_mpc){
+        r->forms = lval_read_mpc(filename, NULL);
+        return;
+    }
+
+    r->file = fopen(filename, "rb");
+    if(r->file == NULL){
+        r->forms = lval_err("%s: error: Unable to open file!\n", filename);
+        return;
+    }
+
+    /* With a matching cache the source isn't needed */
+    r->cache = lcache_open(filename, r->file);
+    if(r->cache && !r->cache->writing){
+        fclose(r->file);
+        r->file = NULL;
+        return;
+    }
+    r->size = LREAD_CHUNK + 1;
+    r->s = malloc(r->size);
+    r->s[0] = '\0';
+}
+
+static void lread_free(lreader* r){
+    if(r->file){ fclose(r->file); }
+    if(r->cache){ lcache_close(r->cache); }
+    if(r->size){ free(r->s); }
+    if(r->forms){
+        if(r->forms->type != LVAL_ERR){
+            /* The forms before next have been handed out already */
+            for(int i=r->next;i<r->forms->count;i++){ lval_del(r->forms->cell[i]); }
+            r->forms->count = 0;
+        }
+        lval_del(r->forms);
+    }
+    free(r->stack);
+}
+
+/* Drop what has been read and append the next chunk of the file */
+static void lread_fill(lreader* r){
+    for(int i=0;i<r->pos;i++){
+        if(r->s[i] == '\n'){ r->row++; r->col = 0; }
+        else { r->col++; }
+    }
+    memmove(r->s, r->s + r->pos, r->len - r->pos);
+    r->len -= r->pos;
+    if(r->fail >= r->pos){ r->fail -= r->pos; }
+    else { r->fail = -1; r->expect_count = 0; }
+    r->pos = 0;
+
+    /* Grow when a single form is too big for what is left */
+    if(r->size - r->len - 1 < LREAD_CHUNK){
+        r->size *= 2;
+        r->s = realloc(r->s, r->size);
+    }
+
+    int n = fread(r->s + r->len, 1, r->size - r->len - 1, r->file);
+    r->len += n;
+    r->s[r->len] = '\0';
+    if(n == 0){
+        fclose(r->file);
+        r->file = NULL;
+    }
+}
+
+/* Next form from a matching cache. One that turns out to be damaged is */
+/* removed so the source is read next time */
+static lval* lread_cached(lreader* r){
+    int t = lcache_getc(r->cache);
+    if(t == LCACHE_END){ return NULL; }
+
+    lval* x = t < 0 ? NULL : lcache_get(r->cache, t);
+    if(x){ return x; }
+    r->failed = 1;
+    remove(r->cache->path);
+    return lval_err("%s: error: Cache %s was damaged and has been removed",
+        r->filename, r->cache->path);
+}
+
+/*
+Read the next top-level form, returning NULL at the end of the input.
+On a parse error failed is set and the error is returned instead.
+
+A form that runs into the end of what has been read so far, or whose
+reading looked at that position, is read again with more of the file.
+Anything that looks at a position records a failure there, so checking
+the furthest failure catches every case.
+*/
+static lval* lread_next(lreader* r){
+    if(r->forms){
+        if(r->forms->type == LVAL_ERR){
+            lval* err = r->forms;
+            r->forms = NULL;
+            r->failed = 1;
+            return err;
+        }
+        if(r->next == r->forms->count){ return NULL; }
+        return r->forms->cell[r->next++];
+    }
+    if(r->failed){ return NULL; }
+    if(r->cache && !r->cache->writing){ return lread_cached(r); }
+
+    for(;;){
+        lread_space(r);
+        if(r->pos == r->len && r->file){
+            lread_fill(r);
+            continue;
+        }
+        if(r->s[r->pos] == '\0'){
+            if(r->cache){ r->cache->done = 1; }
+            return NULL;
+        }
+
+        /* Keep the failures so far in case the form has to be read again */
+        int start = r->pos;
+        int fail = r->fail;
+        int expect_count = r->expect_count;
+        char* expect[LREAD_EXPECT_MAX];
+        if(r->file){ memcpy(expect, r->expect, sizeof(char*) * expect_count); }
+
+        int res = lread_expr(r);
+        if(r->file && (r->pos >= r->len || r->fail >= r->len)){
+            while(r->top > 0){ lval_del(r->stack[--r->top]); }
+            r->pos = start;
+            r->fail = fail;
+            r->expect_count = expect_count;
+            memcpy(r->expect, expect, sizeof(char*) * expect_count);
+            lread_fill(r);
+            continue;
+        }
+
+        if(res == 1){
+            /* Comments leave nothing behind */
+            if(r->top == 0){ continue; }
+            if(r->cache){ lcache_put(r->cache, r->stack[r->top-1]); }
+            return r->stack[--r->top];
+        }
+
+        if(res == 0){ lread_expect(r, r->pos, "end of input"); }
+        while(r->top > 0){ lval_del(r->stack[--r->top]); }
+        r->failed = 1;
+        return lread_error(r);
+    }
+}
+
+/* Read every expression in a NUL terminated buffer into an S-Expression */
+lval* lval_read_src(char* filename, char* s){
+    if(lread_use_mpc){ return lval_read_mpc(filename, s); }
+
+    lreader r;
+    lread_init(&r, filename, s);
+
+    lval* x = lval_sexpr();
+    lval* y;
+    while((y = lread_next(&r))){
+        if(r.failed){
+            lval_del(x);
+            x = y;
+            break;
+        }
+        x = lval_add(x, y);
+    }
+
+    lread_free(&r);
+    return x;
+}
+
+/* Printed output is gathered here and written out by lout_flush, once */
+/* per result or print call rather than once per atom */
+static struct {
+    char* data;
+    int len;
+    int cap;
+} lout;
+
+/* Past this size the buffer is flushed rather than grown further */
+#define LOUT_FLUSH_AT (1 << 20)
+
+#define lout_putc(c) \
+    do { if(lout.len == lout.cap){ lout_reserve(1); } lout.data[lout.len++] = (c); } while(0)
+
+void lout_reserve(int n){
+    if(lout.len + n <= lout.cap){ return; }
+    if(lout.len >= LOUT_FLUSH_AT){
+        lout_flush();
+        if(n <= lout.cap){ return; }
+    }
+    int cap = lout.cap ? lout.cap : 4096;
+    while(lout.len + n > cap){ cap *= 2; }
+    lout.data = realloc(lout.data, cap);
+    lout.cap = cap;
+}
+
+void lout_write(char* s, int n){
+    lout_reserve(n);
+    memcpy(lout.data + lout.len, s, n);
+    lout.len += n;
+}
+
+void lout_puts(char* s){
+    lout_write(s, strlen(s));
+}
+
+static char ldigits[] =
+    "0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+    "5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+/* Format two digits at a time from the right */
+void lout_long(long x){
+    char buf[24];
+    char* p = buf + sizeof(buf);
+    unsigned long u = x < 0 ? 0UL - (unsigned long)x : (unsigned long)x;
+    while(u >= 100){
+        p -= 2;
+        memcpy(p, ldigits + 2 * (u % 100), 2);
+        u /= 100;
+    }
+    if(u >= 10){ p -= 2; memcpy(p, ldigits + 2 * u, 2); }
+    else { *--p = (char)('0' + u); }
+    if(x < 0){ *--p = '-'; }
+    lout_write(p, buf + sizeof(buf) - p);
+}
+
+/* Exactly nine digits with leading zeros */
+static void lout_digits9(uint32_t x){
+    char buf[9];
+    for(int i=8;i>=0;i--){ buf[i] = (char)('0' + x % 10); x /= 10; }
+    lout_write(buf, 9);
+}
+
+void lout_flush(void){
+    fwrite(lout.data, 1, lout.len, stdout);
+    fflush(stdout);
+    lout.len = 0;
+}
+
+void lval_expr_print(lval* v,char open, char close){
+    lout_putc(open);
+    for(int i=0;i<v->count;i++){
+        /*Print value contained within*/
+        lval_print(v->cell[i]);
+
+        /*Don't print trailing space if last element*/
+        if(i != v->count-1){
+            lout_putc(' ');
+        }
+    }
+    lout_putc(close);
+}
+
+void lval_map_print(lval* v){
+    int first = 1;
+    lout_puts("#{");
+    for(int i=0;i<v->map->slots;i++){
+        if(!LMAP_LIVE(v->map, i)){ continue; }
+        if(!first){ lout_puts(", "); }
+        lval_print(v->map->keys[i]); lout_putc(' '); lval_print(v->map->vals[i]);
+        first = 0;
+    }
+    lout_putc('}');
+}
+
+void lval_vec_print(lval* v){
+    lout_puts("#[");
+    for(int i=0;i<v->vec->count;i++){
+        if(i){ lout_putc(' '); }
+        if(v->vec->dbl){
+            lval x;
+            x.type = LVAL_DBL;
+            x.dbl = v->vec->d[i];
+            lval_print_dbl(&x);
+        } else {
+            lout_long(v->vec->i[i]);
+        }
+    }
+    lout_putc(']');
+}
+
+/* Letter to print after a backslash for each byte that needs escaping */
+static char lstr_escape_tab[256] = {
+    ['\a'] = 'a', ['\b'] = 'b', ['\f'] = 'f', ['\n'] = 'n', ['\r'] = 'r',
+    ['\t'] = 't', ['\v'] = 'v', ['\\'] = '\\', ['\''] = '\'', ['"'] = '"',
+    ['\0'] = '0'
+};
+
+/* Copy runs of plain bytes straight into the buffer between escapes */
+static void lstr_print_escaped(char* s, int n){
+    int i = 0;
+    while(i < n){
+        int start = i;
+        while(i < n && !lstr_escape_tab[(unsigned char)s[i]]){ i++; }
+        lout_write(s + start, i - start);
+        if(i < n){
+            lout_putc('\\');
+            lout_putc(lstr_escape_tab[(unsigned char)s[i]]);
+            i++;
+        }
+    }
+}
+
+/* Print the leaves of a rope in order without flattening it */
+static void lrope_print(lrope* r){
+    if(r->leaf){ lstr_print_escaped(r->leaf, r->len); return; }
+    lrope_print(r->left);
+    lrope_print(r->right);
+}
+
+void lval_print_str(lval* v){
+    /* Print between " characters, escaping as we go */
+    lout_putc('"');
+    if(v->rope){ lrope_print(v->rope); }
+    else { lstr_print_escaped(v->str, v->len); }
+    lout_putc('"');
+}
+
+void lval_print_dbl(lval* v){
+    char buf[32];
+
+    /* Use the shortest precision that reads back as the same value */
+    for(int p = 15; p <= 17; p++){
+        snprintf(buf, sizeof(buf), "%.*g", p, v->dbl);
+        if(strtod(buf,NULL) == v->dbl){ break; }
+    }
+
+    /* Keep whole Doubles distinguishable from Numbers */
+    if(!strpbrk(buf,".eEni")){ strcat(buf,".0"); }
+    lout_puts(buf);
+}
+
+void lval_print_big(lval* v){
+    lbig* b = v->big;
+
+    /* Zero, or no limbs at all, has no chunks to print */
+    int len = b->len;
+    while(len > 0 && b->d[len-1] == 0){ len--; }
+    if(len == 0){ lout_putc('0'); return; }
+
+    /* Peel off base 10^9 chunks by repeated division of a scratch copy */
+    uint32_t* t = malloc(sizeof(uint32_t) * len);
+    uint32_t* chunks = malloc(sizeof(uint32_t) * (len * 2 + 1));
+    memcpy(t, b->d, sizeof(uint32_t) * len);
+
+    int n = 0;
+    do {
+        uint64_t rem = 0;
+        for(int i=len-1;i>=0;i--){
+            uint64_t cur = (rem << 32) | t[i];
+            t[i] = (uint32_t)(cur / 1000000000);
+            rem = cur % 1000000000;
+        }
+        chunks[n++] = (uint32_t)rem;
+        while(len > 0 && t[len-1] == 0){ len--; }
+    } while(len > 0);
+
+    if(b->neg){ lout_putc('-'); }
+    lout_long(chunks[n-1]);
+    for(int i=n-2;i>=0;i--){ lout_digits9(chunks[i]); }
+
+    free(chunks);
+    free(t);
+}
+
+void lval_print(lval* v){
+    switch (v->type) {
+        case LVAL_NUM: lout_long(v->num); break;
+        case LVAL_DBL: lval_print_dbl(v); break;
+        case LVAL_BIG: lval_print_big(v); break;
+        case LVAL_VEC: lval_vec_print(v); break;
+        case LVAL_ERR: lout_puts("Error: "); lout_puts(v->err); break;
+        case LVAL_SYM: lout_puts(v->sym); break;
+        case LVAL_STR: lval_print_str(v); break;
+        case LVAL_SEXPR: lval_expr_print(v,'(',')'); break;
+        case LVAL_QEXPR: lval_expr_print(v,'{','}'); break;
+        case LVAL_MAP: lval_map_print(v); break;
+        case LVAL_FUN: 
+            if(v->builtin){
+                lout_puts("<builtin>");
+            } else {
+                lout_putc('\\'); lval_print(v->formals);
+                lout_putc(' '); lval_print(v->body); lout_putc(')');
+            } 
+        break;
+    }
+}
+
+void lval_println(lval* v){lval_print(v); lout_putc('\n'); lout_flush();}
+
+lval* lval_pop(lval* v, int i){
+    /* Find the item at i */
+    lval* x = v->cell[i];
+
+    /* Shift memory after the item "i" is over the top */
+    memmove(&v->cell[i],&v->cell[i+1],
+        sizeof(lval*) * (v->count-i-1));
+
+    /* Decrease the count of items in the list */
+    v->count--;
+    
+    /*reallocate the memory used*/
+    v->cell = realloc(v->cell,sizeof(lval*) * v->count);
+
+    return x;
+}
+
+lval* lval_take(lval* v, int i){
+    lval* x = lval_pop(v,i);
+    lval_del(v);
+    return x;
+}
+
+lval* lval_join(lval* x, lval* y){
+    /*For each cell in 'y' add it to 'x'*/
+    while(y->count){
+        x = lval_add(x,lval_pop(y,0));
+    }
+    lval_del(y);
+    return x;
+}
+
+long lval_len(lval* y){
+    long x = 0;
+    while(y->count){
+        lval* temp = lval_pop(y,0);
+        x++; 
+        lval_del(temp);
+    }
+    lval_del(y);
+    return x;
+}
+
+lval* lval_init(lval* x, lval* y){
+    while(y->count-1 != 0){
+        x = lval_add(x,lval_pop(y,0));
+    }
+    lval_del(y);
+    return x;
+}
+
+char* ltype_name(int t){
+    switch(t){
+        case LVAL_FUN: return "Function";
+        case LVAL_NUM: return "Number";
+        case LVAL_DBL: return "Double";
+        case LVAL_BIG: return "Bignum";
+        case LVAL_VEC: return "Vector";
+        case LVAL_ERR: return "Error";
+        case LVAL_SYM: return "Symbol";
+        case LVAL_STR: return "String";
+        case LVAL_SEXPR: return "S-Expression";
+        case LVAL_QEXPR: return "Q-Expression";
+        case LVAL_MAP: return "Map";
+        default: return "Unknown";
+    }
+}
+
+lmap* lmap_new(int slots){
+    lmap* m = malloc(sizeof(lmap));
+    m->refs = 1;
+    m->count = 0;
+    m->used = 0;
+    m->slots = slots;
+    m->hashes = malloc(sizeof(unsigned long) * slots);
+    m->keys = calloc(slots, sizeof(lval*));
+    m->vals = malloc(sizeof(lval*) * slots);
+    return m;
+}
+
+void lmap_release(lmap* m){
+    /* Only the last reference frees the table */
+    if(--m->refs > 0){ return; }
+    for(int i=0;i<m->slots;i++){
+        if(!LMAP_LIVE(m, i)){ continue; }
+        lval_del(m->keys[i]);
+        lval_del(m->vals[i]);
+    }
+    free(m->hashes);
+    free(m->keys);
+    free(m->vals);
+    free(m);
+}
+
+/* Return the slot holding k, or -1 if it is absent */
+int lmap_find(lmap* m, lval* k, unsigned long h){
+    unsigned long mask = m->slots - 1;
+    for(unsigned long i = h & mask;;i = (i+1) & mask){
+        lval* x = m->keys[i];
+        if(x == NULL){ return -1; }
+        if(x != &lmap_tomb && m->hashes[i] == h && lval_eq(x,k)){
+            return (int)i;
+        }
+    }
+}
+
+/* Rehash live entries into a table sized for the current count */
+static void lmap_resize(lmap* m, int slots){
+    unsigned long* hashes = m->hashes;
+    lval** keys = m->keys;
+    lval** vals = m->vals;
+    int old = m->slots;
+
+    m->slots = slots;
+    m->used = m->count;
+    m->hashes = malloc(sizeof(unsigned long) * slots);
+    m->keys = calloc(slots, sizeof(lval*));
+    m->vals = malloc(sizeof(lval*) * slots);
+
+    for(int i=0;i<old;i++){
+        if(keys[i] == NULL || keys[i] == &lmap_tomb){ continue; }
+        unsigned long j = hashes[i] & (slots-1);
+        while(m->keys[j]){ j = (j+1) & (slots-1); }
+        m->hashes[j] = hashes[i];
+        m->keys[j] = keys[i];
+        m->vals[j] = vals[i];
+    }
+    /* Tables from an image are left in place */
+    if(!LIMAGE_OWNS(keys)){ free(hashes); free(keys); free(vals); }
+}
+
+/* Insert or replace an entry, taking ownership of k and v */
+void lmap_put(lmap* m, lval* k, lval* v){
+    unsigned long h = lval_hash(k);
+    int i = lmap_find(m,k,h);
+    if(i >= 0){
+        lval_del(k);
+        lval_del(m->vals[i]);
+        m->vals[i] = v;
+        return;
+    }
+
+    /* Keep load factor including deleted slots below 3/4 */
+    if((m->used+1) * 4 > m->slots * 3){
+        int slots = 8;
+        while(slots * 3 <= (m->count+1) * 4 * 2){ slots *= 2; }
+        lmap_resize(m, slots);
+    }
+
+    unsigned long j = h & (m->slots-1);
+    while(m->keys[j] && m->keys[j] != &lmap_tomb){ j = (j+1) & (m->slots-1); }
+    if(m->keys[j] == NULL){ m->used++; }
+    m->hashes[j] = h;
+    m->keys[j] = k;
+    m->vals[j] = v;
+    m->count++;
+}
+
+/* Remove an entry, returning 0 if it was not present */
+int lmap_del(lmap* m, lval* k){
+    int i = lmap_find(m,k,lval_hash(k));
+    if(i < 0){ return 0; }
+    lval_del(m->keys[i]);
+    lval_del(m->vals[i]);
+    m->keys[i] = &lmap_tomb;
+    m->count--;
+    return 1;
+}
+
+int lmap_eq(lmap* x, lmap* y){
+    if(x == y){ return 1; }
+    if(x->count != y->count){ return 0; }
+    for(int i=0;i<x->slots;i++){
+        if(!LMAP_LIVE(x, i)){ continue; }
+        int j = lmap_find(y, x->keys[i], x->hashes[i]);
+        if(j < 0 || !lval_eq(x->vals[i], y->vals[j])){ return 0; }
+    }
+    return 1;
+}
+
+/* Whether v holds m, directly or through lists, other maps or functions. */
+/* map-put refuses values that do, so no map ever reaches itself and */
+/* printing, hashing and freeing maps always terminate */
+int lmap_reached(lmap* m, lval* v){
+    switch(v->type){
+        case LVAL_MAP:
+            if(v->map == m){ return 1; }
+            for(int i=0;i<v->map->slots;i++){
+                if(!LMAP_LIVE(v->map, i)){ continue; }
+                if(lmap_reached(m, v->map->keys[i]) || lmap_reached(m, v->map->vals[i])){ return 1; }
+            }
+            return 0;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            for(int i=0;i<v->count;i++){
+                if(lmap_reached(m, v->cell[i])){ return 1; }
+            }
+            return 0;
+        case LVAL_FUN:
+            if(v->builtin){ return 0; }
+            for(int i=0;i<v->env->count;i++){
+                if(lmap_reached(m, v->env->vals[i])){ return 1; }
+            }
+            return lmap_reached(m, v->formals) || lmap_reached(m, v->body);
+        default:
+            return 0;
+    }
+}
+
+/* Whether v holds a Map anywhere it would be hashed. Keys holding one */
+/* are refused, as changing the map would leave their stored hash stale */
+int lval_has_map(lval* v){
+    switch(v->type){
+        case LVAL_MAP: return 1;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            for(int i=0;i<v->count;i++){
+                if(lval_has_map(v->cell[i])){ return 1; }
+            }
+            return 0;
+        case LVAL_FUN:
+            if(v->builtin){ return 0; }
+            return lval_has_map(v->formals) || lval_has_map(v->body);
+        default:
+            return 0;
+    }
+}
+
+/* Number of digits once leading zeros are dropped */
+static int mag_trim(const uint32_t* a, int n){
+    while(n > 0 && a[n-1] == 0){ n--; }
+    return n;
+}
+
+static int mag_cmp(const uint32_t* a, int an, const uint32_t* b, int bn){
+    an = mag_trim(a,an);
+    bn = mag_trim(b,bn);
+    if(an != bn){ return an > bn ? 1 : -1; }
+    for(int i=an-1;i>=0;i--){
+        if(a[i] != b[i]){ return a[i] > b[i] ? 1 : -1; }
+    }
+    return 0;
+}
+
+/* r = a + b, r must have room for max(an,bn)+1 digits */
+static int mag_add(uint32_t* r, const uint32_t* a, int an, const uint32_t* b, int bn){
+    if(an < bn){
+        const uint32_t* t = a; a = b; b = t;
+        int tn = an; an = bn; bn = tn;
+    }
+    uint64_t c = 0;
+    for(int i=0;i<an;i++){
+        c += (uint64_t)a[i] + (i < bn ? b[i] : 0);
+        r[i] = (uint32_t)c;
+        c >>= 32;
+    }
+    r[an] = (uint32_t)c;
+    return an+1;
+}
+
+/* r = a - b where a >= b, r must have room for an digits */
+static void mag_sub(uint32_t* r, const uint32_t* a, int an, const uint32_t* b, int bn){
+    int64_t c = 0;
+    for(int i=0;i<an;i++){
+        c += (int64_t)a[i] - (i < bn ? b[i] : 0);
+        r[i] = (uint32_t)c;
+        c = c < 0 ? -1 : 0;
+    }
+}
+
+/* r += x, the sum must fit in rn digits */
+static void mag_add_at(uint32_t* r, int rn, const uint32_t* x, int xn){
+    xn = mag_trim(x,xn);
+    uint64_t c = 0;
+    for(int i=0;i<rn && (i < xn || c);i++){
+        c += (uint64_t)r[i] + (i < xn ? x[i] : 0);
+        r[i] = (uint32_t)c;
+        c >>= 32;
+    }
+}
+
+/* r -= x, where r >= x */
+static void mag_sub_at(uint32_t* r, int rn, const uint32_t* x, int xn){
+    xn = mag_trim(x,xn);
+    int64_t c = 0;
+    for(int i=0;i<rn && (i < xn || c);i++){
+        c += (int64_t)r[i] - (i < xn ? x[i] : 0);
+        r[i] = (uint32_t)c;
+        c = c < 0 ? -1 : 0;
+    }
+}
+
+/* r = a * b, r must be zeroed with room for an+bn digits */
+static void mag_mul(uint32_t* r, const uint32_t* a, int an, const uint32_t* b, int bn){
+    if(an < bn){
+        const uint32_t* t = a; a = b; b = t;
+        int tn = an; an = bn; bn = tn;
+    }
+
+    /* Schoolbook for small operands */
+    if(bn < LBIG_KARATSUBA){
+        for(int i=0;i<bn;i++){
+            uint64_t c = 0;
+            for(int j=0;j<an;j++){
+                c += (uint64_t)a[j] * b[i] + r[i+j];
+                r[i+j] = (uint32_t)c;
+                c >>= 32;
+            }
+            r[i+an] = (uint32_t)c;
+        }
+        return;
+    }
+
+    /* Lopsided operands are multiplied a slice of a at a time */
+    if(an >= 2*bn){
+        uint32_t* t = malloc(sizeof(uint32_t) * 2 * bn);
+        for(int i=0;i<an;i+=bn){
+            int n = an-i < bn ? an-i : bn;
+            memset(t, 0, sizeof(uint32_t) * (n+bn));
+            mag_mul(t, a+i, n, b, bn);
+            mag_add_at(r+i, an+bn-i, t, n+bn);
+        }
+        free(t);
+        return;
+    }
+
+    /* Karatsuba: with a = a1*B^m + a0 and b = b1*B^m + b0, */
+    /* a*b = z2*B^2m + ((a0+a1)(b0+b1) - z2 - z0)*B^m + z0  */
+    int m = an/2;
+    int hn = an-m;
+    int kn = bn-m;
+
+    uint32_t* z0 = calloc(2*m, sizeof(uint32_t));
+    uint32_t* z2 = calloc(hn+kn, sizeof(uint32_t));
+    uint32_t* sa = malloc(sizeof(uint32_t) * (hn+1));
+    uint32_t* sb = malloc(sizeof(uint32_t) * ((kn > m ? kn : m)+1));
+    mag_mul(z0, a, m, b, m);
+    mag_mul(z2, a+m, hn, b+m, kn);
+    int san = mag_add(sa, a, m, a+m, hn);
+    int sbn = mag_add(sb, b, m, b+m, kn);
+
+    uint32_t* z1 = calloc(san+sbn, sizeof(uint32_t));
+    mag_mul(z1, sa, san, sb, sbn);
+    mag_sub_at(z1, san+sbn, z0, 2*m);
+    mag_sub_at(z1, san+sbn, z2, hn+kn);
+
+    mag_add_at(r, an+bn, z0, 2*m);
+    mag_add_at(r+2*m, an+bn-2*m, z2, hn+kn);
+    mag_add_at(r+m, an+bn-m, z1, san+sbn);
+
+    free(z0); free(z2); free(z1);
+    free(sa); free(sb);
+}
+
+/* Knuth's algorithm D: q = u / v and r = u % v for un >= vn >= 1 with a */
+/* nonzero top digit in v. q needs un-vn+1 digits and r needs vn digits */
+static void mag_divmod(uint32_t* q, uint32_t* r,
+    const uint32_t* u, int un, const uint32_t* v, int vn){
+
+    /* Short division by a single digit */
+    if(vn == 1){
+        uint64_t rem = 0;
+        for(int j=un-1;j>=0;j--){
+            uint64_t cur = (rem << 32) | u[j];
+            q[j] = (uint32_t)(cur / v[0]);
+            rem = cur % v[0];
+        }
+        r[0] = (uint32_t)rem;
+        return;
+    }
+
+    /* Normalise so the top digit of v has its high bit set */
+    int s = __builtin_clz(v[vn-1]);
+    uint32_t* vs = malloc(sizeof(uint32_t) * vn);
+    uint32_t* us = malloc(sizeof(uint32_t) * (un+1));
+    for(int i=vn-1;i>0;i--){
+        vs[i] = (v[i] << s) | (s ? v[i-1] >> (32-s) : 0);
+    }
+    vs[0] = v[0] << s;
+    us[un] = s ? u[un-1] >> (32-s) : 0;
+    for(int i=un-1;i>0;i--){
+        us[i] = (u[i] << s) | (s ? u[i-1] >> (32-s) : 0);
+    }
+    us[0] = u[0] << s;
+
+    const uint64_t base = (uint64_t)1 << 32;
+    for(int j=un-vn;j>=0;j--){
+        /* Estimate the quotient digit from the top two digits */
+        uint64_t num = ((uint64_t)us[j+vn] << 32) | us[j+vn-1];
+        uint64_t qhat = num / vs[vn-1];
+        uint64_t rhat = num % vs[vn-1];
+        while(qhat >= base || qhat * vs[vn-2] > ((rhat << 32) | us[j+vn-2])){
+            qhat--;
+            rhat += vs[vn-1];
+            if(rhat >= base){ break; }
+        }
+
+        /* Multiply and subtract */
+        int64_t k = 0;
+        int64_t t;
+        for(int i=0;i<vn;i++){
+            uint64_t p = qhat * vs[i];
+            t = (int64_t)us[i+j] - k - (int64_t)(p & 0xffffffffUL);
+            us[i+j] = (uint32_t)t;
+            k = (int64_t)(p >> 32) - (t >> 32);
+        }
+        t = (int64_t)us[j+vn] - k;
+        us[j+vn] = (uint32_t)t;
+
+        /* The estimate was one too large so add back */
+        q[j] = (uint32_t)qhat;
+        if(t < 0){
+            q[j]--;
+            uint64_t c = 0;
+            for(int i=0;i<vn;i++){
+                c += (uint64_t)us[i+j] + vs[i];
+                us[i+j] = (uint32_t)c;
+                c >>= 32;
+            }
+            us[j+vn] += (uint32_t)c;
+        }
+    }
+
+    /* Unnormalise the remainder */
+    for(int i=0;i<vn;i++){
+        r[i] = (us[i] >> s) | (s ? us[i+1] << (32-s) : 0);
+    }
+    free(vs);
+    free(us);
+}
+
+/* Allocate a zeroed Bignum with room for len digits */
+lbig* lbig_new(int len){
+    lbig* b = calloc(1, sizeof(lbig) + sizeof(uint32_t) * (len > 0 ? len : 1));
+    b->neg = 0;
+    b->len = len;
+    b->d = (uint32_t*)(b+1);
+    return b;
+}
+
+lbig* lbig_copy(lbig* b){
+    lbig* x = lbig_new(b->len);
+    x->neg = b->neg;
+    memcpy(x->d, b->d, sizeof(uint32_t) * b->len);
+    return x;
+}
+
+static lbig* lbig_trim(lbig* b){
+    b->len = mag_trim(b->d, b->len);
+    if(b->len == 0){ b->neg = 0; }
+    return b;
+}
+
+/* Parse an optionally signed run of decimal digits */
+lbig* lbig_read(char* s){
+    int neg = (*s == '-');
+    if(neg){ s++; }
+
+    int digits = strlen(s);
+    lbig* b = lbig_new(digits/9 + 2);
+    b->len = 0;
+
+    /* Fold in up to nine digits at a time */
+    int k = digits % 9 ? digits % 9 : 9;
+    while(*s){
+        uint32_t chunk = 0;
+        uint32_t scale = 1;
+        for(int i=0;i<k;i++){
+            chunk = chunk * 10 + (*s++ - '0');
+            scale *= 10;
+        }
+        uint64_t c = chunk;
+        for(int i=0;i<b->len;i++){
+            c += (uint64_t)b->d[i] * scale;
+            b->d[i] = (uint32_t)c;
+            c >>= 32;
+        }
+        if(c){ b->d[b->len++] = (uint32_t)c; }
+        k = 9;
+    }
+
+    b->neg = neg;
+    return lbig_trim(b);
+}
+
+/* Convert a whole, finite Double */
+lbig* lbig_from_dbl(double x){
+    int exp;
+    double m = fabs(x);
+    frexp(m, &exp);
+    int len = exp > 0 ? (exp+31)/32 : 0;
+
+    lbig* b = lbig_new(len);
+    for(int i=len-1;i>=0;i--){
+        double p = ldexp(1.0, 32*i);
+        double digit = floor(m / p);
+        b->d[i] = (uint32_t)digit;
+        m -= digit * p;
+    }
+    b->neg = x < 0;
+    return lbig_trim(b);
+}
+
+/* a + b, or a - b if sub is set */
+lbig* lbig_add(lbig* a, lbig* b, int sub){
+    int bneg = b->neg ^ sub;
+    lbig* r;
+
+    /* Same signs add magnitudes, otherwise take the smaller from the larger */
+    if(a->neg == bneg){
+        r = lbig_new((a->len > b->len ? a->len : b->len) + 1);
+        mag_add(r->d, a->d, a->len, b->d, b->len);
+        r->neg = a->neg;
+    } else if(mag_cmp(a->d, a->len, b->d, b->len) >= 0){
+        r = lbig_new(a->len);
+        mag_sub(r->d, a->d, a->len, b->d, b->len);
+        r->neg = a->neg;
+    } else {
+        r = lbig_new(b->len);
+        mag_sub(r->d, b->d, b->len, a->d, a->len);
+        r->neg = bneg;
+    }
+    return lbig_trim(r);
+}
+
+lbig* lbig_mul(lbig* a, lbig* b){
+    lbig* r = lbig_new(a->len + b->len);
+    if(a->len && b->len){
+        mag_mul(r->d, a->d, a->len, b->d, b->len);
+    }
+    r->neg = a->neg ^ b->neg;
+    return lbig_trim(r);
+}
+
+/* Truncating a / b, or the remainder with the sign of a if rem is set */
+lbig* lbig_div(lbig* a, lbig* b, int rem){
+    if(mag_cmp(a->d, a->len, b->d, b->len) < 0){
+        return rem ? lbig_copy(a) : lbig_new(0);
+    }
+
+    lbig* q = lbig_new(a->len - b->len + 1);
+    lbig* r = lbig_new(b->len);
+    mag_divmod(q->d, r->d, a->d, a->len, b->d, b->len);
+    q->neg = a->neg ^ b->neg;
+    r->neg = a->neg;
+
+    if(rem){ free(q); return lbig_trim(r); }
+    free(r);
+    return lbig_trim(q);
+}
+
+int lbig_cmp(lbig* a, lbig* b){
+    if(a->neg != b->neg){ return a->neg ? -1 : 1; }
+    int c = mag_cmp(a->d, a->len, b->d, b->len);
+    return a->neg ? -c : c;
+}
+
+double lbig_to_dbl(lbig* b){
+    double x = 0.0;
+    for(int i=b->len-1;i>=0;i--){
+        x = x * 4294967296.0 + b->d[i];
+    }
+    return b->neg ? -x : x;
+}
+
+/* View an integer lval as a Bignum, using tmp and a two digit buf for Numbers */
+lbig* lval_to_big(lval* v, lbig* tmp, uint32_t* buf){
+    if(v->type == LVAL_BIG){ return v->big; }
+
+    uint64_t u = v->num < 0 ? (uint64_t)0 - (uint64_t)v->num : (uint64_t)v->num;
+    buf[0] = (uint32_t)u;
+    buf[1] = (uint32_t)(u >> 32);
+    tmp->neg = v->num < 0;
+    tmp->len = mag_trim(buf, 2);
+    tmp->d = buf;
+    return tmp;
+}
+
+/* Store b in v, demoting it to a plain Number when it fits in a long */
+void lval_set_big(lval* v, lbig* b){
+    lbig_trim(b);
+    if(b->len <= 2){
+        uint64_t u = b->len > 0 ? b->d[0] : 0;
+        if(b->len == 2){ u |= (uint64_t)b->d[1] << 32; }
+        if(!b->neg && u <= (uint64_t)LONG_MAX){
+            v->type = LVAL_NUM;
+            v->num = (long)u;
+            free(b);
+            return;
+        }
+        if(b->neg && u - 1 <= (uint64_t)LONG_MAX){
+            v->type = LVAL_NUM;
+            v->num = -(long)(u - 1) - 1;
+            free(b);
+            return;
+        }
+    }
+    v->type = LVAL_BIG;
+    v->big = b;
+}
+
+double lval_to_dbl(lval* v){
+    switch(v->type){
+        case LVAL_DBL: return v->dbl;
+        case LVAL_BIG: return lbig_to_dbl(v->big);
+        default: return (double)v->num;
+    }
+}
+
+/* Exact order of two numbers of any type: -1, 0 or 1, or 2 if either is NaN */
+int lval_num_cmp(lval* x, lval* y){
+    if(x->type == LVAL_DBL && y->type == LVAL_DBL){
+        if(x->dbl != x->dbl || y->dbl != y->dbl){ return 2; }
+        return (x->dbl > y->dbl) - (x->dbl < y->dbl);
+    }
+
+    /* An integer against a Double compares with its whole part exactly, */
+    /* so large integers aren't rounded to the nearest Double first */
+    if(x->type == LVAL_DBL || y->type == LVAL_DBL){
+        int flip = (x->type == LVAL_DBL);
+        lval* n = flip ? y : x;
+        double d = flip ? x->dbl : y->dbl;
+        if(d != d){ return 2; }
+
+        int c;
+        if(isinf(d)){
+            c = d > 0 ? -1 : 1;
+        } else {
+            lbig tn;
+            uint32_t dn[2];
+            double f = floor(d);
+            lbig* w = lbig_from_dbl(f);
+            c = lbig_cmp(lval_to_big(n, &tn, dn), w);
+            free(w);
+            /* Equal to the whole part but short of a fraction above it */
+            if(c == 0 && d != f){ c = -1; }
+        }
+        return flip ? -c : c;
+    }
+
+    if(x->type == LVAL_BIG || y->type == LVAL_BIG){
+        lbig tx, ty;
+        uint32_t dx[2], dy[2];
+        return lbig_cmp(lval_to_big(x, &tx, dx), lval_to_big(y, &ty, dy));
+    }
+    return (x->num > y->num) - (x->num < y->num);
+}
+
+/* Portable kernels. Integer vector arithmetic wraps on overflow */
+static void lvec_add_i64_c(int64_t* r, const int64_t* a, const int64_t* b, int n){
+    for(int i=0;i<n;i++){ r[i] = (int64_t)((uint64_t)a[i] + (uint64_t)b[i]); }
+}
+
+static void lvec_mul_i64_c(int64_t* r, const int64_t* a, const int64_t* b, int n){
+    for(int i=0;i<n;i++){ r[i] = (int64_t)((uint64_t)a[i] * (uint64_t)b[i]); }
+}
+
+static int64_t lvec_sum_i64_c(const int64_t* a, int n){
+    uint64_t s = 0;
+    for(int i=0;i<n;i++){ s += (uint64_t)a[i]; }
+    return (int64_t)s;
+}
+
+static int64_t lvec_dot_i64_c(const int64_t* a, const int64_t* b, int n){
+    uint64_t s = 0;
+    for(int i=0;i<n;i++){ s += (uint64_t)a[i] * (uint64_t)b[i]; }
+    return (int64_t)s;
+}
+
+static void lvec_add_f64_c(double* r, const double* a, const double* b, int n){
+    for(int i=0;i<n;i++){ r[i] = a[i] + b[i]; }
+}
+
+static void lvec_mul_f64_c(double* r, const double* a, const double* b, int n){
+    for(int i=0;i<n;i++){ r[i] = a[i] * b[i]; }
+}
+
+static double lvec_sum_f64_c(const double* a, int n){
+    double s = 0.0;
+    for(int i=0;i<n;i++){ s += a[i]; }
+    return s;
+}
+
+static double lvec_dot_f64_c(const double* a, const double* b, int n){
+    double s = 0.0;
+    for(int i=0;i<n;i++){ s += a[i] * b[i]; }
+    return s;
+}
+
+static lvec_kernels lvec_scalar = {
+    "scalar",
+    lvec_add_i64_c, lvec_mul_i64_c, lvec_sum_i64_c, lvec_dot_i64_c,
+    lvec_add_f64_c, lvec_mul_f64_c, lvec_sum_f64_c, lvec_dot_f64_c
+};
+
+#ifdef LISPY_X86
+
+/* SSE2 kernels, two lanes at a time with the scalar kernels finishing the tail */
+
+/* Neither SSE2 nor AVX2 has a 64 bit multiply, so build the low 64 bits */
+/* of each product from 32 bit halves: lo*lo + ((hi*lo + lo*hi) << 32) */
+__attribute__((target("sse2")))
+static inline __m128i lvec_mullo_sse2(__m128i a, __m128i b){
+    __m128i lo = _mm_mul_epu32(a, b);
+    __m128i cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), b),
+                                  _mm_mul_epu32(a, _mm_srli_epi64(b, 32)));
+    return _mm_add_epi64(lo, _mm_slli_epi64(cross, 32));
+}
+
+__attribute__((target("sse2")))
+static void lvec_add_i64_sse2(int64_t* r, const int64_t* a, const int64_t* b, int n){
+    int i = 0;
+    for(;i+2<=n;i+=2){
+        __m128i x = _mm_loadu_si128((const __m128i*)(a+i));
+        __m128i y = _mm_loadu_si128((const __m128i*)(b+i));
+        _mm_storeu_si128((__m128i*)(r+i), _mm_add_epi64(x, y));
+    }
+    lvec_add_i64_c(r+i, a+i, b+i, n-i);
+}
+
+__attribute__((target("sse2")))
+static void lvec_mul_i64_sse2(int64_t* r, const int64_t* a, const int64_t* b, int n){
+    int i = 0;
+    for(;i+2<=n;i+=2){
+        __m128i x = _mm_loadu_si128((const __m128i*)(a+i));
+        __m128i y = _mm_loadu_si128((const __m128i*)(b+i));
+        _mm_storeu_si128((__m128i*)(r+i), lvec_mullo_sse2(x, y));
+    }
+    lvec_mul_i64_c(r+i, a+i, b+i, n-i);
+}
+
+__attribute__((target("sse2")))
+static int64_t lvec_sum_i64_sse2(const int64_t* a, int n){
+    __m128i acc = _mm_setzero_si128();
+    int i = 0;
+    for(;i+2<=n;i+=2){
+        acc = _mm_add_epi64(acc, _mm_loadu_si128((const __m128i*)(a+i)));
+    }
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    return (int64_t)((uint64_t)lanes[0] + (uint64_t)lanes[1]
+        + (uint64_t)lvec_sum_i64_c(a+i, n-i));
+}
+
+__attribute__((target("sse2")))
+static int64_t lvec_dot_i64_sse2(const int64_t* a, const int64_t* b, int n){
+    __m128i acc = _mm_setzero_si128();
+    int i = 0;
+    for(;i+2<=n;i+=2){
+        __m128i x = _mm_loadu_si128((const __m128i*)(a+i));
+        __m128i y = _mm_loadu_si128((const __m128i*)(b+i));
+        acc = _mm_add_epi64(acc, lvec_mullo_sse2(x, y));
+    }
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    return (int64_t)((uint64_t)lanes[0] + (uint64_t)lanes[1]
+        + (uint64_t)lvec_dot_i64_c(a+i, b+i, n-i));
+}
+
+__attribute__((target("sse2")))
+static void lvec_add_f64_sse2(double* r, const double* a, const double* b, int n){
+    int i = 0;
+    for(;i+2<=n;i+=2){
+        _mm_storeu_pd(r+i, _mm_add_pd(_mm_loadu_pd(a+i), _mm_loadu_pd(b+i)));
+    }
+    lvec_add_f64_c(r+i, a+i, b+i, n-i);
+}
+
+__attribute__((target("sse2")))
+static void lvec_mul_f64_sse2(double* r, const double* a, const double* b, int n){
+    int i = 0;
+    for(;i+2<=n;i+=2){
+        _mm_storeu_pd(r+i, _mm_mul_pd(_mm_loadu_pd(a+i), _mm_loadu_pd(b+i)));
+    }
+    lvec_mul_f64_c(r+i, a+i, b+i, n-i);
+}
+
+__attribute__((target("sse2")))
+static double lvec_sum_f64_sse2(const double* a, int n){
+    __m128d acc = _mm_setzero_pd();
+    int i = 0;
+    for(;i+2<=n;i+=2){
+        acc = _mm_add_pd(acc, _mm_loadu_pd(a+i));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    return lanes[0] + lanes[1] + lvec_sum_f64_c(a+i, n-i);
+}
+
+__attribute__((target("sse2")))
+static double lvec_dot_f64_sse2(const double* a, const double* b, int n){
+    __m128d acc = _mm_setzero_pd();
+    int i = 0;
+    for(;i+2<=n;i+=2){
+        acc = _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(a+i), _mm_loadu_pd(b+i)));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    return lanes[0] + lanes[1] + lvec_dot_f64_c(a+i, b+i, n-i);
+}
+
+static lvec_kernels lvec_sse2 = {
+    "sse2",
+    lvec_add_i64_sse2, lvec_mul_i64_sse2, lvec_sum_i64_sse2, lvec_dot_i64_sse2,
+    lvec_add_f64_sse2, lvec_mul_f64_sse2, lvec_sum_f64_sse2, lvec_dot_f64_sse2
+};
+
+/* AVX2 kernels, four lanes at a time */
+
+__attribute__((target("avx2")))
+static inline __m256i lvec_mullo_avx2(__m256i a, __m256i b){
+    __m256i lo = _mm256_mul_epu32(a, b);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                     _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+__attribute__((target("avx2")))
+static void lvec_add_i64_avx2(int64_t* r, const int64_t* a, const int64_t* b, int n){
+    int i = 0;
+    for(;i+4<=n;i+=4){
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a+i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b+i));
+        _mm256_storeu_si256((__m256i*)(r+i), _mm256_add_epi64(x, y));
+    }
+    lvec_add_i64_c(r+i, a+i, b+i, n-i);
+}
+
+__attribute__((target("avx2")))
+static void lvec_mul_i64_avx2(int64_t* r, const int64_t* a, const int64_t* b, int n){
+    int i = 0;
+    for(;i+4<=n;i+=4){
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a+i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b+i));
+        _mm256_storeu_si256((__m256i*)(r+i), lvec_mullo_avx2(x, y));
+    }
+    lvec_mul_i64_c(r+i, a+i, b+i, n-i);
+}
+
+__attribute__((target("avx2")))
+static int64_t lvec_sum_i64_avx2(const int64_t* a, int n){
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    for(;i+4<=n;i+=4){
+        acc = _mm256_add_epi64(acc, _mm256_loadu_si256((const __m256i*)(a+i)));
+    }
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+    return (int64_t)((uint64_t)lanes[0] + (uint64_t)lanes[1] + (uint64_t)lanes[2]
+        + (uint64_t)lanes[3] + (uint64_t)lvec_sum_i64_c(a+i, n-i));
+}
+
+__attribute__((target("avx2")))
+static int64_t lvec_dot_i64_avx2(const int64_t* a, const int64_t* b, int n){
+    __m256i acc = _mm256_setzero_si256();
+    int i = 0;
+    for(;i+4<=n;i+=4){
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a+i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(b+i));
+        acc = _mm256_add_epi64(acc, lvec_mullo_avx2(x, y));
+    }
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+    return (int64_t)((uint64_t)lanes[0] + (uint64_t)lanes[1] + (uint64_t)lanes[2]
+        + (uint64_t)lanes[3] + (uint64_t)lvec_dot_i64_c(a+i, b+i, n-i));
+}
+
+__attribute__((target("avx2")))
+static void lvec_add_f64_avx2(double* r, const double* a, const double* b, int n){
+    int i = 0;
+    for(;i+4<=n;i+=4){
+        _mm256_storeu_pd(r+i, _mm256_add_pd(_mm256_loadu_pd(a+i), _mm256_loadu_pd(b+i)));
+    }
+    lvec_add_f64_c(r+i, a+i, b+i, n-i);
+}
+
+__attribute__((target("avx2")))
+static void lvec_mul_f64_avx2(double* r, const double* a, const double* b, int n){
+    int i = 0;
+    for(;i+4<=n;i+=4){
+        _mm256_storeu_pd(r+i, _mm256_mul_pd(_mm256_loadu_pd(a+i), _mm256_loadu_pd(b+i)));
+    }
+    lvec_mul_f64_c(r+i, a+i, b+i, n-i);
+}
+
+__attribute__((target("avx2")))
+static double lvec_sum_f64_avx2(const double* a, int n){
+    __m256d acc = _mm256_setzero_pd();
+    int i = 0;
+    for(;i+4<=n;i+=4){
+        acc = _mm256_add_pd(acc, _mm256_loadu_pd(a+i));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + lvec_sum_f64_c(a+i, n-i);
+}
+
+__attribute__((target("avx2")))
+static double lvec_dot_f64_avx2(const double* a, const double* b, int n){
+    __m256d acc = _mm256_setzero_pd();
+    int i = 0;
+    for(;i+4<=n;i+=4){
+        acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_loadu_pd(a+i), _mm256_loadu_pd(b+i)));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + lvec_dot_f64_c(a+i, b+i, n-i);
+}
+
+static lvec_kernels lvec_avx2 = {
+    "avx2",
+    lvec_add_i64_avx2, lvec_mul_i64_avx2, lvec_sum_i64_avx2, lvec_dot_i64_avx2,
+    lvec_add_f64_avx2, lvec_mul_f64_avx2, lvec_sum_f64_avx2, lvec_dot_f64_avx2
+};
+
+#endif
+
+/* Best instruction set this CPU supports, found with CPUID on first use. */
+/* LISPY_SIMD=scalar|sse2|avx2 caps it, for comparing the fallbacks */
+int lcpu_level(void){
+    static int level = -1;
+    if(level >= 0){ return level; }
+
+    level = LCPU_SCALAR;
+#ifdef LISPY_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){ level = LCPU_AVX2; }
+    else if(__builtin_cpu_supports("sse2")){ level = LCPU_SSE2; }
+#endif
+
+    char* cap = getenv("LISPY_SIMD");
+    if(cap && strcmp(cap,"scalar") == 0){ level = LCPU_SCALAR; }
+    if(cap && strcmp(cap,"sse2") == 0 && level > LCPU_SSE2){ level = LCPU_SSE2; }
+    return level;
+}
+
+lvec_kernels* lvec_select(void){
+#ifdef LISPY_X86
+    switch(lcpu_level()){
+        case LCPU_AVX2: return &lvec_avx2;
+        case LCPU_SSE2: return &lvec_sse2;
+    }
+#endif
+    return &lvec_scalar;
+}
+
+static char* lmemchr_c(char* s, int c, int n){
+    for(int i=0;i<n;i++){
+        if(s[i] == (char)c){ return s+i; }
+    }
+    return NULL;
+}
+
+#ifdef LISPY_X86
+
+/* Compare 16 or 32 bytes at once, the lowest set mask bit is the first match */
+__attribute__((target("sse2")))
+static char* lmemchr_sse2(char* s, int c, int n){
+    __m128i k = _mm_set1_epi8((char)c);
+    int i = 0;
+    for(;i+16<=n;i+=16){
+        __m128i x = _mm_loadu_si128((const __m128i*)(s+i));
+        int m = _mm_movemask_epi8(_mm_cmpeq_epi8(x, k));
+        if(m){ return s + i + __builtin_ctz(m); }
+    }
+    return lmemchr_c(s+i, c, n-i);
+}
+
+__attribute__((target("avx2")))
+static char* lmemchr_avx2(char* s, int c, int n){
+    __m256i k = _mm256_set1_epi8((char)c);
+    int i = 0;
+    for(;i+32<=n;i+=32){
+        __m256i x = _mm256_loadu_si256((const __m256i*)(s+i));
+        unsigned m = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, k));
+        if(m){ return s + i + __builtin_ctz(m); }
+    }
+    return lmemchr_c(s+i, c, n-i);
+}
+
+#endif
+
+/* First occurrence of byte c in the n bytes at s, or NULL */
+char* lmemchr(char* s, int c, int n){
+    /* Short inputs are not worth the setup */
+    if(n < 16){ return lmemchr_c(s, c, n); }
+#ifdef LISPY_X86
+    switch(lcpu_level()){
+        case LCPU_AVX2: return lmemchr_avx2(s, c, n);
+        case LCPU_SSE2: return lmemchr_sse2(s, c, n);
+    }
+#endif
+    return lmemchr_c(s, c, n);
+}
+
+/* Index of needle in s at or after from, or -1. Candidates are found */
+/* by scanning for the first byte of the needle */
+int lstr_find(char* s, int n, char* needle, int nn, int from){
+    if(nn == 0){ return from <= n ? from : -1; }
+    for(int i=from;i+nn<=n;){
+        char* p = lmemchr(s+i, needle[0], n-nn+1-i);
+        if(!p){ return -1; }
+        i = p - s;
+        if(memcmp(p, needle, nn) == 0){ return i; }
+        i++;
+    }
+    return -1;
+}
+
+/* Leaf holding a copy of len bytes */
+lrope* lrope_leaf(char* s, int len){
+    lrope* r = malloc(sizeof(lrope));
+    r->refs = 1;
+    r->len = len;
+    r->depth = 0;
+    r->left = NULL;
+    r->right = NULL;
+    r->leaf = malloc(len+1);
+    if(len){ memcpy(r->leaf, s, len); }
+    r->leaf[len] = '\0';
+    return r;
+}
+
+lrope* lrope_ref(lrope* r){
+    r->refs++;
+    return r;
+}
+
+void lrope_release(lrope* r){
+    if(--r->refs > 0){ return; }
+    if(r->leaf){
+        free(r->leaf);
+    } else {
+        lrope_release(r->left);
+        lrope_release(r->right);
+    }
+    free(r);
+}
+
+/* Inner node taking over the references to l and r */
+static lrope* lrope_node(lrope* l, lrope* r){
+    lrope* n = malloc(sizeof(lrope));
+    n->refs = 1;
+    n->len = l->len + r->len;
+    n->depth = 1 + (l->depth > r->depth ? l->depth : r->depth);
+    n->left = l;
+    n->right = r;
+    n->leaf = NULL;
+    return n;
+}
+
+/* Node over l and r whose depths differ by at most two, rotating as in */
+/* an AVL tree. Nodes are shared so rotations build new ones */
+static lrope* lrope_balance(lrope* l, lrope* r){
+    if(r->depth > l->depth + 1){
+        lrope* rl = r->left;
+        lrope* rr = r->right;
+        lrope* n;
+        if(rr->depth >= rl->depth){
+            n = lrope_node(lrope_node(l, lrope_ref(rl)), lrope_ref(rr));
+        } else {
+            n = lrope_node(lrope_node(l, lrope_ref(rl->left)),
+                           lrope_node(lrope_ref(rl->right), lrope_ref(rr)));
+        }
+        lrope_release(r);
+        return n;
+    }
+    if(l->depth > r->depth + 1){
+        lrope* ll = l->left;
+        lrope* lr = l->right;
+        lrope* n;
+        if(ll->depth >= lr->depth){
+            n = lrope_node(lrope_ref(ll), lrope_node(lrope_ref(lr), r));
+        } else {
+            n = lrope_node(lrope_node(lrope_ref(ll), lrope_ref(lr->left)),
+                           lrope_node(lrope_ref(lr->right), r));
+        }
+        lrope_release(l);
+        return n;
+    }
+    return lrope_node(l, r);
+}
+
+/* Concatenate, consuming both references. Only the spine of the deeper */
+/* side is copied, so this is O(log n) */
+lrope* lrope_join(lrope* l, lrope* r){
+    if(l->len == 0){ lrope_release(l); return r; }
+    if(r->len == 0){ lrope_release(r); return l; }
+
+    /* Merge small neighbouring leaves */
+    if(l->leaf && r->leaf && l->len + r->len < LROPE_LEAF){
+        lrope* n = lrope_leaf(l->leaf, l->len);
+        n->leaf = realloc(n->leaf, l->len + r->len + 1);
+        memcpy(n->leaf + l->len, r->leaf, r->len + 1);
+        n->len += r->len;
+        lrope_release(l);
+        lrope_release(r);
+        return n;
+    }
+
+    if(l->depth > r->depth + 1){
+        lrope* n = lrope_balance(lrope_ref(l->left), lrope_join(lrope_ref(l->right), r));
+        lrope_release(l);
+        return n;
+    }
+    if(r->depth > l->depth + 1){
+        lrope* n = lrope_balance(lrope_join(l, lrope_ref(r->left)), lrope_ref(r->right));
+        lrope_release(r);
+        return n;
+    }
+    return lrope_node(l, r);
+}
+
+static void lrope_copy_to(lrope* r, char* out){
+    if(r->leaf){ memcpy(out, r->leaf, r->len); return; }
+    lrope_copy_to(r->left, out);
+    lrope_copy_to(r->right, out + r->left->len);
+}
+
+/* Turn r into a single leaf in place. Every holder of r sees the same */
+/* bytes before and after, so sharing it is unaffected */
+char* lrope_flatten(lrope* r){
+    if(r->leaf){ return r->leaf; }
+    char* buf = malloc(r->len+1);
+    lrope_copy_to(r, buf);
+    buf[r->len] = '\0';
+    lrope_release(r->left);
+    lrope_release(r->right);
+    r->left = NULL;
+    r->right = NULL;
+    r->depth = 0;
+    r->leaf = buf;
+    return buf;
+}
+
+/* Allocate a zeroed Vector with the elements stored after the header */
+lvec* lvec_new(int dbl, int count){
+    lvec* v = calloc(1, sizeof(lvec) + sizeof(int64_t) * count);
+    v->dbl = dbl;
+    v->count = count;
+    v->i = (int64_t*)(v+1);
+    v->d = (double*)(v+1);
+    return v;
+}
+
+lvec* lvec_copy(lvec* v){
+    lvec* x = lvec_new(v->dbl, v->count);
+    memcpy(x->i, v->i, sizeof(int64_t) * v->count);
+    return x;
+}
+
+/* Copy of a Vector with its elements converted to Doubles */
+lvec* lvec_promote(lvec* v){
+    lvec* x = lvec_new(1, v->count);
+    for(int i=0;i<v->count;i++){
+        x->d[i] = v->dbl ? v->d[i] : (double)v->i[i];
+    }
+    return x;
+}
+
+/* Pack Number and Double cells into a Vector, of Doubles if any cell is one */
+lval* lvec_from_cells(lval** cells, int count, char* func){
+    int dbl = 0;
+    for(int i=0;i<count;i++){
+        if(cells[i]->type == LVAL_DBL){ dbl = 1; continue; }
+        if(cells[i]->type != LVAL_NUM){
+            return lval_err("Function '%s' passed incorrect type for element %i. "
+                "Got %s, Expected %s or %s.", func, i,
+                ltype_name(cells[i]->type), ltype_name(LVAL_NUM), ltype_name(LVAL_DBL));
+        }
+    }
+
+    lval* v = lval_vec(dbl, count);
+    for(int i=0;i<count;i++){
+        if(dbl){ v->vec->d[i] = lval_to_dbl(cells[i]); }
+        else { v->vec->i[i] = cells[i]->num; }
+    }
+    return v;
+}
+
+lenv* lenv_new(void){
     lenv* e = malloc(sizeof(lenv));
+    lmem_alloc(LMEM_ENV, sizeof(lenv));
     e->par = NULL;
     e->count = 0;
     e->syms = NULL;
@@ -554,17 +3296,17 @@ lenv* lenv_new(void){
 
 void lenv_del(lenv* e){
     for(int i=0;i<e->count;i++){
-        free(e->syms[i]);
+        if(!LIMAGE_OWNS(e->syms[i])){ free(e->syms[i]); }
         lval_del(e->vals[i]);
     }
     free(e->syms);
     free(e->vals);
     free(e);
+    lmem.kinds[LMEM_ENV].live--;
 }
 
 lval* lval_lambda(lval* formals, lval* body){
-    lval* v = malloc(sizeof(lval));
-    v->type = LVAL_FUN;
+    lval* v = lval_new(LVAL_FUN);
 
     /* Set Builtin to Null */
     v->builtin = NULL;
@@ -592,60 +3334,318 @@ lval* lenv_get(lenv* e, lval* k){
         return lenv_get(e->par, k);
     }
 
-    return lval_err("Unbound Symbol '%s'",k->sym);
+    /* A definition indexed by a lazy load is evaluated when first needed */
+    lval* d = llazy_define(k->sym);
+    if(d){
+        if(d->type == LVAL_ERR){ return d; }
+        lval_del(d);
+        return lenv_get(e, k);
+    }
+
+    return lval_err("Unbound Symbol '%s'",k->sym);
+}
+
+lenv* lenv_copy(lenv* e){
+    lenv* n = malloc(sizeof(lenv));
+    lmem_alloc(LMEM_ENV, sizeof(lenv) + (sizeof(char*) + sizeof(lval*)) * e->count);
+    n->par = e->par;
+    n->count = e->count;
+    n->syms = malloc(sizeof(char*) * n->count);
+    n->vals = malloc(sizeof(lval*) * n->count);
+    for(int i = 0; i< e->count; i++){
+        n->syms[i] = malloc(strlen(e->syms[i])+1);
+        strcpy(n->syms[i],e->syms[i]);
+        lmem_bytes(LMEM_ENV, strlen(e->syms[i])+1);
+        n->vals[i] = lval_copy(e->vals[i]);
+    }
+    return n;
+}
+
+void lenv_put(lenv* e, lval* k, lval* v){
+    /* Iterate over all items in environment */
+    /* This is to see if variable already exists */
+    for(int i=0;i<e->count;i++){
+
+        /* If variable is found delete item at that position */
+        /* And replace with variable supplied by user */
+        if(strcmp(e->syms[i],k->sym) == 0){
+            lval_del(e->vals[i]);
+            e->vals[i] = lval_copy(v);
+            return;
+        }
+    }
+
+    /* If no existing entry found allocate space for new entry */
+    e->count++;
+    e->vals = realloc(e->vals, sizeof(lval*) * e->count);
+    e->syms = realloc(e->syms, sizeof(char*) * e->count);
+
+    /* Copy contents of lval and symbol string into new location */
+    e->vals[e->count-1] = lval_copy(v);
+    e->syms[e->count-1] = malloc(strlen(k->sym)+1);
+    strcpy(e->syms[e->count-1],k->sym);
+    lmem_bytes(LMEM_ENV, sizeof(char*) + sizeof(lval*) + strlen(k->sym)+1);
+}
+
+void lenv_def(lenv* e,lval* k, lval* v){
+    /* Iterate till e has no parent */
+    while(e->par) {
+        e = e->par;
+    }
+    /* Put value in e */
+    lenv_put(e,k,v);
+}
+
+/* Most functions counted separately, the rest are counted together */
+#define LMEM_SITES 4096
+/* Functions listed by mem-report */
+#define LMEM_TOP 20
+
+/* Start counting by function as well, before anything is allocated */
+static void lmem_start(void){
+    lmem.sites = calloc(LMEM_SITES, sizeof(lmem_count));
+    lmem.names = calloc(LMEM_SITES, sizeof(char*));
+    lmem.slots = calloc(LMEM_SITES*2, sizeof(int));
+    lmem.names[0] = "(toplevel)";
+    lmem.names[LMEM_SITES-1] = "(other)";
+    lmem.sites_num = 1;
+    lmem_on = 1;
+}
+
+/* Site counting allocations made while the function name runs */
+static int lmem_site(char* name){
+    unsigned long mask = LMEM_SITES*2 - 1;
+    for(unsigned long i = lhash_str(0, name) & mask;;i = (i+1) & mask){
+        int site = lmem.slots[i];
+        if(!site){
+            if(lmem.sites_num == LMEM_SITES-1){ return LMEM_SITES-1; }
+            site = lmem.sites_num++;
+            lmem.names[site] = malloc(strlen(name)+1);
+            strcpy(lmem.names[site], name);
+            lmem.slots[i] = site;
+            return site;
+        }
+        if(strcmp(lmem.names[site], name) == 0){ return site; }
+    }
+}
+
+static int lmem_cmp(const void* a, const void* b){
+    long x = lmem.sites[*(int*)a].bytes;
+    long y = lmem.sites[*(int*)b].bytes;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static void lmem_row(FILE* out, char* name, lmem_count* c){
+    fprintf(out, "%-24s %12ld %14ld %12ld\n", name, c->allocs, c->bytes, c->live);
+}
+
+/* Write the counts for each kind, then the functions that allocated most */
+static void lmem_report(FILE* out){
+    fprintf(out, "%-24s %12s %14s %12s\n", "type", "allocs", "bytes", "live");
+    for(int k=0;k<LMEM_KINDS;k++){
+        if(!lmem.kinds[k].allocs){ continue; }
+        lmem_row(out, k == LMEM_ENV ? "Environment" : ltype_name(k), &lmem.kinds[k]);
+    }
+
+    if(!lmem_on){
+        fprintf(out, "set LISPY_MEM_REPORT to count by function\n");
+        return;
+    }
+    int* order = malloc(sizeof(int) * LMEM_SITES);
+    int n = 0;
+    for(int i=0;i<LMEM_SITES;i++){
+        if(lmem.sites[i].allocs){ order[n++] = i; }
+    }
+    qsort(order, n, sizeof(int), lmem_cmp);
+
+    fprintf(out, "%-24s %12s %14s %12s\n", "function", "allocs", "bytes", "live");
+    for(int i=0;i<n && i<LMEM_TOP;i++){
+        lmem_row(out, lmem.names[order[i]], &lmem.sites[order[i]]);
+    }
+    if(n > LMEM_TOP){ fprintf(out, "(%d more)\n", n - LMEM_TOP); }
+    free(order);
+}
+
+lval* builtin_mem_report(lenv* e, lval* a){
+    LASSERT_NUM("mem-report", a, 0);
+    lval_del(a);
+    lout_flush();
+    lmem_report(stdout);
+    fflush(stdout);
+    return lval_sexpr();
+}
+
+/*
+Profiler. While (profile-start) is running, every call made through
+lval_call pushes a frame naming the function, by the symbol it was
+called through if there was one. SIGPROF samples the frames at each
+tick of CPU time into a buffer, and (profile-stop "file") writes them
+as collapsed stacks, one "a;b;c count" line per distinct stack, which
+flamegraph.pl and similar tools read. The frames are also kept while
+counting allocations by function. Otherwise lval_call only tests flags.
+*/
+
+/* Sampling interval in microseconds of CPU time */
+#define LPROF_USEC 1000
+/* Frames kept per stack, deeper ones are counted but not recorded */
+#define LPROF_DEPTH 4096
+/* Most bytes of samples kept, later samples are dropped */
+#define LPROF_BYTES (64 << 20)
+
+static volatile int lprof_on = 0;
+
+static struct {
+    char* volatile frames[LPROF_DEPTH];
+    volatile int depth;
+    char* buf;
+    volatile size_t used;
+    volatile long samples;
+    volatile long dropped;
+} lprof;
+
+#ifdef LISPY_HAVE_SIGPROF
+/* Append the current stack to the buffer. Only touches lprof */
+static void lprof_sample(int sig){
+    (void)sig;
+    int depth = lprof.depth < LPROF_DEPTH ? lprof.depth : LPROF_DEPTH;
+    size_t at = lprof.used;
+    char* root = "(toplevel)";
+
+    for(int i=-1;i<depth;i++){
+        char* name = i < 0 ? root : lprof.frames[i];
+        if(i >= 0){
+            if(at >= LPROF_BYTES){ lprof.dropped++; return; }
+            lprof.buf[at++] = ';';
+        }
+        for(;*name;name++){
+            if(at >= LPROF_BYTES){ lprof.dropped++; return; }
+            lprof.buf[at++] = *name;
+        }
+    }
+    if(at >= LPROF_BYTES){ lprof.dropped++; return; }
+    lprof.buf[at++] = '\0';
+    lprof.used = at;
+    lprof.samples++;
+}
+
+static void lprof_timer(long usec){
+    struct itimerval t;
+    t.it_interval.tv_sec = 0;
+    t.it_interval.tv_usec = usec;
+    t.it_value = t.it_interval;
+    setitimer(ITIMER_PROF, &t, NULL);
 }
+#endif
 
-lenv* lenv_copy(lenv* e){
-    lenv* n = malloc(sizeof(lenv));
-    n->par = e->par;
-    n->count = e->count;
-    n->syms = malloc(sizeof(char*) * n->count);
-    n->vals = malloc(sizeof(lval*) * n->count);
-    for(int i = 0; i< e->count; i++){
-        n->syms[i] = malloc(strlen(e->syms[i])+1);
-        strcpy(n->syms[i],e->syms[i]);
-        n->vals[i] = lval_copy(e->vals[i]);
+/* Call f with a frame on the profiler's stack named name, or after f */
+/* itself if name is empty */
+static lval* lprof_call(lenv* e, lval* f, lval* a, char* name){
+    if(!name || !*name){
+        name = f->builtin ? lbuiltin_name(f->builtin) : "lambda";
     }
-    return n;
+    int d = lprof.depth;
+    if(d < LPROF_DEPTH){ lprof.frames[d] = name; }
+    lprof.depth = d + 1;
+    int site = lmem.site;
+    if(lmem_on){ lmem.site = lmem_site(name); }
+
+    lval* r = f->builtin ? f->builtin(e,a) : lval_apply(e,f,a);
+
+    lmem.site = site;
+    lprof.depth = d;
+    return r;
 }
 
-void lenv_put(lenv* e, lval* k, lval* v){
-    /* Iterate over all items in environment */
-    /* This is to see if variable already exists */
-    for(int i=0;i<e->count;i++){
+static int lprof_cmp(const void* a, const void* b){
+    return strcmp(*(char**)a, *(char**)b);
+}
 
-        /* If variable is found delete item at that position */
-        /* And replace with variable supplied by user */
-        if(strcmp(e->syms[i],k->sym) == 0){
-            lval_del(e->vals[i]);
-            e->vals[i] = lval_copy(v);
-            return;
-        }
+lval* builtin_profile_start(lenv* e, lval* a){
+    LASSERT_NUM("profile-start", a, 0);
+    lval_del(a);
+#ifdef LISPY_HAVE_SIGPROF
+    if(lprof_on){ return lval_err("Function 'profile-start' called while already profiling"); }
+    if(!lprof.buf){ lprof.buf = malloc(LPROF_BYTES); }
+    lprof.used = 0;
+    lprof.samples = 0;
+    lprof.dropped = 0;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = lprof_sample;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, NULL);
+
+    lprof_on = 1;
+    lprof_timer(LPROF_USEC);
+    return lval_sexpr();
+#else
+    return lval_err("Function 'profile-start' needs SIGPROF, which this platform lacks");
+#endif
+}
+
+lval* builtin_profile_stop(lenv* e, lval* a){
+    LASSERT_NUM("profile-stop", a, 1);
+    LASSERT_TYPE("profile-stop", a, 0, LVAL_STR);
+#ifdef LISPY_HAVE_SIGPROF
+    if(!lprof_on){
+        lval_del(a);
+        return lval_err("Function 'profile-stop' called without profile-start");
     }
 
-    /* If no existing entry found allocate space for new entry */
-    e->count++;
-    e->vals = realloc(e->vals, sizeof(lval*) * e->count);
-    e->syms = realloc(e->syms, sizeof(char*) * e->count);
+    /* Keep profiling if the file can't be written */
+    char* filename = lval_str_bytes(a->cell[0]);
+    FILE* out = fopen(filename, "w");
+    if(out == NULL){
+        lval* err = lval_err("Could not write profile %s", filename);
+        lval_del(a);
+        return err;
+    }
+    lprof_timer(0);
+    signal(SIGPROF, SIG_IGN);
+    lprof_on = 0;
+
+    /* Sort the samples so equal stacks are together and count them */
+    char** stacks = malloc(sizeof(char*) * (lprof.samples + 1));
+    long n = 0;
+    for(size_t at = 0;at < lprof.used;at += strlen(lprof.buf + at) + 1){
+        stacks[n++] = lprof.buf + at;
+    }
+    qsort(stacks, n, sizeof(char*), lprof_cmp);
 
-    /* Copy contents of lval and symbol string into new location */
-    e->vals[e->count-1] = lval_copy(v);
-    e->syms[e->count-1] = malloc(strlen(k->sym)+1);
-    strcpy(e->syms[e->count-1],k->sym);
-}
+    for(long i=0;i<n;){
+        long j = i+1;
+        while(j < n && strcmp(stacks[i], stacks[j]) == 0){ j++; }
+        fprintf(out, "%s %ld\n", stacks[i], j - i);
+        i = j;
+    }
+    int failed = fclose(out) != 0;
+    free(stacks);
 
-void lenv_def(lenv* e,lval* k, lval* v){
-    /* Iterate till e has no parent */
-    while(e->par) {
-        e = e->par;
+    if(lprof.dropped){
+        fprintf(stderr, "profile-stop: dropped %ld samples after the first %ld\n",
+            lprof.dropped, lprof.samples);
     }
-    /* Put value in e */
-    lenv_put(e,k,v);
+    lval* x = failed ? lval_err("Could not write profile %s", filename) : lval_num(lprof.samples);
+    lval_del(a);
+    return x;
+#else
+    lval_del(a);
+    return lval_err("Function 'profile-stop' needs SIGPROF, which this platform lacks");
+#endif
 }
 
 lval* lval_call(lenv* e, lval* f, lval* a){
+    if(lprof_on || lmem_on){ return lprof_call(e, f, a, NULL); }
+
     /* If Builtin then simply call that */
     if(f->builtin){ return f->builtin(e,a); }
+    return lval_apply(e, f, a);
+}
+
+/* Bind the arguments of the lambda f, evaluating it once all are bound */
+lval* lval_apply(lenv* e, lval* f, lval* a){
 
     /* Record Argument Counts */
     int given = a->count;
@@ -738,6 +3738,7 @@ lval* lval_call(lenv* e, lval* f, lval* a){
 }
 
 lval* builtin_var(lenv* e, lval* a, char* func){
+    LASSERT(a, a->count != 0, "Function '%s' passed no arguments!", func);
     LASSERT_TYPE(func, a, 0, LVAL_QEXPR);
     
     /* First argument is symbol */
@@ -866,10 +3867,101 @@ lval* builtin_fun(lenv* e, lval* a){
     return builtin_var(e,function,"def");
 }
 
+/* Apply op to x and y storing the result in x, promoting to Double if either is */
+char* lval_arith(lval* x, lval* y, char op){
+
+    /* Numbers stay unboxed unless the result overflows a long */
+    if(x->type == LVAL_NUM && y->type == LVAL_NUM){
+        long r;
+        switch(op){
+            case '+':
+                if(!__builtin_add_overflow(x->num, y->num, &r)){ x->num = r; return NULL; }
+            break;
+            case '-':
+                if(!__builtin_sub_overflow(x->num, y->num, &r)){ x->num = r; return NULL; }
+            break;
+            case '*':
+                if(!__builtin_mul_overflow(x->num, y->num, &r)){ x->num = r; return NULL; }
+            break;
+            case '/':
+                if(y->num == 0){ return "Division By Zero!"; }
+                if(y->num != -1 || x->num != LONG_MIN){ x->num /= y->num; return NULL; }
+            break;
+            case '%':
+                if(y->num == 0){ return "Modulo By Zero!"; }
+                x->num = y->num == -1 ? 0 : x->num % y->num;
+            return NULL;
+        }
+        return lval_arith_big(x, y, op);
+    }
+
+    if(x->type == LVAL_DBL || y->type == LVAL_DBL){
+        double a = lval_to_dbl(x);
+        double b = lval_to_dbl(y);
+        switch(op){
+            case '+': a += b; break;
+            case '-': a -= b; break;
+            case '*': a *= b; break;
+            case '/':
+                if(b == 0.0){ return "Division By Zero!"; }
+                a /= b; break;
+            case '%':
+                if(b == 0.0){ return "Modulo By Zero!"; }
+                a = fmod(a,b); break;
+        }
+        if(x->type == LVAL_BIG){ free(x->big); }
+        x->type = LVAL_DBL;
+        x->dbl = a;
+        return NULL;
+    }
+
+    return lval_arith_big(x, y, op);
+}
+
+/* Slow path of lval_arith for integers that overflow or are already Bignums */
+char* lval_arith_big(lval* x, lval* y, char op){
+    lbig ta, tb;
+    uint32_t da[2], db[2];
+    lbig* a = lval_to_big(x, &ta, da);
+    lbig* b = lval_to_big(y, &tb, db);
+
+    lbig* r = NULL;
+    switch(op){
+        case '+': r = lbig_add(a, b, 0); break;
+        case '-': r = lbig_add(a, b, 1); break;
+        case '*': r = lbig_mul(a, b); break;
+        case '/':
+            if(b->len == 0){ return "Division By Zero!"; }
+            r = lbig_div(a, b, 0); break;
+        case '%':
+            if(b->len == 0){ return "Modulo By Zero!"; }
+            r = lbig_div(a, b, 1); break;
+    }
+
+    if(x->type == LVAL_BIG){ free(x->big); }
+    lval_set_big(x, r);
+    return NULL;
+}
+
 lval* builtin_op(lenv* e, lval* a,char* op){
+    LASSERT(a, a->count != 0, "Function '%s' passed no arguments!", op);
+
     /* Ensure all arguments are numbers */
     for(int i=0;i<a->count;i++){
-        LASSERT_TYPE(op,a,i,LVAL_NUM);
+        LASSERT_NUMBER(op,a,i);
+    }
+
+    /* Two arguments is the common case so compute straight into the */
+    /* first without popping, which avoids touching the allocator */
+    if(a->count == 2){
+        lval* x = a->cell[0];
+        lval* y = a->cell[1];
+        char* err = lval_arith(x, y, op[0]);
+        lval_del(y);
+        free(a->cell);
+        lval_free(a);
+        if(err){ lval_del(x); return lval_err(err); }
+        return x;
     }
 
     /*Pop the first element*/
@@ -877,31 +3969,26 @@ lval* builtin_op(lenv* e, lval* a,char* op){
 
     /*If no arguments and subexpressions perform unary negation*/
     if((strcmp(op,"-") == 0) && a->count == 0){
-        x->num = -x->num;
+        if(x->type == LVAL_DBL){ x->dbl = -x->dbl; }
+        else if(x->type == LVAL_NUM && x->num != LONG_MIN){ x->num = -x->num; }
+        else {
+            lval* z = lval_num(0);
+            lval_arith(z, x, '-');
+            lval_del(x);
+            x = z;
+        }
     }
 
     /*While there are still elements remaining*/
     while(a->count > 0){
         /*Pop the next element*/
         lval* y = lval_pop(a,0);
-        if(strcmp(op,"+")==0){ x->num += y->num;}
-        if(strcmp(op,"-")==0){ x->num -= y->num;}
-        if(strcmp(op,"*")==0){ x->num *= y->num;}
-        if(strcmp(op,"%")==0){
-            if(y->num==0){
-                lval_del(x);lval_del(y);
-                x = lval_err("Modulo By Zero!");break;
-            }
-             x->num = (long) x->num % (long) y->num;
-        }
-        if(strcmp(op,"/")==0){
-            if(y->num==0){
-                lval_del(x); lval_del(y);
-                x = lval_err("Division By Zero!"); break;
-            }
-            x->num /= y->num;
-        }
+        char* err = lval_arith(x, y, op[0]);
         lval_del(y);
+        if(err){
+            lval_del(x);
+            x = lval_err(err); break;
+        }
     }
     
     lval_del(a); 
@@ -928,7 +4015,96 @@ lval* builtin_mod(lenv* e, lval* a){
     return builtin_op(e,a,"%");
 }
 
+lval* builtin_math(lenv* e, lval* a, char* func, double (*f)(double)){
+    LASSERT_NUM(func,a,1);
+    LASSERT_NUMBER(func,a,0);
+
+    /* Reuse the argument to hold the result */
+    lval* x = lval_take(a,0);
+    double d = lval_to_dbl(x);
+    if(x->type == LVAL_BIG){ free(x->big); }
+    x->type = LVAL_DBL;
+    x->dbl = f(d);
+    return x;
+}
+
+lval* builtin_sqrt(lenv* e, lval* a){
+    return builtin_math(e,a,"sqrt",sqrt);
+}
+
+lval* builtin_exp(lenv* e, lval* a){
+    return builtin_math(e,a,"exp",exp);
+}
+
+lval* builtin_log(lenv* e, lval* a){
+    return builtin_math(e,a,"log",log);
+}
+
+lval* builtin_sin(lenv* e, lval* a){
+    return builtin_math(e,a,"sin",sin);
+}
+
+lval* builtin_cos(lenv* e, lval* a){
+    return builtin_math(e,a,"cos",cos);
+}
+
+lval* builtin_tan(lenv* e, lval* a){
+    return builtin_math(e,a,"tan",tan);
+}
+
+lval* builtin_atan(lenv* e, lval* a){
+    return builtin_math(e,a,"atan",atan);
+}
+
+lval* builtin_round(lenv* e, lval* a, char* func, double (*f)(double)){
+    LASSERT_NUM(func,a,1);
+    LASSERT_NUMBER(func,a,0);
+
+    /* Numbers are already whole */
+    lval* x = lval_take(a,0);
+    if(x->type != LVAL_DBL){ return x; }
+
+    /* Give back a Number, or a Bignum if it is too large for one */
+    double d = f(x->dbl);
+    if(isinf(d) || isnan(d)){
+        x->dbl = d;
+    } else if(d >= (double)LONG_MIN && d < -(double)LONG_MIN){
+        x->type = LVAL_NUM;
+        x->num = (long)d;
+    } else {
+        lval_set_big(x, lbig_from_dbl(d));
+    }
+    return x;
+}
+
+lval* builtin_floor(lenv* e, lval* a){
+    return builtin_round(e,a,"floor",floor);
+}
+
+lval* builtin_ceil(lenv* e, lval* a){
+    return builtin_round(e,a,"ceil",ceil);
+}
+
+lval* builtin_trunc(lenv* e, lval* a){
+    return builtin_round(e,a,"trunc",trunc);
+}
+
+lval* builtin_pow(lenv* e, lval* a){
+    LASSERT_NUM("pow",a,2);
+    LASSERT_NUMBER("pow",a,0);
+    LASSERT_NUMBER("pow",a,1);
+
+    lval* x = a->cell[0];
+    lval* y = a->cell[1];
+    double p = lval_to_dbl(x);
+    double q = lval_to_dbl(y);
+    lval_del(a);
+    return lval_dbl(pow(p,q));
+}
+
 lval* builtin_logic(lenv* e, lval* a, char* op){
+    LASSERT(a, a->count != 0, "Function '%s' passed no arguments!", op);
+
     /* Ensure all arguments are numbers */
     for(int i=0;i<a->count;i++){
         LASSERT_TYPE(op,a,i,LVAL_NUM);
@@ -998,14 +4174,18 @@ lval* builtin_ne(lenv* e, lval* a){
 lval* builtin_ord(lenv* e,lval* a, char* op){
     /* Ensure all arguments are numbers */
     LASSERT_NUM(op,a,2);
-    LASSERT_TYPE(op,a,0,LVAL_NUM);
-    LASSERT_TYPE(op,a,1,LVAL_NUM);
+    LASSERT_NUMBER(op,a,0);
+    LASSERT_NUMBER(op,a,1);
+
+    /* NaN is unordered so every comparison fails */
+    int c = lval_num_cmp(a->cell[0], a->cell[1]);
+    if(c == 2){ lval_del(a); return lval_num(0); }
 
     int r;
-    if(strcmp(op,">")==0){ r = (a->cell[0]->num > a->cell[1]->num);}
-    if(strcmp(op,"<")==0){ r = (a->cell[0]->num < a->cell[1]->num);}
-    if(strcmp(op,">=")==0){ r = (a->cell[0]->num >= a->cell[1]->num);}
-    if(strcmp(op,"<=")==0){ r = (a->cell[0]->num <= a->cell[1]->num);}
+    if(strcmp(op,">")==0){ r = (c > 0);}
+    if(strcmp(op,"<")==0){ r = (c < 0);}
+    if(strcmp(op,">=")==0){ r = (c >= 0);}
+    if(strcmp(op,"<=")==0){ r = (c <= 0);}
     
     lval_del(a); 
     return lval_num(r);
@@ -1062,6 +4242,7 @@ lval* builtin_tail(lenv* e, lval* a){
 }
 
 lval* builtin_join(lenv* e, lval* a){
+    LASSERT(a, a->count != 0, "Function 'join' passed no arguments!");
     for(int i = 0;i<a->count;i++){
         LASSERT_TYPE("join",a,i,LVAL_QEXPR);
     }
@@ -1081,64 +4262,435 @@ lval* builtin_cons(lenv* e, lval* a){
     LASSERT(a,a->cell[0]->type != LVAL_ERR,
         "Function 'cons' passed incorrect type!");
 
-    LASSERT_TYPE("cons",a,1,LVAL_QEXPR);
+    LASSERT_TYPE("cons",a,1,LVAL_QEXPR);
+
+    lval* x = lval_qexpr();
+    x = lval_add(x,lval_pop(a,0));
+    while(a->count){
+        x = lval_join(x,lval_pop(a,0));
+    }
+
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_len(lenv* e, lval* a){
+    LASSERT_NUM("len",a,1);
+    LASSERT_TYPE("len",a,0,LVAL_QEXPR);
+
+    long x = 0;
+    x = lval_len(lval_pop(a,0));
+
+    lval* y = lval_num(x);
+    lval_del(a);
+    return y;
+}
+
+lval* builtin_init(lenv* e, lval* a){
+    LASSERT_NUM("init",a,1);
+    LASSERT_TYPE("init",a,0,LVAL_QEXPR);
+    LASSERT(a,a->cell[0]->count != 0,
+    "Function 'init' passed {}!");
+
+    lval* x = lval_qexpr();
+    x = lval_init(x,lval_pop(a,0));
+
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_error(lenv* e, lval* a){
+    LASSERT_NUM("error",a, 1);
+    LASSERT_TYPE("error", a, 0, LVAL_STR);
+
+    /* Construct Error from first argument */
+    lval* err = lval_err("%s", lval_str_bytes(a->cell[0]));
+
+    /* Delete arguments and return */
+    lval_del(a);
+    return err;
+}
+
+lval* builtin_map_new(lenv* e, lval* a){
+    LASSERT(a, a->count % 2 == 0,
+        "Function 'map-new' passed unpaired arguments. "
+        "Got %i, Expected an even number.", a->count);
+    for(int i=0;i<a->count;i+=2){
+        LASSERT(a, !lval_has_map(a->cell[i]),
+            "Function 'map-new' cannot use a Map as a key.");
+    }
+
+    /* Arguments are alternating keys and values */
+    lval* m = lval_map();
+    while(a->count){
+        lval* k = lval_pop(a,0);
+        lmap_put(m->map, k, lval_pop(a,0));
+    }
+    lval_del(a);
+    return m;
+}
+
+lval* builtin_map_get(lenv* e, lval* a){
+    LASSERT(a, a->count == 2 || a->count == 3,
+        "Function 'map-get' passed incorrect number of arguments. "
+        "Got %i, Expected 2 or 3.", a->count);
+    LASSERT_TYPE("map-get",a,0,LVAL_MAP);
+    LASSERT(a, !lval_has_map(a->cell[1]),
+        "Function 'map-get' cannot use a Map as a key.");
+
+    lmap* m = a->cell[0]->map;
+    int i = lmap_find(m, a->cell[1], lval_hash(a->cell[1]));
+
+    /* Missing keys give the default if one was supplied */
+    if(i < 0){
+        if(a->count == 3){ return lval_take(a,2); }
+        lval_del(a);
+        return lval_err("Function 'map-get' passed key not in map.");
+    }
+
+    lval* x = lval_copy(m->vals[i]);
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_map_put(lenv* e, lval* a){
+    LASSERT_NUM("map-put",a,3);
+    LASSERT_TYPE("map-put",a,0,LVAL_MAP);
+    LASSERT(a, !lval_has_map(a->cell[1]),
+        "Function 'map-put' cannot use a Map as a key.");
+    LASSERT(a, !lmap_reached(a->cell[0]->map, a->cell[2]),
+        "Function 'map-put' cannot put a Map inside itself.");
+
+    /* Update the shared table in place and return the map */
+    lval* m = lval_pop(a,0);
+    lval* k = lval_pop(a,0);
+    lmap_put(m->map, k, lval_pop(a,0));
+    lval_del(a);
+    return m;
+}
+
+lval* builtin_map_del(lenv* e, lval* a){
+    LASSERT_NUM("map-del",a,2);
+    LASSERT_TYPE("map-del",a,0,LVAL_MAP);
+    LASSERT(a, !lval_has_map(a->cell[1]),
+        "Function 'map-del' cannot use a Map as a key.");
+
+    lmap_del(a->cell[0]->map, a->cell[1]);
+    return lval_take(a,0);
+}
+
+lval* builtin_map_keys(lenv* e, lval* a){
+    LASSERT_NUM("map-keys",a,1);
+    LASSERT_TYPE("map-keys",a,0,LVAL_MAP);
+
+    lmap* m = a->cell[0]->map;
+    lval* x = lval_qexpr();
+    x->cell = malloc(sizeof(lval*) * m->count);
+    for(int i=0;i<m->slots;i++){
+        if(!LMAP_LIVE(m, i)){ continue; }
+        x->cell[x->count++] = lval_copy(m->keys[i]);
+    }
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_map_size(lenv* e, lval* a){
+    LASSERT_NUM("map-size",a,1);
+    LASSERT_TYPE("map-size",a,0,LVAL_MAP);
+
+    lval* x = lval_num(a->cell[0]->map->count);
+    lval_del(a);
+    return x;
+}
+
+/* Build a Vector from its arguments or from a single Q-Expression */
+lval* builtin_vec(lenv* e, lval* a){
+    lval* v;
+    if(a->count == 1 && a->cell[0]->type == LVAL_QEXPR){
+        v = lvec_from_cells(a->cell[0]->cell, a->cell[0]->count, "vec");
+    } else {
+        v = lvec_from_cells(a->cell, a->count, "vec");
+    }
+    lval_del(a);
+    return v;
+}
+
+lval* builtin_vec_list(lenv* e, lval* a){
+    LASSERT_NUM("vec->list",a,1);
+    LASSERT_TYPE("vec->list",a,0,LVAL_VEC);
+
+    lvec* v = a->cell[0]->vec;
+    lval* x = lval_qexpr();
+    x->count = v->count;
+    x->cell = malloc(sizeof(lval*) * v->count);
+    for(int i=0;i<v->count;i++){
+        x->cell[i] = v->dbl ? lval_dbl(v->d[i]) : lval_num(v->i[i]);
+    }
+    lval_del(a);
+    return x;
+}
+
+/* Element wise op on two Vectors, promoting to Doubles if either holds them */
+lval* builtin_vec_op(lenv* e, lval* a, char* func, char op){
+    LASSERT_NUM(func,a,2);
+    LASSERT_TYPE(func,a,0,LVAL_VEC);
+    LASSERT_TYPE(func,a,1,LVAL_VEC);
+
+    lvec* x = a->cell[0]->vec;
+    lvec* y = a->cell[1]->vec;
+    LASSERT(a, x->count == y->count,
+        "Function '%s' passed vectors of different lengths. Got %i and %i.",
+        func, x->count, y->count);
+
+    lvec_kernels* k = lvec_select();
+    lval* r;
+    if(x->dbl || y->dbl){
+        lvec* px = x->dbl ? x : lvec_promote(x);
+        lvec* py = y->dbl ? y : lvec_promote(y);
+        r = lval_vec(1, x->count);
+        if(op == '+'){ k->add_f64(r->vec->d, px->d, py->d, x->count); }
+        else { k->mul_f64(r->vec->d, px->d, py->d, x->count); }
+        if(px != x){ free(px); }
+        if(py != y){ free(py); }
+    } else {
+        r = lval_vec(0, x->count);
+        if(op == '+'){ k->add_i64(r->vec->i, x->i, y->i, x->count); }
+        else { k->mul_i64(r->vec->i, x->i, y->i, x->count); }
+    }
+    lval_del(a);
+    return r;
+}
+
+lval* builtin_vec_add(lenv* e, lval* a){
+    return builtin_vec_op(e,a,"vec-add",'+');
+}
+
+lval* builtin_vec_mul(lenv* e, lval* a){
+    return builtin_vec_op(e,a,"vec-mul",'*');
+}
+
+lval* builtin_vec_sum(lenv* e, lval* a){
+    LASSERT_NUM("vec-sum",a,1);
+    LASSERT_TYPE("vec-sum",a,0,LVAL_VEC);
+
+    lvec* v = a->cell[0]->vec;
+    lval* x = v->dbl ? lval_dbl(lvec_select()->sum_f64(v->d, v->count))
+                     : lval_num(lvec_select()->sum_i64(v->i, v->count));
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_vec_dot(lenv* e, lval* a){
+    LASSERT_NUM("vec-dot",a,2);
+    LASSERT_TYPE("vec-dot",a,0,LVAL_VEC);
+    LASSERT_TYPE("vec-dot",a,1,LVAL_VEC);
+
+    lvec* x = a->cell[0]->vec;
+    lvec* y = a->cell[1]->vec;
+    LASSERT(a, x->count == y->count,
+        "Function 'vec-dot' passed vectors of different lengths. Got %i and %i.",
+        x->count, y->count);
+
+    lval* r;
+    if(x->dbl || y->dbl){
+        lvec* px = x->dbl ? x : lvec_promote(x);
+        lvec* py = y->dbl ? y : lvec_promote(y);
+        r = lval_dbl(lvec_select()->dot_f64(px->d, py->d, x->count));
+        if(px != x){ free(px); }
+        if(py != y){ free(py); }
+    } else {
+        r = lval_num(lvec_select()->dot_i64(x->i, y->i, x->count));
+    }
+    lval_del(a);
+    return r;
+}
+
+/* Call a function on every element, packing the results into a new Vector */
+lval* builtin_vec_map(lenv* e, lval* a){
+    LASSERT_NUM("vec-map",a,2);
+    LASSERT_TYPE("vec-map",a,0,LVAL_FUN);
+    LASSERT_TYPE("vec-map",a,1,LVAL_VEC);
+
+    lval* f = a->cell[0];
+    lvec* v = a->cell[1]->vec;
+    lval* results = lval_qexpr();
+    for(int i=0;i<v->count;i++){
+        lval* x = v->dbl ? lval_dbl(v->d[i]) : lval_num(v->i[i]);
+
+        /* Calling binds the formals in place so use a fresh copy each time */
+        lval* g = lval_copy(f);
+        lval* r = lval_call(e, g, lval_add(lval_sexpr(), x));
+        lval_del(g);
+        if(r->type == LVAL_ERR){
+            lval_del(results);
+            lval_del(a);
+            return r;
+        }
+        results = lval_add(results, r);
+    }
+
+    lval* x = lvec_from_cells(results->cell, results->count, "vec-map");
+    lval_del(results);
+    lval_del(a);
+    return x;
+}
+
+lval* builtin_str_len(lenv* e, lval* a){
+    LASSERT_NUM("str-len",a,1);
+    LASSERT_TYPE("str-len",a,0,LVAL_STR);
+
+    lval* x = lval_num(a->cell[0]->len);
+    lval_del(a);
+    return x;
+}
 
-    lval* x = lval_qexpr();
-    x = lval_add(x,lval_pop(a,0));
-    while(a->count){
-        x = lval_join(x,lval_pop(a,0));
+lval* builtin_str_concat(lenv* e, lval* a){
+    LASSERT(a, a->count != 0, "Function 'str-concat' passed no arguments!");
+    for(int i=0;i<a->count;i++){
+        LASSERT_TYPE("str-concat",a,i,LVAL_STR);
     }
 
+    /* Grow the first String in place */
+    lval* x = lval_pop(a,0);
+    for(int i=0;i<a->count;i++){
+        lval_str_cat(x, a->cell[i]);
+    }
     lval_del(a);
     return x;
 }
 
-lval* builtin_len(lenv* e, lval* a){
-    LASSERT_NUM("len",a,1);
-    LASSERT_TYPE("len",a,0,LVAL_QEXPR);
-
-    long x = 0;
-    x = lval_len(lval_pop(a,0));
+/* substr s start, or substr s start count */
+lval* builtin_substr(lenv* e, lval* a){
+    LASSERT(a, a->count == 2 || a->count == 3,
+        "Function 'substr' passed incorrect number of arguments. "
+        "Got %i, Expected 2 or 3", a->count);
+    LASSERT_TYPE("substr",a,0,LVAL_STR);
+    LASSERT_TYPE("substr",a,1,LVAL_NUM);
+    if(a->count == 3){ LASSERT_TYPE("substr",a,2,LVAL_NUM); }
+
+    lval* s = a->cell[0];
+    long start = a->cell[1]->num;
+    LASSERT(a, start >= 0 && start <= s->len,
+        "Function 'substr' passed start %li outside String of length %i.", start, s->len);
+
+    /* Counts running past the end are cut short */
+    long count = a->count == 3 ? a->cell[2]->num : s->len - start;
+    LASSERT(a, count >= 0, "Function 'substr' passed negative count %li.", count);
+    if(count > s->len - start){ count = s->len - start; }
+
+    lval* x = lval_strn(lval_str_bytes(s) + start, count);
+    lval_del(a);
+    return x;
+}
 
-    lval* y = lval_num(x);
+/* str-find s needle, or str-find s needle from. Gives -1 if absent */
+lval* builtin_str_find(lenv* e, lval* a){
+    LASSERT(a, a->count == 2 || a->count == 3,
+        "Function 'str-find' passed incorrect number of arguments. "
+        "Got %i, Expected 2 or 3", a->count);
+    LASSERT_TYPE("str-find",a,0,LVAL_STR);
+    LASSERT_TYPE("str-find",a,1,LVAL_STR);
+    if(a->count == 3){ LASSERT_TYPE("str-find",a,2,LVAL_NUM); }
+
+    lval* s = a->cell[0];
+    lval* n = a->cell[1];
+    long from = a->count == 3 ? a->cell[2]->num : 0;
+    LASSERT(a, from >= 0 && from <= s->len,
+        "Function 'str-find' passed start %li outside String of length %i.", from, s->len);
+
+    lval* x = lval_num(lstr_find(lval_str_bytes(s), s->len,
+        lval_str_bytes(n), n->len, from));
     lval_del(a);
-    return y;
+    return x;
 }
 
-lval* builtin_init(lenv* e, lval* a){
-    LASSERT_NUM("init",a,1);
-    LASSERT_TYPE("init",a,0,LVAL_QEXPR);
-    LASSERT(a,a->cell[0]->count != 0,
-    "Function 'init' passed {}!");
+lval* builtin_str_split(lenv* e, lval* a){
+    LASSERT_NUM("str-split",a,2);
+    LASSERT_TYPE("str-split",a,0,LVAL_STR);
+    LASSERT_TYPE("str-split",a,1,LVAL_STR);
+    LASSERT(a, a->cell[1]->len != 0, "Function 'str-split' passed empty separator.");
 
+    char* s = lval_str_bytes(a->cell[0]);
+    char* sep = lval_str_bytes(a->cell[1]);
+    int n = a->cell[0]->len;
+    int sn = a->cell[1]->len;
     lval* x = lval_qexpr();
-    x = lval_init(x,lval_pop(a,0));
-
+    int i = 0;
+    for(;;){
+        int j = lstr_find(s, n, sep, sn, i);
+        if(j < 0){ break; }
+        x = lval_add(x, lval_strn(s + i, j - i));
+        i = j + sn;
+    }
+    x = lval_add(x, lval_strn(s + i, n - i));
     lval_del(a);
     return x;
 }
 
-lval* builtin_error(lenv* e, lval* a){
-    LASSERT_NUM("error",a, 1);
-    LASSERT_TYPE("error", a, 0, LVAL_STR);
+lval* builtin_str_join(lenv* e, lval* a){
+    LASSERT_NUM("str-join",a,2);
+    LASSERT_TYPE("str-join",a,0,LVAL_QEXPR);
+    LASSERT_TYPE("str-join",a,1,LVAL_STR);
+
+    lval* l = a->cell[0];
+    lval* sep = a->cell[1];
+    for(int i=0;i<l->count;i++){
+        LASSERT(a, l->cell[i]->type == LVAL_STR,
+            "Function 'str-join' passed incorrect type for element %i. "
+            "Got %s, Expected %s.", i, ltype_name(l->cell[i]->type), ltype_name(LVAL_STR));
+    }
 
-    /* Construct Error from first argument */
-    lval* err = lval_err(a->cell[0]->str);
+    lval* x = lval_strn("", 0);
+    for(int i=0;i<l->count;i++){
+        if(i){ lval_str_append(x, lval_str_bytes(sep), sep->len); }
+        lval_str_append(x, lval_str_bytes(l->cell[i]), l->cell[i]->len);
+    }
+    lval_del(a);
+    return x;
+}
 
-    /* Delete arguments and return */
+/* Read a Number, Bignum or Double using the same syntax as the parser */
+lval* builtin_str_num(lenv* e, lval* a){
+    LASSERT_NUM("str->num",a,1);
+    LASSERT_TYPE("str->num",a,0,LVAL_STR);
+
+    /* -?[0-9]+(\.[0-9]+)?([eE][-+]?[0-9]+)? */
+    char* s = lval_str_bytes(a->cell[0]);
+    int n = a->cell[0]->len;
+    int i = 0;
+    if(i < n && s[i] == '-'){ i++; }
+    int digits = i;
+    while(i < n && isdigit((unsigned char)s[i])){ i++; }
+    int ok = i > digits;
+    if(ok && i < n && s[i] == '.'){
+        digits = ++i;
+        while(i < n && isdigit((unsigned char)s[i])){ i++; }
+        ok = i > digits;
+    }
+    if(ok && i < n && (s[i] == 'e' || s[i] == 'E')){
+        i++;
+        if(i < n && (s[i] == '-' || s[i] == '+')){ i++; }
+        digits = i;
+        while(i < n && isdigit((unsigned char)s[i])){ i++; }
+        ok = i > digits;
+    }
+    LASSERT(a, ok && i == n, "Function 'str->num' passed String that is not a number.");
+
+    lval* x = lval_parse_num(s);
     lval_del(a);
-    return err;
+    return x;
 }
 
 lval* builtin_print(lenv* e, lval* a){
 
     /* Print each argument followed by a space */
     for( int i =0;i<a->count;i++){
-        lval_print(a->cell[i]); putchar(' ');
+        lval_print(a->cell[i]); lout_putc(' ');
     }
 
-    /* Print a newline and delete arguments */
-    putchar('\n');
+    /* Print a newline, write it all out and delete arguments */
+    lout_putc('\n');
+    lout_flush();
     lval_del(a);
 
     return lval_sexpr();
@@ -1160,61 +4712,145 @@ void lenv_add_builtin(lenv* e, char* name, lbuiltin func){
     lval_del(k);lval_del(v);
 }
 
-void lenv_add_builtins(lenv* e){
+/* Every builtin with its name. Images refer to builtins by their index here */
+/* Builtins marked alone take no arguments, and are called when they */
+/* stand alone in an S-Expression rather than evaluating to themselves */
+static struct { char* name; lbuiltin func; int alone; } lbuiltins[] = {
     /* List Functions */
-    lenv_add_builtin(e, "list", builtin_list);
-    lenv_add_builtin(e, "head", builtin_head);
-    lenv_add_builtin(e, "tail", builtin_tail);
-    lenv_add_builtin(e, "eval", builtin_eval);
-    lenv_add_builtin(e, "join", builtin_join);
-    lenv_add_builtin(e, "cons", builtin_cons);
-    lenv_add_builtin(e, "init", builtin_init);
-    lenv_add_builtin(e, "len", builtin_len);
-    lenv_add_builtin(e, "def", builtin_def);
-    lenv_add_builtin(e, "=", builtin_put);
-    lenv_add_builtin(e, "\\", builtin_lambda);
-    lenv_add_builtin(e, "fun", builtin_fun);
+    {"list", builtin_list},
+    {"head", builtin_head},
+    {"tail", builtin_tail},
+    {"eval", builtin_eval},
+    {"join", builtin_join},
+    {"cons", builtin_cons},
+    {"init", builtin_init},
+    {"len", builtin_len},
+    {"def", builtin_def},
+    {"=", builtin_put},
+    {"\\", builtin_lambda},
+    {"fun", builtin_fun},
 
     /*Mathematical Functions*/
-    lenv_add_builtin(e,"+",builtin_add);
-    lenv_add_builtin(e,"-",builtin_sub);
-    lenv_add_builtin(e,"*",builtin_mul);
-    lenv_add_builtin(e,"/",builtin_div);
-    lenv_add_builtin(e,"%",builtin_mod);
+    {"+", builtin_add},
+    {"-", builtin_sub},
+    {"*", builtin_mul},
+    {"/", builtin_div},
+    {"%", builtin_mod},
+    {"sqrt", builtin_sqrt},
+    {"exp", builtin_exp},
+    {"log", builtin_log},
+    {"sin", builtin_sin},
+    {"cos", builtin_cos},
+    {"tan", builtin_tan},
+    {"atan", builtin_atan},
+    {"floor", builtin_floor},
+    {"ceil", builtin_ceil},
+    {"trunc", builtin_trunc},
+    {"pow", builtin_pow},
 
     /*Comparison Functions*/
-    lenv_add_builtin(e, "if", builtin_if);
-    lenv_add_builtin(e,"==",builtin_eq);
-    lenv_add_builtin(e,"!=",builtin_ne);
-    lenv_add_builtin(e,">",builtin_gt);
-    lenv_add_builtin(e,"<",builtin_lt);
-    lenv_add_builtin(e,">=",builtin_ge);
-    lenv_add_builtin(e,"<=",builtin_le);
+    {"if", builtin_if},
+    {"==", builtin_eq},
+    {"!=", builtin_ne},
+    {">", builtin_gt},
+    {"<", builtin_lt},
+    {">=", builtin_ge},
+    {"<=", builtin_le},
 
     /* Logical Functions */
-    lenv_add_builtin(e,"&&",builtin_and);
-    lenv_add_builtin(e,"||",builtin_or);
-    lenv_add_builtin(e,"!",builtin_not);
+    {"&&", builtin_and},
+    {"||", builtin_or},
+    {"!", builtin_not},
+
+    /* Map Functions */
+    {"map-new", builtin_map_new, 1},
+    {"map-get", builtin_map_get},
+    {"map-put", builtin_map_put},
+    {"map-del", builtin_map_del},
+    {"map-keys", builtin_map_keys},
+    {"map-size", builtin_map_size},
+
+    /* Vector Functions */
+    {"vec", builtin_vec},
+    {"vec->list", builtin_vec_list},
+    {"vec-add", builtin_vec_add},
+    {"vec-mul", builtin_vec_mul},
+    {"vec-sum", builtin_vec_sum},
+    {"vec-dot", builtin_vec_dot},
+    {"vec-map", builtin_vec_map},
 
     /* String Functions */
-    lenv_add_builtin(e,"load",builtin_load);
-    lenv_add_builtin(e,"print",builtin_print);
-    lenv_add_builtin(e,"error",builtin_error);
+    {"load", builtin_load},
+    {"print", builtin_print},
+    {"error", builtin_error},
+    {"str-len", builtin_str_len},
+    {"str-concat", builtin_str_concat},
+    {"substr", builtin_substr},
+    {"str-find", builtin_str_find},
+    {"str-split", builtin_str_split},
+    {"str-join", builtin_str_join},
+    {"str->num", builtin_str_num},
+
+    /* Profiling Functions */
+    {"profile-start", builtin_profile_start, 1},
+    {"profile-stop", builtin_profile_stop},
+    {"mem-report", builtin_mem_report, 1},
+};
+
+#define LBUILTINS_NUM ((int)(sizeof(lbuiltins)/sizeof(lbuiltins[0])))
+
+void lenv_add_builtins(lenv* e){
+    for(int i=0;i<LBUILTINS_NUM;i++){
+        lenv_add_builtin(e, lbuiltins[i].name, lbuiltins[i].func);
+    }
+}
+
+/* Name func is added under, or "builtin" if it isn't in lbuiltins */
+char* lbuiltin_name(lbuiltin func){
+    for(int i=0;i<LBUILTINS_NUM;i++){
+        if(lbuiltins[i].func == func){ return lbuiltins[i].name; }
+    }
+    return "builtin";
+}
+
+/* Whether func is called when it stands alone, see lbuiltins */
+int lbuiltin_alone(lbuiltin func){
+    for(int i=0;i<LBUILTINS_NUM;i++){
+        if(lbuiltins[i].func == func){ return lbuiltins[i].alone; }
+    }
+    return 0;
 }
 
 lval* lval_eval_sexpr(lenv* e,lval* v){
+    /* The profiler names a call after the symbol its function came from, */
+    /* so that symbol is looked up here and kept until the call returns */
+    lval* sym = NULL;
+    if((lprof_on || lmem_on) && v->count && v->cell[0]->type == LVAL_SYM){
+        sym = v->cell[0];
+        v->cell[0] = lenv_get(e, sym);
+    }
+
     /*Evaluate Children*/
-    for(int i =0;i<v->count;i++){
+    for(int i = sym ? 1 : 0;i<v->count;i++){
         v->cell[i] = lval_eval(e, v->cell[i]);
     }
 
     /* Error checking */
     for(int i=0;i<v->count;i++){
-        if(v->cell[i]->type==LVAL_ERR){return lval_take(v,i);}
+        if(v->cell[i]->type==LVAL_ERR){
+            if(sym){ lval_del(sym); }
+            return lval_take(v,i);
+        }
     }
 
     if(v->count==0){return v;}
-    if(v->count==1){return lval_take(v,0);}
+
+    /* A lone value is returned, unless it is a builtin taking no arguments */
+    if(v->count==1 && !(v->cell[0]->type == LVAL_FUN && v->cell[0]->builtin
+        && lbuiltin_alone(v->cell[0]->builtin))){
+        if(sym){ lval_del(sym); }
+        return lval_take(v,0);
+    }
 
     /* Ensure First element is a function after evaluation */
     lval* f = lval_pop(v,0);
@@ -1224,12 +4860,14 @@ lval* lval_eval_sexpr(lenv* e,lval* v){
             "Got %s, Expected %s.",
             ltype_name(f->type), ltype_name(LVAL_FUN));
         lval_del(v);lval_del(f);
+        if(sym){ lval_del(sym); }
         return err;
     }
 
     /* If so call function to get result */
-    lval* result = lval_call(e, f, v);
+    lval* result = lprof_on || lmem_on ? lprof_call(e, f, v, sym ? sym->sym : NULL) : lval_call(e, f, v);
     lval_del(f);
+    if(sym){ lval_del(sym); }
     return result;
 }
 
@@ -1244,75 +4882,808 @@ lval* lval_eval(lenv* e, lval* v){
     return v;
 }
 
-lval* builtin_load(lenv* e, lval* a){
-    LASSERT_NUM("load", a, 1);
-    LASSERT_TYPE("load", a, 0, LVAL_STR);
+/* Evaluate each form r reads as soon as it has been read. Returns NULL, */
+/* or an error for a form that couldn't be read */
+static lval* lload_forms(lenv* e, lreader* r){
+    lval* x;
+    while ((x = lread_next(r))){
+        if (r->failed){
+            /* Create new error message using the parse error */
+            lval* err = lval_err("Could not load library %s", x->err);
+            lval_del(x);
+            return err;
+        }
 
-    /* Parse File given by string name */
-    mpc_result_t r;
-    if(mpc_parse_contents(a->cell[0]->str, Lispy, &r)){
+        x = lval_eval(e, x);
+        /* If Evaluation leads to error print it */
+        if (x->type == LVAL_ERR) {lval_println(x);}
+        lval_del(x);
+    }
+    return NULL;
+}
+
+/*
+Lazy loading. With --lazy, load scans each file without reading it and
+only indexes the top-level (fun {name ...} ...) forms, and the
+(def {name} value) forms whose value is a number, string, Q-Expression
+or lambda, whose name isn't bound yet. Their values don't depend on when
+they are evaluated. Every other form is still read and evaluated in
+order, so a def computed from other names sees them as they are at that
+point in the file. An indexed form is read and evaluated the first time
+lenv_get misses its name, so a script only pays for the definitions it
+uses. A deferred definition's syntax errors happen when it is first used.
+*/
+
+typedef struct {
+    char* filename;
+    char* text;
+} llazy_file;
+
+typedef struct {
+    char* name;
+    llazy_file* file;
+    int start;
+    int end;
+    int row;
+    int col;
+    int pending;
+} llazy_def;
+
+/* Set by --lazy */
+static int llazy_on = 0;
+
+/* Open addressing table of definitions by name, the files they are in */
+/* and the environment they are evaluated in */
+static struct {
+    llazy_def* defs;
+    int slots;
+    int count;
+    llazy_file** files;
+    int files_num;
+    lenv* env;
+} llazy;
+
+static int llazy_space(char c){
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+/* Slot for name, which is empty if it has never been indexed */
+static llazy_def* llazy_find(char* name){
+    unsigned long mask = llazy.slots - 1;
+    for(unsigned long i = lhash_str(0, name) & mask;;i = (i+1) & mask){
+        if(!llazy.defs[i].name || strcmp(llazy.defs[i].name, name) == 0){
+            return &llazy.defs[i];
+        }
+    }
+}
+
+static void llazy_add(char* name, llazy_file* f, int start, int end, int row, int col){
+    if((llazy.count+1) * 4 > llazy.slots * 3){
+        llazy_def* defs = llazy.defs;
+        int slots = llazy.slots;
+        llazy.slots = slots ? slots * 2 : 256;
+        llazy.defs = calloc(llazy.slots, sizeof(llazy_def));
+        for(int i=0;i<slots;i++){
+            if(defs[i].name){ *llazy_find(defs[i].name) = defs[i]; }
+        }
+        free(defs);
+    }
+
+    llazy_def* d = llazy_find(name);
+    if(d->name){ free(name); }
+    else { d->name = name; llazy.count++; }
+    d->file = f;
+    d->start = start;
+    d->end = end;
+    d->row = row;
+    d->col = col;
+    d->pending = 1;
+}
+
+/* End of the bracketed form at s[i], or -1 if it doesn't close properly */
+static int llazy_form_end(char* s, int i){
+    char* closers = NULL;
+    int top = 0;
+    int cap = 0;
+    do {
+        char c = s[i];
+        if(c == '"'){
+            for(i++;s[i] && s[i] != '"';i++){
+                if(s[i] == '\\' && s[i+1]){ i++; }
+            }
+            if(!s[i]){ break; }
+            i++;
+        } else if(c == ';'){
+            while(s[i] && s[i] != '\r' && s[i] != '\n'){ i++; }
+        } else if(c == '(' || c == '{'){
+            if(top == cap){
+                cap = cap ? cap * 2 : 64;
+                closers = realloc(closers, cap);
+            }
+            closers[top++] = c == '(' ? ')' : '}';
+            i++;
+        } else if(c == ')' || c == '}'){
+            if(top == 0 || closers[top-1] != c){ break; }
+            top--;
+            i++;
+        } else if(c == '\0'){
+            break;
+        } else {
+            i++;
+        }
+    } while(top > 0);
+    free(closers);
+    return top == 0 ? i : -1;
+}
+
+/* End of a value at s[i] that is the same whenever it is evaluated: a */
+/* number, string, Q-Expression or lambda. Returns -1 for anything else */
+static int llazy_value_end(char* s, int i){
+    if(s[i] == '"' || s[i] == '{'){ return llazy_form_end(s, i); }
+    if(s[i] == '('){
+        int j = i + 1;
+        while(llazy_space(s[j])){ j++; }
+        if(s[j] != '\\' || lread_symtab[(unsigned char)s[j+1]]){ return -1; }
+        return llazy_form_end(s, i);
+    }
+
+    /* Numbers, as the reader reads them rather than as Symbols */
+    int j = i;
+    if(s[j] == '-'){ j++; }
+    if(!lread_digit(s[j])){ return -1; }
+    while(lread_digit(s[j])){ j++; }
+    if(s[j] == '.' && lread_digit(s[j+1])){
+        j++;
+        while(lread_digit(s[j])){ j++; }
+    }
+    if(lread_symtab[(unsigned char)s[j]]){ return -1; }
+    return j;
+}
+
+/* Name a (def {name} value) or (fun {name ...} ...) form at s[i] defines */
+/* when it can be deferred */
+static char* llazy_name(char* s, int i){
+    i++;
+    while(llazy_space(s[i])){ i++; }
+    if(strncmp(s + i, "def", 3) != 0 && strncmp(s + i, "fun", 3) != 0){ return NULL; }
+    int fun = s[i] == 'f';
+    i += 3;
+    if(lread_symtab[(unsigned char)s[i]]){ return NULL; }
+    while(llazy_space(s[i])){ i++; }
+    if(s[i] != '{'){ return NULL; }
+    i++;
+    while(llazy_space(s[i])){ i++; }
+
+    /* Only text the reader takes as a single Symbol */
+    int start = i;
+    while(lread_symtab[(unsigned char)s[i]]){ i++; }
+    if(i == start || lread_digit(s[start]) || (s[start] == '-' && lread_digit(s[start+1]))){
+        return NULL;
+    }
+    int end = i;
+    while(llazy_space(s[i])){ i++; }
+    if(s[i] != '}' && !(fun && lread_symtab[(unsigned char)s[i]])){ return NULL; }
+
+    /* A def's value must be a single one that doesn't read other names */
+    if(!fun){
+        i++;
+        while(llazy_space(s[i])){ i++; }
+        i = llazy_value_end(s, i);
+        if(i < 0){ return NULL; }
+        while(llazy_space(s[i])){ i++; }
+        if(s[i] != ')'){ return NULL; }
+    }
+
+    char* name = malloc(end - start + 1);
+    memcpy(name, s + start, end - start);
+    name[end - start] = '\0';
+    return name;
+}
+
+static int llazy_bound(lenv* e, char* name){
+    for(int i=0;i<e->count;i++){
+        if(strcmp(e->syms[i], name) == 0){ return 1; }
+    }
+    return 0;
+}
 
-        /* Read contents */
-        lval* expr = lval_read(r.output);
-        mpc_ast_delete(r.output);
+/* Reader over a copy of text[start..end), placed at row and col */
+static void llazy_reader(lreader* r, llazy_file* f, int start, int end, int row, int col){
+    char* s = malloc(end - start + 1);
+    memcpy(s, f->text + start, end - start);
+    s[end - start] = '\0';
+    lread_init(r, f->filename, s);
+    r->row = row;
+    r->col = col;
+}
+
+/* Load the forms in text[start..end) straight away */
+static lval* llazy_eval_range(lenv* e, llazy_file* f, int start, int end, int row, int col){
+    if(start == end){ return NULL; }
+    lreader r;
+    llazy_reader(&r, f, start, end, row, col);
+    lval* err = lload_forms(e, &r);
+    char* s = r.s;
+    lread_free(&r);
+    free(s);
+    return err;
+}
+
+/* Index the definitions in filename and evaluate everything else */
+lval* llazy_load(lenv* e, char* filename){
+    FILE* in = fopen(filename, "rb");
+    if(in == NULL){
+        return lval_err("Could not load library %s: error: Unable to open file!\n", filename);
+    }
+    llazy_file* f = malloc(sizeof(llazy_file));
+    f->filename = malloc(strlen(filename)+1);
+    strcpy(f->filename, filename);
+    f->text = NULL;
+    size_t len = 0, cap = 0, n;
+    do {
+        if(len + LREAD_CHUNK + 1 > cap){
+            cap = cap ? cap * 2 : LREAD_CHUNK + 1;
+            f->text = realloc(f->text, cap);
+        }
+        n = fread(f->text + len, 1, cap - len - 1, in);
+        len += n;
+    } while(n > 0);
+    f->text[len] = '\0';
+    fclose(in);
+    llazy.files = realloc(llazy.files, sizeof(llazy_file*) * (llazy.files_num+1));
+    llazy.files[llazy.files_num++] = f;
+
+    while(e->par){ e = e->par; }
+    llazy.env = e;
+    lread_tables();
+
+    /* Forms from eager up to i haven't been evaluated yet */
+    char* s = f->text;
+    int i = 0;
+    int eager = 0, eager_row = 0, eager_col = 0;
+    int row = 0, col = 0, at = 0;
+    lval* err = NULL;
+    while(s[i] && !err){
+        char c = s[i];
+        if(llazy_space(c)){ i++; continue; }
+        if(c == '(' || c == '{' || c == '"' || c == ';'){
+            int end = llazy_form_end(s, i);
+            if(end < 0){ break; }
+
+            char* name = c == '(' ? llazy_name(s, i) : NULL;
+            if(name){
+                /* Bring row and col up to i */
+                for(;at < i;at++){
+                    if(s[at] == '\n'){ row++; col = 0; }
+                    else { col++; }
+                }
+                err = llazy_eval_range(e, f, eager, i, eager_row, eager_col);
+                if(err || llazy_bound(e, name)){
+                    free(name);
+                    eager = i; eager_row = row; eager_col = col;
+                } else {
+                    llazy_add(name, f, i, end, row, col);
+                    for(;at < end;at++){
+                        if(s[at] == '\n'){ row++; col = 0; }
+                        else { col++; }
+                    }
+                    eager = end; eager_row = row; eager_col = col;
+                }
+            }
+            i = end;
+            continue;
+        }
+        /* A stray closing bracket is left for the reader to report */
+        if(c == ')' || c == '}'){ break; }
+        while(s[i] && !llazy_space(s[i]) && !strchr("(){}\";", s[i])){ i++; }
+    }
+
+    if(!err){ err = llazy_eval_range(e, f, eager, strlen(s), eager_row, eager_col); }
+    return err ? err : lval_sexpr();
+}
+
+/* Evaluate the pending definition of name. Returns NULL if there is none, */
+/* or else the result, which is an error if it failed */
+lval* llazy_define(char* name){
+    if(!llazy.count){ return NULL; }
+    llazy_def* d = llazy_find(name);
+    if(!d->name || !d->pending){ return NULL; }
+    d->pending = 0;
+
+    lreader r;
+    llazy_reader(&r, d->file, d->start, d->end, d->row, d->col);
+    lval* x = lread_next(&r);
+    if(x == NULL){ x = lval_sexpr(); }
+    char* s = r.s;
+    lread_free(&r);
+    free(s);
+
+    if(x->type == LVAL_ERR){
+        lval* err = lval_err("Could not load library %s", x->err);
+        lval_del(x);
+        return err;
+    }
+    return lval_eval(llazy.env, x);
+}
 
-        /* Evaluate each Expression */
-        while (expr->count){
-            lval* x = lval_eval(e, lval_pop(expr,0));
-            /* If Evaluation leads to error print it */
-            if (x->type == LVAL_ERR) {lval_println(x);}
+/* Evaluate every pending definition, as writing an image needs */
+void llazy_define_all(void){
+    /* Definitions can load files, adding more as this goes */
+    int again = 1;
+    while(again){
+        again = 0;
+        for(int i=0;i<llazy.slots;i++){
+            if(!llazy.defs[i].name || !llazy.defs[i].pending){ continue; }
+            /* Don't replace a name defined again since it was indexed */
+            if(llazy_bound(llazy.env, llazy.defs[i].name)){
+                llazy.defs[i].pending = 0;
+                continue;
+            }
+            lval* x = llazy_define(llazy.defs[i].name);
+            if(x->type == LVAL_ERR){ lval_println(x); }
             lval_del(x);
+            again = 1;
         }
+    }
+}
+
+void llazy_free(void){
+    for(int i=0;i<llazy.slots;i++){ free(llazy.defs[i].name); }
+    for(int i=0;i<llazy.files_num;i++){
+        free(llazy.files[i]->filename);
+        free(llazy.files[i]->text);
+        free(llazy.files[i]);
+    }
+    free(llazy.defs);
+    free(llazy.files);
+}
+
+lval* builtin_load(lenv* e, lval* a){
+    LASSERT_NUM("load", a, 1);
+    LASSERT_TYPE("load", a, 0, LVAL_STR);
 
-        /* Delete expressions and arguments */
-        lval_del(expr);
+    /* With --lazy definitions are only indexed until they are needed */
+    if (llazy_on){
+        lval* x = llazy_load(e, lval_str_bytes(a->cell[0]));
         lval_del(a);
+        return x;
+    }
 
-        /* Return empty list */
-        return lval_sexpr();
-    } 
-        
-    /* Get Parse Error as String */
-    char* err_msg = mpc_err_string(r.error);
-    mpc_err_delete(r.error);
+    /* Read the file given by string name one form at a time */
+    lreader r;
+    lread_open(&r, lval_str_bytes(a->cell[0]));
 
-    /* Create new error message using it */
-    lval* err = lval_err("Could not load library %s", err_msg);
-    free(err_msg);
+    /* Evaluate each Expression as soon as it has been read */
+    lval* err = lload_forms(e, &r);
+
+    /* Cleanup and return empty list */
+    lread_free(&r);
     lval_del(a);
+    return err ? err : lval_sexpr();
+}
 
-    /* Cleanup and return error */
-    return err;
+/*
+Heap images. --dump-image writes the bindings of the global environment
+as one block laid out the way they are in memory, with pointers set for
+the block sitting at LIMAGE_BASE. --image maps the block back, moving
+every pointer listed in the relocation table if it landed elsewhere,
+patches in the builtins and binds the values without copying them.
+Reading a value from the environment copies it as usual, and lval_del
+leaves values inside the image alone.
+*/
+
+#define LIMAGE_MAGIC "LSPYIMG"
+#define LIMAGE_VERSION 1
+
+/* Address images are laid out for. One mapped there is used as it is, */
+/* and its pages are only read in when the values on them are */
+#define LIMAGE_BASE ((uintptr_t)(sizeof(void*) > 4 ? 0x200000000000ULL : 0x50000000UL))
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t word;          /* sizeof(void*) and sizeof(lval) of the writer */
+    uint32_t lval_size;
+    uint32_t builtins;      /* Number of builtins, their names hashed into builtins_hash */
+    uint64_t builtins_hash;
+    uint64_t size;          /* Bytes in the whole file */
+    uint64_t env;           /* Offset of the lenv holding the bindings */
+    uint64_t relocs;        /* Offsets of pointer slots to relocate */
+    uint64_t relocs_num;
+    uint64_t funs;          /* Pairs of a builtin slot and its index in lbuiltins */
+    uint64_t funs_num;
+    uint64_t maps;          /* Offsets of the Maps, which may be updated in place */
+    uint64_t maps_num;
+} limage_header;
+
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+    uint64_t* relocs;
+    size_t relocs_num;
+    size_t relocs_cap;
+    uint64_t* funs;
+    size_t funs_num;
+    size_t funs_cap;
+
+    /* Maps written so far, so values sharing one still share it */
+    lmap** maps;
+    uint64_t* map_offs;
+    int maps_num;
+} limage_writer;
+
+#define LIMAGE_AT(w, off, type) ((type*)((w)->data + (off)))
+
+/* Whether the image was mapped rather than read into memory */
+static int limage_mapped;
+
+/* Maps in the loaded image, whose new entries are freed with it */
+static uint64_t* limage_maps;
+static uint64_t limage_maps_num;
+
+static uint64_t limage_hash_builtins(void){
+    unsigned long h = 0;
+    for(int i=0;i<LBUILTINS_NUM;i++){ h = lhash_str(h, lbuiltins[i].name); }
+    return h;
 }
 
-int main(int argc, char** argv){
-    Number = mpc_new("number");
-    Symbol = mpc_new("symbol");
-    String = mpc_new("string");
-    Comment = mpc_new("comment");
-    Sexpr = mpc_new("sexpr");
-    Qexpr = mpc_new("qexpr");
-    Expr = mpc_new("expr");
-    Lispy = mpc_new("lispy");
+static void limage_push(uint64_t** a, size_t* num, size_t* cap, uint64_t x){
+    if(*num == *cap){
+        *cap = *cap ? *cap * 2 : 256;
+        *a = realloc(*a, sizeof(uint64_t) * *cap);
+    }
+    (*a)[(*num)++] = x;
+}
 
-    mpca_lang(MPCA_LANG_DEFAULT,
-    "                                                        \
-        number  : /-?[0-9]+/ ;                               \
-        symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&|]+/;         \
-        string  : /\"(\\\\.|[^\"])*\"/;                      \
-        comment : /;[^\\r\\n]*/ ;                            \
-        sexpr   : '(' <expr>* ')' ;                          \
-        qexpr   : '{' <expr>* '}' ;                          \
-        expr    :  <number> | <symbol> | <string>            \
-                | <comment> |<sexpr> | <qexpr> ;             \
-        lispy   : /^/<expr>*/$/ ;                            \
-    ",
-    Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+/* Zeroed space for n bytes, aligned for any field */
+static uint64_t limage_alloc(limage_writer* w, size_t n){
+    size_t off = (w->len + 7) & ~(size_t)7;
+    if(off + n > w->cap){
+        while(off + n > w->cap){ w->cap *= 2; }
+        w->data = realloc(w->data, w->cap);
+    }
+    memset(w->data + w->len, 0, off + n - w->len);
+    w->len = off + n;
+    return off;
+}
+
+/* Point the pointer at slot to target and record it for relocation */
+static void limage_link(limage_writer* w, uint64_t slot, uint64_t target){
+    *LIMAGE_AT(w, slot, uintptr_t) = LIMAGE_BASE + (uintptr_t)target;
+    limage_push(&w->relocs, &w->relocs_num, &w->relocs_cap, slot);
+}
+
+static uint64_t limage_bytes(limage_writer* w, char* s, int n){
+    uint64_t off = limage_alloc(w, n+1);
+    memcpy(w->data + off, s, n);
+    return off;
+}
+
+static uint64_t limage_val(limage_writer* w, lval* v);
+static uint64_t limage_env(limage_writer* w, lenv* e, int* keep);
+
+/* Live entries rehashed into the same number of slots, leaving no tombs */
+static uint64_t limage_map(limage_writer* w, lmap* m){
+    for(int i=0;i<w->maps_num;i++){
+        if(w->maps[i] == m){ return w->map_offs[i]; }
+    }
+
+    uint64_t off = limage_alloc(w, sizeof(lmap));
+    w->maps = realloc(w->maps, sizeof(lmap*) * (w->maps_num+1));
+    w->map_offs = realloc(w->map_offs, sizeof(uint64_t) * (w->maps_num+1));
+    w->maps[w->maps_num] = m;
+    w->map_offs[w->maps_num++] = off;
+
+    int slots = m->slots;
+    uint64_t hashes = limage_alloc(w, sizeof(unsigned long) * slots);
+    uint64_t keys = limage_alloc(w, sizeof(lval*) * slots);
+    uint64_t vals = limage_alloc(w, sizeof(lval*) * slots);
+    lmap* x = LIMAGE_AT(w, off, lmap);
+    x->refs = 1;
+    x->count = m->count;
+    x->used = m->count;
+    x->slots = slots;
+    limage_link(w, off + offsetof(lmap, hashes), hashes);
+    limage_link(w, off + offsetof(lmap, keys), keys);
+    limage_link(w, off + offsetof(lmap, vals), vals);
+
+    for(int i=0;i<slots;i++){
+        if(!LMAP_LIVE(m, i)){ continue; }
+        unsigned long j = m->hashes[i] & (slots-1);
+        while(*LIMAGE_AT(w, keys + j * sizeof(lval*), uintptr_t)){ j = (j+1) & (slots-1); }
+        LIMAGE_AT(w, hashes, unsigned long)[j] = m->hashes[i];
+        limage_link(w, keys + j * sizeof(lval*), limage_val(w, m->keys[i]));
+        limage_link(w, vals + j * sizeof(lval*), limage_val(w, m->vals[i]));
+    }
+    return off;
+}
+
+static uint64_t limage_val(limage_writer* w, lval* v){
+    uint64_t off = limage_alloc(w, sizeof(lval));
+    LIMAGE_AT(w, off, lval)->type = v->type;
+
+    switch(v->type){
+        case LVAL_NUM: LIMAGE_AT(w, off, lval)->num = v->num; break;
+        case LVAL_DBL: LIMAGE_AT(w, off, lval)->dbl = v->dbl; break;
+        case LVAL_ERR:
+            limage_link(w, off + offsetof(lval, err), limage_bytes(w, v->err, strlen(v->err)));
+        break;
+        case LVAL_SYM:
+            limage_link(w, off + offsetof(lval, sym), limage_bytes(w, v->sym, strlen(v->sym)));
+        break;
+        /* Ropes are flattened, which their other holders don't notice */
+        case LVAL_STR: {
+            uint64_t str = limage_bytes(w, lval_str_bytes(v), v->len);
+            LIMAGE_AT(w, off, lval)->len = v->len;
+            LIMAGE_AT(w, off, lval)->cap = v->len + 1;
+            limage_link(w, off + offsetof(lval, str), str);
+        }
+        break;
+        /* Builtins are patched in by index when the image is loaded */
+        case LVAL_FUN:
+            if(v->builtin){
+                int i = 0;
+                while(lbuiltins[i].func != v->builtin){ i++; }
+                limage_push(&w->funs, &w->funs_num, &w->funs_cap, off + offsetof(lval, builtin));
+                limage_push(&w->funs, &w->funs_num, &w->funs_cap, i);
+                break;
+            }
+            limage_link(w, off + offsetof(lval, env), limage_env(w, v->env, NULL));
+            limage_link(w, off + offsetof(lval, formals), limage_val(w, v->formals));
+            limage_link(w, off + offsetof(lval, body), limage_val(w, v->body));
+        break;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR: {
+            LIMAGE_AT(w, off, lval)->count = v->count;
+            if(v->count == 0){ break; }
+            uint64_t cell = limage_alloc(w, sizeof(lval*) * v->count);
+            limage_link(w, off + offsetof(lval, cell), cell);
+            for(int i=0;i<v->count;i++){
+                limage_link(w, cell + i * sizeof(lval*), limage_val(w, v->cell[i]));
+            }
+        }
+        break;
+        case LVAL_MAP:
+            limage_link(w, off + offsetof(lval, map), limage_map(w, v->map));
+        break;
+        /* Bignum digits and Vector elements follow their headers */
+        case LVAL_BIG: {
+            size_t n = sizeof(lbig) + sizeof(uint32_t) * (v->big->len > 0 ? v->big->len : 1);
+            uint64_t big = limage_alloc(w, n);
+            memcpy(w->data + big, v->big, n);
+            limage_link(w, big + offsetof(lbig, d), big + sizeof(lbig));
+            limage_link(w, off + offsetof(lval, big), big);
+        }
+        break;
+        case LVAL_VEC: {
+            size_t n = sizeof(lvec) + sizeof(int64_t) * v->vec->count;
+            uint64_t vec = limage_alloc(w, n);
+            memcpy(w->data + vec, v->vec, n);
+            limage_link(w, vec + offsetof(lvec, i), vec + sizeof(lvec));
+            limage_link(w, vec + offsetof(lvec, d), vec + sizeof(lvec));
+            limage_link(w, off + offsetof(lval, vec), vec);
+        }
+        break;
+    }
+    return off;
+}
+
+/* The bindings of e, only those with keep set if it is given. The parent */
+/* is left out since calling a function sets it */
+static uint64_t limage_env(limage_writer* w, lenv* e, int* keep){
+    int count = 0;
+    for(int i=0;i<e->count;i++){ count += keep ? keep[i] : 1; }
+
+    uint64_t off = limage_alloc(w, sizeof(lenv));
+    LIMAGE_AT(w, off, lenv)->count = count;
+    if(count == 0){ return off; }
+
+    uint64_t syms = limage_alloc(w, sizeof(char*) * count);
+    uint64_t vals = limage_alloc(w, sizeof(lval*) * count);
+    limage_link(w, off + offsetof(lenv, syms), syms);
+    limage_link(w, off + offsetof(lenv, vals), vals);
+    for(int i=0, j=0;i<e->count;i++){
+        if(keep && !keep[i]){ continue; }
+        limage_link(w, syms + j * sizeof(char*), limage_bytes(w, e->syms[i], strlen(e->syms[i])));
+        limage_link(w, vals + j * sizeof(lval*), limage_val(w, e->vals[i]));
+        j++;
+    }
+    return off;
+}
+
+/* Write the bindings of e to filename, leaving out builtins still bound */
+/* under their own names since every Lispy has those */
+lval* limage_dump(lenv* e, char* filename){
+    limage_writer w = {0};
+    w.cap = 1 << 16;
+    w.data = malloc(w.cap);
+    limage_alloc(&w, sizeof(limage_header));
+
+    int* keep = malloc(sizeof(int) * (e->count ? e->count : 1));
+    for(int i=0;i<e->count;i++){
+        lval* v = e->vals[i];
+        keep[i] = 1;
+        for(int j=0;j<LBUILTINS_NUM && v->type == LVAL_FUN && v->builtin;j++){
+            if(lbuiltins[j].func == v->builtin && strcmp(lbuiltins[j].name, e->syms[i]) == 0){
+                keep[i] = 0;
+            }
+        }
+    }
+    uint64_t env = limage_env(&w, e, keep);
+    free(keep);
+
+    /* The tables follow the values they describe */
+    uint64_t relocs = limage_alloc(&w, sizeof(uint64_t) * w.relocs_num);
+    if(w.relocs_num){ memcpy(w.data + relocs, w.relocs, sizeof(uint64_t) * w.relocs_num); }
+    uint64_t funs = limage_alloc(&w, sizeof(uint64_t) * w.funs_num);
+    if(w.funs_num){ memcpy(w.data + funs, w.funs, sizeof(uint64_t) * w.funs_num); }
+    uint64_t maps = limage_alloc(&w, sizeof(uint64_t) * w.maps_num);
+    if(w.maps_num){ memcpy(w.data + maps, w.map_offs, sizeof(uint64_t) * w.maps_num); }
+
+    limage_header* h = LIMAGE_AT(&w, 0, limage_header);
+    memcpy(h->magic, LIMAGE_MAGIC, sizeof(h->magic));
+    h->version = LIMAGE_VERSION;
+    h->word = sizeof(void*);
+    h->lval_size = sizeof(lval);
+    h->builtins = LBUILTINS_NUM;
+    h->builtins_hash = limage_hash_builtins();
+    h->size = w.len;
+    h->env = env;
+    h->relocs = relocs;
+    h->relocs_num = w.relocs_num;
+    h->funs = funs;
+    h->funs_num = w.funs_num / 2;
+    h->maps = maps;
+    h->maps_num = w.maps_num;
+
+    FILE* f = fopen(filename, "wb");
+    int ok = f && fwrite(w.data, 1, w.len, f) == w.len;
+    if(f && fclose(f) != 0){ ok = 0; }
+
+    free(w.data);
+    free(w.relocs);
+    free(w.funs);
+    free(w.maps);
+    free(w.map_offs);
+    return ok ? lval_sexpr() : lval_err("Could not write image %s", filename);
+}
+
+/* Check the header and the tables used on every load lie inside the image */
+static int limage_valid(char* base, size_t size){
+    limage_header* h = (limage_header*)base;
+    if(size < sizeof(limage_header)
+        || memcmp(h->magic, LIMAGE_MAGIC, sizeof(h->magic)) != 0
+        || h->version != LIMAGE_VERSION
+        || h->word != sizeof(void*)
+        || h->lval_size != sizeof(lval)
+        || h->builtins != LBUILTINS_NUM
+        || h->builtins_hash != limage_hash_builtins()
+        || h->size != size
+        || h->env % sizeof(void*) || h->env > size - sizeof(lenv)
+        || h->relocs > size || h->relocs_num > (size - h->relocs) / sizeof(uint64_t)
+        || h->funs > size || h->funs_num > (size - h->funs) / (2 * sizeof(uint64_t))
+        || h->maps > size || h->maps_num > (size - h->maps) / sizeof(uint64_t)){
+        return 0;
+    }
+
+    uint64_t* funs = (uint64_t*)(base + h->funs);
+    for(uint64_t i=0;i<h->funs_num;i++){
+        if(funs[2*i] % sizeof(void*) || funs[2*i] > size - sizeof(void*)){ return 0; }
+        if(funs[2*i+1] >= LBUILTINS_NUM){ return 0; }
+    }
+    uint64_t* maps = (uint64_t*)(base + h->maps);
+    for(uint64_t i=0;i<h->maps_num;i++){
+        if(maps[i] % sizeof(void*) || maps[i] > size - sizeof(lmap)){ return 0; }
+    }
+    return 1;
+}
+
+/* Move every pointer by delta for an image that isn't at LIMAGE_BASE */
+static int limage_relocate(char* base, size_t size, uintptr_t delta){
+    limage_header* h = (limage_header*)base;
+    uint64_t* relocs = (uint64_t*)(base + h->relocs);
+    for(uint64_t i=0;i<h->relocs_num;i++){
+        if(relocs[i] % sizeof(void*) || relocs[i] > size - sizeof(void*)){ return 0; }
+        uintptr_t* slot = (uintptr_t*)(base + relocs[i]);
+        if(*slot - LIMAGE_BASE >= size){ return 0; }
+        *slot += delta;
+    }
+    return 1;
+}
+
+void limage_close(void){
+    /* Entries put into the image's Maps since it was loaded, and any */
+    /* tables they grew into, are the only memory it owns outside itself */
+    for(uint64_t i=0;i<limage_maps_num;i++){
+        lmap* m = (lmap*)(limage_base + limage_maps[i]);
+        for(int j=0;j<m->slots;j++){
+            if(!LMAP_LIVE(m, j)){ continue; }
+            lval_del(m->keys[j]);
+            lval_del(m->vals[j]);
+        }
+        if(!LIMAGE_OWNS(m->keys)){ free(m->hashes); free(m->keys); free(m->vals); }
+    }
+    limage_maps = NULL;
+    limage_maps_num = 0;
+
+#ifdef LISPY_HAVE_MMAP
+    if(limage_mapped){ munmap(limage_base, limage_size); limage_base = NULL; }
+#endif
+    free(limage_base);
+    limage_base = NULL;
+    limage_size = 0;
+    limage_mapped = 0;
+}
+
+/* Map filename and bind everything in it into e */
+lval* limage_load(lenv* e, char* filename){
+    if(limage_base){ return lval_err("Only one image can be loaded"); }
+
+    FILE* f = fopen(filename, "rb");
+    if(f == NULL){ return lval_err("Could not open image %s", filename); }
+
+    char* base = NULL;
+    size_t size = 0;
+#ifdef LISPY_HAVE_MMAP
+    struct stat st;
+    if(fstat(fileno(f), &st) == 0 && st.st_size > 0){
+        size = st.st_size;
+        base = mmap((void*)LIMAGE_BASE, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(f), 0);
+        if(base == MAP_FAILED){ base = NULL; }
+        limage_mapped = base != NULL;
+    }
+#endif
+    /* Read it into memory where it can't be mapped */
+    if(base == NULL){
+        size = 0;
+        if(fseek(f, 0, SEEK_END) == 0){ size = ftell(f); rewind(f); }
+        base = malloc(size ? size : 1);
+        if(fread(base, 1, size, f) != size){ size = 0; }
+    }
+    fclose(f);
+
+    limage_base = base;
+    limage_size = size;
+    uintptr_t delta = (uintptr_t)base - LIMAGE_BASE;
+    if(!limage_valid(base, size) || (delta && !limage_relocate(base, size, delta))){
+        limage_close();
+        return lval_err("Image %s was not written by this Lispy", filename);
+    }
+
+    limage_header* h = (limage_header*)base;
+    uint64_t* funs = (uint64_t*)(base + h->funs);
+    for(uint64_t i=0;i<h->funs_num;i++){
+        *(lbuiltin*)(base + funs[2*i]) = lbuiltins[funs[2*i+1]].func;
+    }
+    limage_maps = (uint64_t*)(base + h->maps);
+    limage_maps_num = h->maps_num;
+
+    /* Names in the image replace those already bound, which are only */
+    /* checked against the bindings that were there before */
+    lenv* img = (lenv*)(base + h->env);
+    int before = e->count;
+    e->vals = realloc(e->vals, sizeof(lval*) * (before + img->count));
+    e->syms = realloc(e->syms, sizeof(char*) * (before + img->count));
+    for(int i=0;i<img->count;i++){
+        int j = 0;
+        while(j < before && strcmp(e->syms[j], img->syms[i]) != 0){ j++; }
+        if(j == before){ j = e->count++; }
+        else { lval_del(e->vals[j]); free(e->syms[j]); }
+        e->syms[j] = img->syms[i];
+        e->vals[j] = img->vals[i];
+    }
+    return lval_sexpr();
+}
+
+int main(int argc, char** argv){
+    /* Count allocations by function too, and report them at exit */
+    if (getenv("LISPY_MEM_REPORT")) { lmem_start(); }
 
     lenv* e = lenv_new();
     lenv_add_builtins(e);
 
-    puts("Lispy version 0.0.0.1.1"); 
+    puts("Lispy version " LISPY_VERSION);
     puts("Press Ctrl-c to Exit\n");
 
     if (argc >= 2) {
@@ -1320,6 +5691,38 @@ int main(int argc, char** argv){
         /* loop over each supplied filename (starting from 1) */
         for (int i=1; i<argc; i++){
 
+            /* Switch back to the mpc grammar for reading */
+            if (strcmp(argv[i], "--mpc") == 0) { lread_use_mpc = 1; continue; }
+
+            /* Neither read nor write .lspyc caches */
+            if (strcmp(argv[i], "--no-cache") == 0) { lcache_off = 1; continue; }
+
+            /* Only index definitions in the files loaded from here on */
+            if (strcmp(argv[i], "--lazy") == 0) { llazy_on = 1; continue; }
+
+            /* Bind everything in an image written by --dump-image */
+            if (strcmp(argv[i], "--image") == 0 && i+1 < argc) {
+                lval* x = limage_load(e, argv[++i]);
+                if (x->type == LVAL_ERR) { lval_println(x); }
+                lval_del(x);
+                continue;
+            }
+
+            /* Write what the files so far have defined to an image and exit */
+            if (strcmp(argv[i], "--dump-image") == 0 && i+1 < argc) {
+                llazy_define_all();
+                lval* x = limage_dump(e, argv[++i]);
+                int failed = x->type == LVAL_ERR;
+                if (failed) { lval_println(x); }
+                lval_del(x);
+                if (lmem_on) { lmem_report(stderr); }
+                lenv_del(e);
+                llazy_free();
+                limage_close();
+                lread_mpc_cleanup();
+                return failed;
+            }
+
             /* Argument list with single argument, the filename */
             lval* args = lval_add(lval_sexpr(), lval_str(argv[i]));
 
@@ -1336,7 +5739,6 @@ int main(int argc, char** argv){
 
     while(state){
 
-        mpc_result_t r;
         char* input  = readline("Input> ");
         add_history(input);
 
@@ -1346,22 +5748,24 @@ int main(int argc, char** argv){
             continue;
         }
 
-        if(mpc_parse("<stdin>",input,Lispy,&r)){
-
-            lval* x = lval_eval(e, lval_read(r.output));
+        lval* x = lval_read_src("<stdin>", input);
+        if(x->type != LVAL_ERR){
+            x = lval_eval(e, x);
             lval_println(x);
-            lval_del(x);
-
-            mpc_ast_delete(r.output);
         }else{
-            mpc_err_print(r.error);
-            mpc_err_delete(r.error);
+            /* Parse errors are printed bare, as mpc does */
+            lout_puts(x->err);
+            lout_flush();
         }
+        lval_del(x);
 
         free(input);
     }
 
+    if (lmem_on) { lmem_report(stderr); }
     lenv_del(e);
-    mpc_cleanup(8,Number, Symbol, String, Comment,Sexpr, Qexpr, Expr, Lispy);
+    llazy_free();
+    limage_close();
+    lread_mpc_cleanup();
     return 0;
 }
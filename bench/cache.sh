@@ -0,0 +1,36 @@
+#!/bin/sh
+# Load time with and without .lspyc caches, for the stdlib (n runs) and
+# for a generated library of the given size in megabytes
+# Run with: sh bench/cache.sh [n] [megabytes]
+
+n=${1:-50}
+mb=${2:-10}
+big=bench/cache-big.lspy
+
+sh bench/gen-read.sh "$big" "$mb"
+
+# Average milliseconds to load a file and exit, over runs launches
+time_load() {
+    runs=$1
+    shift
+    start=$(date +%s%N)
+    i=0
+    while [ $i -lt "$runs" ]; do
+        printf 'exit\n' | ./Lispy "$@" >/dev/null
+        i=$((i + 1))
+    done
+    end=$(date +%s%N)
+    echo "$(( (end - start) / runs / 1000 ))us"
+}
+
+for file in stdlib.lspy "$big"; do
+    runs=$n
+    [ "$file" = "$big" ] && runs=5
+    rm -f "${file}c"
+    echo "$file: $(wc -c < "$file") bytes"
+    echo "  source     $(time_load "$runs" --no-cache "$file")"
+    echo "  writing    $(rm -f "${file}c"; time_load 1 "$file")"
+    echo "  cached     $(time_load "$runs" "$file") ($(wc -c < "${file}c") byte cache)"
+done
+
+rm -f "$big" "${big}c" stdlib.lspyc
@@ -0,0 +1,16 @@
+#!/bin/sh
+# Reader benchmark: write a file of definitions, comments and literals,
+# about 4MB unless a size in megabytes is given
+# Run with: sh bench/gen-read.sh && echo exit | ./Lispy --no-cache bench/read-big.lspy
+# and compare against: echo exit | ./Lispy --mpc bench/read-big.lspy
+
+out=${1:-bench/read-big.lspy}
+mb=${2:-4}
+
+# Each record is about 110 bytes
+awk -v n=$((mb * 1000000 / 110)) 'BEGIN {
+    for (i = 0; i < n; i++) {
+        printf "; record %d\n", i
+        printf "(def {row} {%d %d.5 -%d \"name %d\\n\" sym-%d {nested (+ %d 1) {deep %de3}}})\n", i, i, i, i, i, i, i
+    }
+}' > "$out"
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Image startup: load 1, 10 and 100 generated library files either as
+# source or from an image dumped from them, n times each
+# Run with: sh bench/image.sh [n]
+
+n=${1:-50}
+dir=bench/image-libs
+mkdir -p "$dir"
+
+# Each library is about 40 functions and a list of data, roughly 4KB
+gen() {
+    awk -v f="$1" 'BEGIN {
+        for (i = 0; i < 40; i++) {
+            printf "; function %d of library %d\n", i, f
+            printf "(fun {lib%d-fn%d x y} {if (> x y) {+ x (* y %d)} {- y x}})\n", f, i, i
+        }
+        printf "(def {lib%d-data} {", f
+        for (i = 0; i < 100; i++) { printf "%d \"item %d\" ", i, i }
+        printf "})\n"
+    }' > "$dir/lib$1.lspy"
+}
+
+time_launch() {
+    start=$(date +%s%N)
+    i=0
+    while [ $i -lt "$n" ]; do
+        printf 'exit\n' | ./Lispy "$@" >/dev/null
+        i=$((i + 1))
+    done
+    end=$(date +%s%N)
+    echo $(( (end - start) / n / 1000 ))
+}
+
+for libs in 1 10 100; do
+    files=""
+    for f in $(seq 1 $libs); do
+        [ -f "$dir/lib$f.lspy" ] || gen $f
+        files="$files $dir/lib$f.lspy"
+    done
+    ./Lispy $files --dump-image "$dir/libs.img" >/dev/null
+    src=$(time_launch --no-cache $files)
+    img=$(time_launch --image "$dir/libs.img")
+    echo "$libs libraries: ${src}us from source, ${img}us from image ($(wc -c < "$dir/libs.img") bytes)"
+done
+
+rm -r "$dir"
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Lazy loading: start up and run a script using three functions from a
+# library of 5000 definitions, loading the library eagerly from source,
+# eagerly from its .lspyc cache, and with --lazy, n times each
+# Run with: sh bench/lazy.sh [n]
+
+n=${1:-20}
+lib=bench/lazy-lib.lspy
+script=bench/lazy-script.lspy
+
+awk 'BEGIN {
+    for (i = 0; i < 5000; i++) {
+        if (i % 5 == 4) {
+            printf "(def {table-%d} {%d %d %d \"row %d\" {nested %d}})\n", i, i, i+1, i+2, i, i
+        } else {
+            printf "; function %d\n", i
+            printf "(fun {fn-%d x y} {if (> x y) {+ x (* y %d)} {- y (fn-%d y x)}})\n", i, i, i
+        }
+    }
+}' > "$lib"
+printf '(print (fn-1 3 2) (fn-2 5 1) (fn-3 2 7))\n' > "$script"
+
+time_run() {
+    start=$(date +%s%N)
+    i=0
+    while [ $i -lt "$n" ]; do
+        printf 'exit\n' | ./Lispy "$@" >/dev/null
+        i=$((i + 1))
+    done
+    end=$(date +%s%N)
+    echo "$(( (end - start) / n / 1000 ))us"
+}
+
+printf 'exit\n' | ./Lispy "$lib" >/dev/null
+echo "eager:  $(time_run --no-cache "$lib" "$script")"
+echo "cached: $(time_run "$lib" "$script")"
+echo "lazy:   $(time_run --lazy "$lib" "$script")"
+echo "output: $(printf 'exit\n' | ./Lispy --lazy "$lib" "$script" | sed -n 4p)"
+
+rm -f "$lib" "${lib}c" "$script"
@@ -0,0 +1,24 @@
+#!/bin/sh
+# Streaming load check: generate a 1GB file and load it with memory
+# limited to 64MB, which only works if forms are read and evaluated
+# one at a time
+# Run with: sh bench/load-stream.sh [megabytes]
+
+mb=${1:-1000}
+file=bench/load-big.lspy
+
+sh bench/gen-read.sh "$file" "$mb"
+ls -l "$file"
+
+# Finishes with (def {done} 1), so done is only bound if every form ran
+echo "(def {done} 1)" >> "$file"
+
+out=$( (ulimit -v 65536; printf 'done\nexit\n' | ./Lispy --no-cache "$file") 2>&1 | tail -n 1)
+rm -f "$file"
+
+if [ "$out" = "1" ]; then
+    echo "ok: loaded ${mb}MB within 64MB"
+else
+    echo "failed: $out"
+    exit 1
+fi
@@ -0,0 +1,21 @@
+#!/bin/sh
+# Allocation report: defines a list of n numbers, then measures, maps and
+# filters it with the stdlib with LISPY_MEM_REPORT set, and prints the report.
+# Each call copies the list it is passed, which shows up in the counts
+# Run with: sh bench/mem.sh [n]
+
+n=${1:-200}
+script=bench/mem-script.lspy
+
+awk -v n="$n" 'BEGIN {
+    printf "(def {xs} {"
+    for (i = 0; i < n; i++) printf " %d", i
+    printf "})\n"
+    printf "(print (len xs))\n"
+    printf "(print (len (map (\\ {x} {* x x}) xs)))\n"
+    printf "(print (len (filter (\\ {x} {> x %d}) xs)))\n", n / 2
+}' > "$script"
+
+printf 'exit\n' | LISPY_MEM_REPORT=1 ./Lispy --no-cache stdlib.lspy "$script" 2>&1 >/dev/null
+
+rm -f "$script"
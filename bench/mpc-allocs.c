@@ -0,0 +1,94 @@
+/*
+** mpc allocation benchmark: parse typical REPL lines with the Lispy
+** grammar and report heap allocations and time per successful line,
+** once freeing each tree with mpc_ast_delete and once building them
+** in an arena that is cleared after every line.
+**
+** Counting wraps malloc, so this needs GNU ld:
+** Build with: cc -std=c99 -O2 -I. bench/mpc-allocs.c mpc.c -o mpc-allocs \
+**               -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc
+** Run with:   ./mpc-allocs [repeats]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mpc.h"
+
+static long allocs = 0;
+
+void* __real_malloc(size_t n);
+void* __real_calloc(size_t n, size_t m);
+void* __real_realloc(void* p, size_t n);
+
+void* __wrap_malloc(size_t n){ allocs++; return __real_malloc(n); }
+void* __wrap_calloc(size_t n, size_t m){ allocs++; return __real_calloc(n, m); }
+void* __wrap_realloc(void* p, size_t n){ allocs++; return __real_realloc(p, n); }
+
+static const char* lines[] = {
+    "(+ 1 2)",
+    "(def {x} 10)",
+    "(def {fun} (\\ {args body} {def (head args) (\\ (tail args) body)}))",
+    "(fun {fib n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}})",
+    "(print \"hello, world\\n\") ; say hello",
+    "(map (\\ {x} {* x 2.5}) {1 2 3 -4 5e3})",
+};
+
+int main(int argc, char** argv){
+    int repeats = argc > 1 ? atoi(argv[1]) : 20000;
+    int nlines = sizeof(lines) / sizeof(lines[0]);
+
+    mpc_parser_t* Number  = mpc_new("number");
+    mpc_parser_t* Symbol  = mpc_new("symbol");
+    mpc_parser_t* String  = mpc_new("string");
+    mpc_parser_t* Comment = mpc_new("comment");
+    mpc_parser_t* Sexpr   = mpc_new("sexpr");
+    mpc_parser_t* Qexpr   = mpc_new("qexpr");
+    mpc_parser_t* Expr    = mpc_new("expr");
+    mpc_parser_t* Lispy   = mpc_new("lispy");
+
+    mpca_lang(MPCA_LANG_DEFAULT,
+        " number  : /-?[0-9]+(\\.[0-9]+)?([eE][-+]?[0-9]+)?/ ;     "
+        " symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&|]+/ ;             "
+        " string  : /\"(\\\\.|[^\"])*\"/ ;                          "
+        " comment : /;[^\\r\\n]*/ ;                                 "
+        " sexpr   : '(' <expr>* ')' ;                               "
+        " qexpr   : '{' <expr>* '}' ;                               "
+        " expr    : <number> | <symbol> | <string>                  "
+        "         | <comment> | <sexpr> | <qexpr> ;                 "
+        " lispy   : /^/ <expr>* /$/ ;                               ",
+        Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+
+    mpc_ast_arena_t* arena = mpc_ast_arena_new();
+
+    for(int use_arena=0;use_arena<2;use_arena++){
+        long before = allocs;
+        clock_t start = clock();
+        for(int k=0;k<repeats;k++){
+            for(int j=0;j<nlines;j++){
+                mpc_result_t r;
+                int ok = use_arena
+                    ? mpc_parse_arena("<stdin>", lines[j], Lispy, arena, &r)
+                    : mpc_parse("<stdin>", lines[j], Lispy, &r);
+                if(!ok){
+                    mpc_err_print(r.error);
+                    mpc_err_delete(r.error);
+                    return 1;
+                }
+                if(use_arena){ mpc_ast_arena_clear(arena); }
+                else{ mpc_ast_delete(r.output); }
+            }
+        }
+        double t = (double)(clock() - start) / CLOCKS_PER_SEC;
+        long n = (long)repeats * nlines;
+
+        printf("%-8s %.1f allocations and %.2f us per line\n", use_arena ? "arena:" : "malloc:",
+            (double)(allocs - before) / n, t / n * 1e6);
+    }
+
+    mpc_ast_arena_delete(arena);
+    mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+    return 0;
+}
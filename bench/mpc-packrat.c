@@ -0,0 +1,66 @@
+/*
+** mpc packrat benchmark: a grammar that backtracks over the same nested
+** expression twice at every level, so plain parsing takes time doubling
+** with each level of nesting while packrat parsing stays linear.
+**
+** Build with: cc -std=c99 -O2 -I. bench/mpc-packrat.c mpc.c -o mpc-packrat
+** Run with:   ./mpc-packrat
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mpc.h"
+
+static const char* grammar =
+    " expr : '(' <expr> ')' '!' | '(' <expr> ')' | 'a' ; "
+    " top  : /^/ <expr> /$/ ; ";
+
+/* Time one parse of n nested parentheses, or -1 if it fails */
+static double run(mpc_parser_t* top, int n){
+    char* s = malloc(2*n + 2);
+    memset(s, '(', n);
+    s[n] = 'a';
+    memset(s+n+1, ')', n);
+    s[2*n+1] = '\0';
+
+    clock_t start = clock();
+    mpc_result_t r;
+    int ok = mpc_parse("<bench>", s, top, &r);
+    double t = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    if(ok){ mpc_ast_delete(r.output); }
+    else { mpc_err_print(r.error); mpc_err_delete(r.error); t = -1; }
+    free(s);
+    return t;
+}
+
+int main(void){
+    mpc_parser_t* Expr = mpc_new("expr");
+    mpc_parser_t* Top = mpc_new("top");
+    mpca_lang(MPCA_LANG_DEFAULT, grammar, Expr, Top, NULL);
+
+    mpc_parser_t* PExpr = mpc_new("expr");
+    mpc_parser_t* PTop = mpc_new("top");
+    mpca_lang(MPCA_LANG_PACKRAT, grammar, PExpr, PTop, NULL);
+
+    printf("%8s %12s %12s\n", "depth", "plain (s)", "packrat (s)");
+    for(int n = 2; n <= 4096; n *= 2){
+        /* Plain parsing is skipped once it would take minutes */
+        double plain = n <= 20 ? run(Top, n) : -1;
+        double packrat = run(PTop, n);
+        if(plain >= 0){ printf("%8d %12.4f %12.4f\n", n, plain, packrat); }
+        else { printf("%8d %12s %12.4f\n", n, "-", packrat); }
+        if(n == 16){
+            /* Fill in the depths around where plain parsing gives up */
+            for(int m = 18; m <= 20; m += 2){
+                printf("%8d %12.4f %12.4f\n", m, run(Top, m), run(PTop, m));
+            }
+        }
+    }
+
+    mpc_cleanup(4, Expr, Top, PExpr, PTop);
+    return 0;
+}
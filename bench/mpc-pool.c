@@ -0,0 +1,105 @@
+/*
+** mpc pool benchmark: parse a generated file of Lispy records the way
+** `load` does with --mpc, and report heap allocations, throughput and
+** how often the per-parse pool had to fall back to malloc.
+**
+** Counting wraps malloc, so this needs GNU ld:
+** Build with: cc -std=c99 -O2 -I. bench/mpc-pool.c mpc.c -o mpc-pool \
+**               -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc
+** Run with:   ./mpc-pool [megabytes] [depth] [pool-max-kb]
+**
+** A depth nests each record in that many braces, which keeps more
+** allocations live at once.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mpc.h"
+
+static long allocs = 0;
+
+void* __real_malloc(size_t n);
+void* __real_calloc(size_t n, size_t m);
+void* __real_realloc(void* p, size_t n);
+
+void* __wrap_malloc(size_t n){ allocs++; return __real_malloc(n); }
+void* __wrap_calloc(size_t n, size_t m){ allocs++; return __real_calloc(n, m); }
+void* __wrap_realloc(void* p, size_t n){ allocs++; return __real_realloc(p, n); }
+
+/* The records bench/gen-read.sh writes, about n bytes of them */
+static char* make_input(long n, int depth){
+    char* s = malloc(n + 2 * depth + 256);
+    long len = 0;
+    for(long i=0;len<n;i++){
+        len += sprintf(s+len, "; record %ld\n", i);
+        for(int d=0;d<depth;d++){ s[len++] = '{'; }
+        len += sprintf(s+len,
+            "(def {row} {%ld %ld.5 -%ld \"name %ld\\n\" sym-%ld {nested (+ %ld 1) {deep %lde3}}})",
+            i, i, i, i, i, i, i);
+        for(int d=0;d<depth;d++){ s[len++] = '}'; }
+        s[len++] = '\n';
+    }
+    s[len] = '\0';
+    return s;
+}
+
+int main(int argc, char** argv){
+    long n = (argc > 1 ? atol(argv[1]) : 4) * 1000L * 1000L;
+    int depth = argc > 2 ? atoi(argv[2]) : 0;
+    if(argc > 3){ mpc_mem_pool(0, (size_t)atol(argv[3]) * 1024); }
+
+    mpc_parser_t* Number  = mpc_new("number");
+    mpc_parser_t* Symbol  = mpc_new("symbol");
+    mpc_parser_t* String  = mpc_new("string");
+    mpc_parser_t* Comment = mpc_new("comment");
+    mpc_parser_t* Sexpr   = mpc_new("sexpr");
+    mpc_parser_t* Qexpr   = mpc_new("qexpr");
+    mpc_parser_t* Expr    = mpc_new("expr");
+    mpc_parser_t* Lispy   = mpc_new("lispy");
+
+    mpca_lang(MPCA_LANG_DEFAULT,
+        " number  : /-?[0-9]+(\\.[0-9]+)?([eE][-+]?[0-9]+)?/ ;     "
+        " symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&|]+/ ;             "
+        " string  : /\"(\\\\.|[^\"])*\"/ ;                          "
+        " comment : /;[^\\r\\n]*/ ;                                 "
+        " sexpr   : '(' <expr>* ')' ;                               "
+        " qexpr   : '{' <expr>* '}' ;                               "
+        " expr    : <number> | <symbol> | <string>                  "
+        "         | <comment> | <sexpr> | <qexpr> ;                 "
+        " lispy   : /^/ <expr>* /$/ ;                               ",
+        Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+
+    char* s = make_input(n, depth);
+    n = strlen(s);
+    mpc_ast_arena_t* arena = mpc_ast_arena_new();
+
+    mpc_mem_stats_reset();
+    long before = allocs;
+    clock_t start = clock();
+    mpc_result_t r;
+    if(!mpc_parse_arena("<bench>", s, Lispy, arena, &r)){
+        mpc_err_print(r.error);
+        mpc_err_delete(r.error);
+        return 1;
+    }
+    double t = (double)(clock() - start) / CLOCKS_PER_SEC;
+    long used = allocs - before;
+
+    mpc_mem_stats_t m;
+    mpc_mem_stats(&m);
+    unsigned long total = m.pool + m.large + m.overflow;
+
+    printf("%ld bytes in %.3f seconds, %.1f MB/s\n", n, t, t > 0 ? n / t / 1e6 : 0.0);
+    printf("%ld heap allocations\n", used);
+    printf("pool: %lu of %lu allocations, %.2f%% too large, %.2f%% overflowed\n",
+        m.pool, total, total ? 100.0 * m.large / total : 0.0, total ? 100.0 * m.overflow / total : 0.0);
+    printf("pool: %lu bytes reserved, %lu used\n", m.reserved, m.used);
+
+    mpc_ast_arena_delete(arena);
+    free(s);
+    mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+    return 0;
+}
@@ -0,0 +1,72 @@
+/*
+** mpc prediction benchmark: print the Lispy grammar's stats, then
+** parse a generated source file with it and report throughput. Each
+** `or` whose alternatives start with different characters jumps to
+** the one that can match instead of trying them in turn.
+**
+** Build with: cc -std=c99 -O2 -I. bench/mpc-predict.c mpc.c -o mpc-predict
+** Run with:   ./mpc-predict [megabytes]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mpc.h"
+
+/* Fill n bytes with whole lines of typical Lispy source */
+static char* make_input(long n){
+    const char* line = "(def {pair} (\\ {x y} {list x \"y\" (+ x 1.5)})) ; note\n";
+    long len = strlen(line);
+    n -= n % len;
+    char* s = malloc(n+1);
+    for(long i=0;i<n;i++){ s[i] = line[i % len]; }
+    s[n] = '\0';
+    return s;
+}
+
+int main(int argc, char** argv){
+    long n = (argc > 1 ? atol(argv[1]) : 4) * 1000L * 1000L;
+
+    mpc_parser_t* Number  = mpc_new("number");
+    mpc_parser_t* Symbol  = mpc_new("symbol");
+    mpc_parser_t* String  = mpc_new("string");
+    mpc_parser_t* Comment = mpc_new("comment");
+    mpc_parser_t* Sexpr   = mpc_new("sexpr");
+    mpc_parser_t* Qexpr   = mpc_new("qexpr");
+    mpc_parser_t* Expr    = mpc_new("expr");
+    mpc_parser_t* Lispy   = mpc_new("lispy");
+
+    mpca_lang(MPCA_LANG_DEFAULT,
+        " number  : /-?[0-9]+(\\.[0-9]+)?([eE][-+]?[0-9]+)?/ ;     "
+        " symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&|]+/ ;             "
+        " string  : /\"(\\\\.|[^\"])*\"/ ;                          "
+        " comment : /;[^\\r\\n]*/ ;                                 "
+        " sexpr   : '(' <expr>* ')' ;                               "
+        " qexpr   : '{' <expr>* '}' ;                               "
+        " expr    : <number> | <symbol> | <string>                  "
+        "         | <comment> | <sexpr> | <qexpr> ;                 "
+        " lispy   : /^/ <expr>* /$/ ;                               ",
+        Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+
+    mpc_stats(Lispy);
+
+    char* s = make_input(n);
+    n = strlen(s);
+    clock_t start = clock();
+    mpc_result_t r;
+    if(!mpc_nparse("<bench>", s, n, Lispy, &r)){
+        mpc_err_print(r.error);
+        mpc_err_delete(r.error);
+        return 1;
+    }
+    double t = (double)(clock() - start) / CLOCKS_PER_SEC;
+    mpc_ast_delete(r.output);
+
+    printf("%ld bytes in %.3f seconds, %.1f MB/s\n", n, t, t > 0 ? n / t / 1e6 : 0.0);
+
+    free(s);
+    mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+    return 0;
+}
@@ -0,0 +1,58 @@
+/*
+** mpc regex benchmark: tokenise a generated source file with Lispy's
+** number, symbol and comment regexes and report throughput. Regexes
+** that compile to a DFA match each token in a single scan.
+**
+** Build with: cc -std=c99 -O2 -I. bench/mpc-regex.c mpc.c -o mpc-regex
+** Run with:   ./mpc-regex [megabytes]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mpc.h"
+
+static mpc_val_t* count_tokens(int n, mpc_val_t** xs){
+    for(int i=0;i<n;i++){ free(xs[i]); }
+    return NULL;
+}
+
+/* Fill n bytes with tokens separated by single spaces */
+static char* make_input(long n){
+    const char* line = "def-var 12 -3.25 sym_1 6.02e23 list->vector ; a comment\n";
+    long len = strlen(line);
+    char* s = malloc(n+1);
+    for(long i=0;i<n;i++){ s[i] = line[i % len]; }
+    s[n-1] = '\n';
+    s[n] = '\0';
+    return s;
+}
+
+int main(int argc, char** argv){
+    long n = (argc > 1 ? atol(argv[1]) : 16) * 1000L * 1000L;
+
+    mpc_parser_t* Token = mpc_or(3,
+        mpc_re("-?[0-9]+(\\.[0-9]+)?([eE][-+]?[0-9]+)?"),
+        mpc_re("[a-zA-Z0-9_+\\-*\\/\\\\=<>!&|]+"),
+        mpc_re(";[^\\r\\n]*"));
+    mpc_parser_t* Tokens = mpc_many(count_tokens,
+        mpc_and(2, mpcf_fst, Token, mpc_re("\\s*"), free));
+
+    char* s = make_input(n);
+    clock_t start = clock();
+    mpc_result_t r;
+    if(!mpc_nparse("<bench>", s, n, Tokens, &r)){
+        mpc_err_print(r.error);
+        mpc_err_delete(r.error);
+        return 1;
+    }
+    double t = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("%ld bytes in %.3f seconds, %.1f MB/s\n", n, t, t > 0 ? n / t / 1e6 : 0.0);
+
+    free(s);
+    mpc_delete(Tokens);
+    return 0;
+}
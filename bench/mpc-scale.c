@@ -0,0 +1,59 @@
+/*
+** mpc string input benchmark: parse generated inputs from 1KB to 100MB
+** line by line and report throughput, which should stay flat as the
+** input grows.
+**
+** Build with: cc -std=c99 -O2 -I. bench/mpc-scale.c mpc.c -o mpc-scale
+** Run with:   ./mpc-scale [max bytes]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mpc.h"
+
+static mpc_val_t* count_lines(int n, mpc_val_t** xs){
+    for(int i=0;i<n;i++){ free(xs[i]); }
+    return NULL;
+}
+
+/* Fill n bytes with Lispy-looking lines */
+static char* make_input(long n){
+    const char* line = "(def {row} {1 2.5 \"name\\n\" sym-1 {nested (+ 1 1)}}) ; c\n";
+    long len = strlen(line);
+    char* s = malloc(n+1);
+    for(long i=0;i<n;i++){ s[i] = line[i % len]; }
+    s[n-1] = '\n';
+    s[n] = '\0';
+    return s;
+}
+
+int main(int argc, char** argv){
+    long max = argc > 1 ? atol(argv[1]) : 100L*1000*1000;
+
+    mpc_parser_t* Line = mpc_and(2, mpcf_fst_free,
+        mpc_many(mpcf_strfold, mpc_noneof("\n")), mpc_char('\n'), free);
+    mpc_parser_t* Lines = mpc_many(count_lines, Line);
+
+    printf("%12s %10s %10s\n", "bytes", "seconds", "MB/s");
+    for(long n = 1000; n <= max; n *= 10){
+        char* s = make_input(n);
+
+        clock_t start = clock();
+        mpc_result_t r;
+        if(!mpc_nparse("<bench>", s, n, Lines, &r)){
+            mpc_err_print(r.error);
+            mpc_err_delete(r.error);
+            return 1;
+        }
+        double t = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+        printf("%12ld %10.3f %10.1f\n", n, t, t > 0 ? n / t / 1e6 : 0.0);
+        free(s);
+    }
+
+    mpc_delete(Lines);
+    return 0;
+}
@@ -0,0 +1,27 @@
+#!/bin/sh
+# Profiler: times (fib n) from the stdlib with and without profiling, then
+# prints the functions with the most samples at the top of the stack and
+# leaves the collapsed stacks in bench/profile.folded for flamegraph.pl
+# Run with: sh bench/profile.sh [n]
+
+n=${1:-20}
+plain=bench/profile-plain.lspy
+prof=bench/profile-prof.lspy
+out=bench/profile.folded
+
+printf '(print (fib %s))\n' "$n" > "$plain"
+printf '(profile-start)\n(print (fib %s))\n(print (profile-stop "%s"))\n' "$n" "$out" > "$prof"
+
+time_run() {
+    start=$(date +%s%N)
+    printf 'exit\n' | ./Lispy --no-cache stdlib.lspy "$1" >/dev/null
+    end=$(date +%s%N)
+    echo "$(( (end - start) / 1000000 ))ms"
+}
+
+echo "off: $(time_run "$plain")"
+echo "on:  $(time_run "$prof")"
+echo "samples at the top of the stack:"
+awk '{ n = split($1, f, ";"); self[f[n]] += $2 } END { for (k in self) print self[k], k }' "$out" | sort -rn | head -5
+
+rm -f "$plain" "$prof"
@@ -0,0 +1,20 @@
+#!/bin/sh
+# Startup time: run the REPL on one line and exit, n times, with and
+# without --mpc. Only --mpc builds the mpc grammar
+# Run with: sh bench/startup.sh [n]
+
+n=${1:-200}
+
+run() {
+    start=$(date +%s%N)
+    i=0
+    while [ $i -lt "$n" ]; do
+        printf '(+ 1 2)\nexit\n' | ./Lispy "$@" >/dev/null
+        i=$((i + 1))
+    done
+    end=$(date +%s%N)
+    echo "$(( (end - start) / n / 1000 ))us per launch $*"
+}
+
+run
+run --mpc
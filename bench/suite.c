@@ -0,0 +1,223 @@
+/*
+** Interpreter benchmark suite: run a fixed set of Lispy programs a number
+** of times each and write, as JSON, their median and fastest wall time,
+** the values they allocated and their peak resident set size. The
+** allocations are the totals (mem-report) prints once a program has run,
+** so they are the same on every run of the same commit.
+**
+** Build and run with: make -C bench [RUNS=5] [OUT=results.json]
+** or from bench/:      ./suite [-n runs] [-c commit] [lispy] > results.json
+** Compare with:        ./suite -b old.json new.json [percent]
+** which lists the change for each program and fails if one got slower or
+** larger by more than percent, 10 by default, or allocated more.
+*/
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define MAX_RUNS 100
+
+typedef struct {
+    char* name;
+    char* args[4];
+} bcase;
+
+/* Paths are relative to bench/. Caches are off so every run reads source */
+static bcase cases[] = {
+    {"fib",     {"../stdlib.lspy", "fib.lspy"}},
+    {"list",    {"../stdlib.lspy", "list.lspy"}},
+    {"recurse", {"../stdlib.lspy", "recurse.lspy"}},
+    {"lookup",  {"../stdlib.lspy", "lookup.lspy"}},
+    {"print",   {"../stdlib.lspy", "print.lspy"}},
+    {"read",    {"read-big.lspy"}},
+};
+
+#define NCASES ((int)(sizeof(cases) / sizeof(cases[0])))
+
+typedef struct {
+    char name[64];
+    double wall_ms;
+    double wall_ms_min;
+    long allocs;
+    long peak_rss_kb;
+} bresult;
+
+static double now_ms(void){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+/* Run one case, reading the allocation totals from the report its */
+/* output ends with. Returns 0 if it didn't exit cleanly or printed an */
+/* error, as a program that stops early would otherwise look faster */
+static int run_case(char* lispy, bcase* c, double* ms, long* allocs, long* rss_kb){
+    int in[2], out[2];
+    if(pipe(in) != 0 || pipe(out) != 0){ return 0; }
+
+    double start = now_ms();
+    pid_t pid = fork();
+    if(pid < 0){ return 0; }
+    if(pid == 0){
+        char* argv[8];
+        int n = 0;
+        argv[n++] = lispy;
+        argv[n++] = "--no-cache";
+        for(int i=0;i<4 && c->args[i];i++){ argv[n++] = c->args[i]; }
+        argv[n] = NULL;
+
+        dup2(in[0], 0);
+        dup2(out[1], 1);
+        freopen("/dev/null", "w", stderr);
+        close(in[0]); close(in[1]); close(out[0]); close(out[1]);
+        execv(lispy, argv);
+        _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+
+    char* script = "(mem-report)\nexit\n";
+    if(write(in[1], script, strlen(script)) < 0){ perror("write"); }
+    close(in[1]);
+
+    /* Sum the allocs column of each type under the report's header */
+    FILE* f = fdopen(out[0], "r");
+    char line[4096];
+    int in_report = 0;
+    int failed = 0;
+    *allocs = 0;
+    while(fgets(line, sizeof(line), f)){
+        char kind[64];
+        long n;
+        if(strncmp(line, "Error:", 6) == 0){ failed = 1; }
+        if(strstr(line, "type") && strstr(line, "allocs")){ in_report = 1; continue; }
+        if(in_report && sscanf(line, "%63s %ld", kind, &n) == 2){ *allocs += n; }
+        else { in_report = 0; }
+    }
+    fclose(f);
+
+    int status;
+    struct rusage ru;
+    wait4(pid, &status, 0, &ru);
+    *ms = now_ms() - start;
+#ifdef __APPLE__
+    *rss_kb = ru.ru_maxrss / 1024;
+#else
+    *rss_kb = ru.ru_maxrss;
+#endif
+    return !failed && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static int cmp_double(const void* a, const void* b){
+    double x = *(double*)a, y = *(double*)b;
+    return x < y ? -1 : x > y;
+}
+
+static int run_suite(char* lispy, int runs, char* commit){
+    printf("{\n  \"commit\": \"%s\",\n  \"runs\": %d,\n  \"cases\": [\n", commit, runs);
+    for(int i=0;i<NCASES;i++){
+        double ms[MAX_RUNS];
+        long allocs = 0, rss = 0;
+        for(int r=0;r<runs;r++){
+            long run_rss;
+            if(!run_case(lispy, &cases[i], &ms[r], &allocs, &run_rss)){
+                fprintf(stderr, "%s: %s failed\n", lispy, cases[i].name);
+                return 1;
+            }
+            if(run_rss > rss){ rss = run_rss; }
+        }
+        qsort(ms, runs, sizeof(double), cmp_double);
+        double median = runs % 2 ? ms[runs/2] : (ms[runs/2-1] + ms[runs/2]) / 2;
+
+        fprintf(stderr, "%-8s %10.1f ms %12ld allocs %8ld KB\n", cases[i].name, median, allocs, rss);
+        printf("    {\"name\": \"%s\", \"wall_ms\": %.1f, \"wall_ms_min\": %.1f, "
+            "\"allocs\": %ld, \"peak_rss_kb\": %ld}%s\n",
+            cases[i].name, median, ms[0], allocs, rss, i+1 < NCASES ? "," : "");
+    }
+    printf("  ]\n}\n");
+    return 0;
+}
+
+/* Read the cases back from a file this wrote, one per line */
+static int read_results(char* filename, bresult* rs){
+    FILE* f = fopen(filename, "r");
+    if(f == NULL){ perror(filename); return -1; }
+    char line[512];
+    int n = 0;
+    while(n < NCASES * 2 && fgets(line, sizeof(line), f)){
+        bresult* r = &rs[n];
+        if(sscanf(line,
+            " {\"name\": \"%63[^\"]\", \"wall_ms\": %lf, \"wall_ms_min\": %lf, "
+            "\"allocs\": %ld, \"peak_rss_kb\": %ld}",
+            r->name, &r->wall_ms, &r->wall_ms_min, &r->allocs, &r->peak_rss_kb) == 5){
+            n++;
+        }
+    }
+    fclose(f);
+    return n;
+}
+
+static double change(double old, double now){
+    return old > 0 ? (now - old) / old * 100 : 0;
+}
+
+static int compare(char* base, char* now, double percent){
+    bresult old[NCASES * 2], cur[NCASES * 2];
+    int nold = read_results(base, old);
+    int ncur = read_results(now, cur);
+    if(nold < 0 || ncur < 0){ return 2; }
+
+    int regressed = 0;
+    printf("%-8s %10s %10s %8s %10s %10s\n", "case", "base ms", "ms", "time", "allocs", "rss");
+    for(int i=0;i<ncur;i++){
+        bresult* o = NULL;
+        for(int j=0;j<nold;j++){
+            if(strcmp(old[j].name, cur[i].name) == 0){ o = &old[j]; }
+        }
+        if(o == NULL){
+            printf("%-8s %10s %10.1f\n", cur[i].name, "-", cur[i].wall_ms);
+            continue;
+        }
+        double t = change(o->wall_ms, cur[i].wall_ms);
+        double a = change(o->allocs, cur[i].allocs);
+        double m = change(o->peak_rss_kb, cur[i].peak_rss_kb);
+        int bad = t > percent || m > percent || cur[i].allocs > o->allocs;
+        printf("%-8s %10.1f %10.1f %+7.1f%% %+9.1f%% %+9.1f%%%s\n", cur[i].name,
+            o->wall_ms, cur[i].wall_ms, t, a, m, bad ? "  regressed" : "");
+        regressed |= bad;
+    }
+    return regressed;
+}
+
+int main(int argc, char** argv){
+    int runs = 5;
+    char* commit = "";
+    char* base = NULL;
+    int i = 1;
+    for(;i<argc && argv[i][0] == '-';i++){
+        if(strcmp(argv[i], "-n") == 0 && i+1 < argc){ runs = atoi(argv[++i]); }
+        else if(strcmp(argv[i], "-c") == 0 && i+1 < argc){ commit = argv[++i]; }
+        else if(strcmp(argv[i], "-b") == 0 && i+1 < argc){ base = argv[++i]; }
+        else {
+            fprintf(stderr, "usage: %s [-n runs] [-c commit] [lispy]\n"
+                "       %s -b base.json results.json [percent]\n", argv[0], argv[0]);
+            return 2;
+        }
+    }
+
+    if(base){
+        if(i >= argc){ fprintf(stderr, "%s: -b needs a results file to compare\n", argv[0]); return 2; }
+        return compare(base, argv[i], i+1 < argc ? atof(argv[i+1]) : 10);
+    }
+
+    if(runs < 1 || runs > MAX_RUNS){ fprintf(stderr, "%s: runs must be 1 to %d\n", argv[0], MAX_RUNS); return 2; }
+    return run_suite(i < argc ? argv[i] : "./lispy", runs, commit);
+}
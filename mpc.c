@@ -1,5 +1,18 @@
+/* Regular files are mapped into memory where mmap is available */
+#if defined(__unix__) || defined(__APPLE__)
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L
+#endif
+#define MPC_HAVE_MMAP
+#endif
+
 #include "mpc.h"
 
+#ifdef MPC_HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 /*
 ** State Type
 */
@@ -58,20 +71,73 @@ static mpc_state_t mpc_state_new(void) {
 enum {
   MPC_INPUT_STRING = 0,
   MPC_INPUT_FILE   = 1,
-  MPC_INPUT_PIPE   = 2
+  MPC_INPUT_PIPE   = 2,
+  MPC_INPUT_MMAP   = 3
 };
 
 enum {
   MPC_INPUT_MARKS_MIN = 32
 };
 
+/*
+** Small allocations made while parsing come from a pool owned by the
+** input, carved on demand into blocks of a few power of two size
+** classes. Each block starts with its class, and freed blocks go on
+** a list per class, so allocating and freeing are both O(1). The pool
+** starts with a slab sized from the input's length and adds slabs of
+** twice the size as it fills, up to a limit. Larger requests, and any
+** made past the limit, fall back to malloc.
+*/
+
+enum {
+  MPC_INPUT_POOL_CLASSES = 5,
+  MPC_INPUT_POOL_SLABS   = 8,
+  MPC_INPUT_POOL_HEAD    = 8,
+  MPC_INPUT_POOL_SCALE   = 16,
+  MPC_INPUT_POOL_UNKNOWN = 1 << 15
+};
+
+static size_t mpc_pool_min = 1 << 12;
+static size_t mpc_pool_max = 1 << 20;
+static mpc_mem_stats_t mpc_pool_stats;
+
 enum {
-  MPC_INPUT_MEM_NUM = 512
+  MPC_INPUT_MEMO_MIN = 64
 };
 
+/*
+** A compiled regex: `cls` maps each byte to a column of `trans`, which
+** has a row per state. State 0 is dead. DFAs leave out NUL, which
+** `mpc_oneof` matches, so inputs holding one use the combinators instead.
+*/
+
+typedef struct {
+  int states;
+  int start;
+  int classes;
+  unsigned char cls[256];
+  char *accept;
+  int *trans;
+} mpc_dfa_t;
+
+/*
+** A remembered run of a packrat parser at one position. The output is
+** the AST it built, shared with the tree being parsed, or a copy of the
+** error it failed with, along with everything it merged into the
+** furthest error while running.
+*/
+
 typedef struct {
-  char mem[64];
-} mpc_mem_t;
+  mpc_parser_t *parser;
+  long pos;
+  char flags;
+  char success;
+  char last;
+  mpc_state_t end;
+  mpc_val_t *output;
+  mpc_err_t *error;
+  mpc_err_t *merged;
+} mpc_memo_t;
 
 typedef struct {
 
@@ -79,7 +145,8 @@ typedef struct {
   char *filename;  
   mpc_state_t state;
   
-  char *string;
+  const char *string;
+  long length;
   char *buffer;
   FILE *file;
   
@@ -92,15 +159,35 @@ typedef struct {
   char *lasts;
   char last;
   
-  size_t mem_index;
-  char mem_full[MPC_INPUT_MEM_NUM];
-  mpc_mem_t mem[MPC_INPUT_MEM_NUM];
+  int pool_num;
+  char *pool[MPC_INPUT_POOL_SLABS];
+  size_t pool_size[MPC_INPUT_POOL_SLABS];
+  size_t pool_used;
+  size_t pool_total;
+  void *pool_free[MPC_INPUT_POOL_CLASSES];
+  mpc_mem_stats_t pool_stats;
+  
+  int memo_num;
+  int memo_slots;
+  mpc_memo_t *memo;
+  mpc_ast_arena_t *ast_arena;
+  
+  char dfa_off;
+  char err_exact;
+  long err_pos;
   
 } mpc_input_t;
 
-static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
+/*
+** String inputs borrow the caller's buffer rather than copying it, so it
+** must stay alive and unchanged until the parse returns. The length is
+** found once up front and every read is checked against it.
+*/
+
+static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *string, size_t length) {
 
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
+  const char *end = memchr(string, '\0', length);
   
   i->filename = malloc(strlen(filename) + 1);
   strcpy(i->filename, filename);
@@ -108,8 +195,8 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   
   i->state = mpc_state_new();
   
-  i->string = malloc(strlen(string) + 1);
-  strcpy(i->string, string);
+  i->string = string;
+  i->length = end ? (long)(end - string) : (long)length;
   i->buffer = NULL;
   i->file = NULL;
   
@@ -121,43 +208,55 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
   
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->pool_num = 0;
+  i->pool_used = 0;
+  i->pool_total = 0;
+  memset(i->pool_free, 0, sizeof(i->pool_free));
+  memset(&i->pool_stats, 0, sizeof(mpc_mem_stats_t));
+  
+  i->memo_num = 0;
+  i->memo_slots = 0;
+  i->memo = NULL;
+  i->ast_arena = NULL;
+  i->dfa_off = 0;
+  i->err_exact = 1;
+  i->err_pos = -1;
   
   return i;
 }
 
-static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *string, size_t length) {
+static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
+  return mpc_input_new_nstring(filename, string, strlen(string));
+}
 
-  mpc_input_t *i = malloc(sizeof(mpc_input_t));
-  
-  i->filename = malloc(strlen(filename) + 1);
-  strcpy(i->filename, filename);
-  i->type = MPC_INPUT_STRING;
-  
-  i->state = mpc_state_new();
-  
-  i->string = malloc(length + 1);
-  strncpy(i->string, string, length);
-  i->string[length] = '\0';
-  i->buffer = NULL;
-  i->file = NULL;
+#ifdef MPC_HAVE_MMAP
+
+/*
+** Maps a regular file read-only and reads it like a string input. Returns
+** NULL if the file can't be mapped so the caller can read it normally.
+*/
+
+static mpc_input_t *mpc_input_new_mmap(const char *filename, FILE *file) {
+
+  struct stat st;
+  void *map;
+  mpc_input_t *i;
   
-  i->suppress = 0;
-  i->backtrack = 1;
-  i->marks_num = 0;
-  i->marks_slots = MPC_INPUT_MARKS_MIN;
-  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
-  i->lasts = malloc(sizeof(char) * i->marks_slots);
-  i->last = '\0';
+  if (fstat(fileno(file), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) { return NULL; }
   
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+  if (map == MAP_FAILED) { return NULL; }
   
+  i = mpc_input_new_nstring(filename, "", 0);
+  i->type = MPC_INPUT_MMAP;
+  i->string = map;
+  i->length = st.st_size;
+  i->dfa_off = memchr(map, '\0', st.st_size) != NULL;
   return i;
-
 }
 
+#endif
+
 static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
 
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
@@ -169,6 +268,7 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->state = mpc_state_new();
   
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
   i->file = pipe;
   
@@ -180,8 +280,19 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
   
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->pool_num = 0;
+  i->pool_used = 0;
+  i->pool_total = 0;
+  memset(i->pool_free, 0, sizeof(i->pool_free));
+  memset(&i->pool_stats, 0, sizeof(mpc_mem_stats_t));
+  
+  i->memo_num = 0;
+  i->memo_slots = 0;
+  i->memo = NULL;
+  i->ast_arena = NULL;
+  i->dfa_off = 0;
+  i->err_exact = 1;
+  i->err_pos = -1;
   
   return i;
   
@@ -197,6 +308,7 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->state = mpc_state_new();
   
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
   i->file = file;
   
@@ -208,48 +320,131 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
   
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->pool_num = 0;
+  i->pool_used = 0;
+  i->pool_total = 0;
+  memset(i->pool_free, 0, sizeof(i->pool_free));
+  memset(&i->pool_stats, 0, sizeof(mpc_mem_stats_t));
+  
+  i->memo_num = 0;
+  i->memo_slots = 0;
+  i->memo = NULL;
+  i->ast_arena = NULL;
+  i->dfa_off = 0;
+  i->err_exact = 1;
+  i->err_pos = -1;
   
   return i;
 }
 
+static void mpc_input_memo_clear(mpc_input_t *i) {
+  
+  int j;
+  
+  if (i->memo == NULL) { return; }
+  
+  for (j = 0; j < i->memo_slots; j++) {
+    if (i->memo[j].error) { mpc_err_delete(i->memo[j].error); }
+    if (i->memo[j].merged) { mpc_err_delete(i->memo[j].merged); }
+  }
+  free(i->memo);
+  i->memo = NULL;
+  i->memo_num = 0;
+  i->memo_slots = 0;
+}
+
 static void mpc_input_delete(mpc_input_t *i) {
   
+  int j;
+  
   free(i->filename);
   
-  if (i->type == MPC_INPUT_STRING) { free(i->string); }
+#ifdef MPC_HAVE_MMAP
+  if (i->type == MPC_INPUT_MMAP) { munmap((void*)i->string, i->length); }
+#endif
+  
   if (i->type == MPC_INPUT_PIPE) { free(i->buffer); }
   
+  mpc_input_memo_clear(i);
+  
+  mpc_pool_stats.parses++;
+  mpc_pool_stats.pool += i->pool_stats.pool;
+  mpc_pool_stats.large += i->pool_stats.large;
+  mpc_pool_stats.overflow += i->pool_stats.overflow;
+  for (j = 0; j < i->pool_num; j++) {
+    mpc_pool_stats.reserved += i->pool_size[j];
+    mpc_pool_stats.used += j < i->pool_num-1 ? i->pool_size[j] : i->pool_used;
+    free(i->pool[j]);
+  }
+  
   free(i->marks);
   free(i->lasts);
   free(i);
 }
 
 static int mpc_mem_ptr(mpc_input_t *i, void *p) {
-  return
-    (char*)p >= (char*)(i->mem) &&
-    (char*)p <  (char*)(i->mem) + (MPC_INPUT_MEM_NUM * sizeof(mpc_mem_t));
+  int j;
+  for (j = i->pool_num-1; j >= 0; j--) {
+    if ((char*)p >= i->pool[j] && (char*)p < i->pool[j] + i->pool_size[j]) { return 1; }
+  }
+  return 0;
+}
+
+static size_t mpc_mem_size(void *p) {
+  return ((size_t)16 << ((char*)p)[-MPC_INPUT_POOL_HEAD]) - MPC_INPUT_POOL_HEAD;
+}
+
+/* Adds a slab to the pool, returning zero if it is at its limit */
+static int mpc_mem_grow(mpc_input_t *i) {
+  
+  size_t size = i->pool_num
+    ? i->pool_size[i->pool_num-1] * 2
+    : (i->length > 0 ? (size_t)i->length / MPC_INPUT_POOL_SCALE : MPC_INPUT_POOL_UNKNOWN);
+  
+  if (i->pool_total >= mpc_pool_max) { return 0; }
+  if (size < mpc_pool_min) { size = mpc_pool_min; }
+  if (size > mpc_pool_max - i->pool_total) { size = mpc_pool_max - i->pool_total; }
+  if (i->pool_num == MPC_INPUT_POOL_SLABS || size < mpc_pool_min) { return 0; }
+  
+  i->pool[i->pool_num] = malloc(size);
+  i->pool_size[i->pool_num] = size;
+  i->pool_num++;
+  i->pool_used = 0;
+  i->pool_total += size;
+  return 1;
 }
 
 static void *mpc_malloc(mpc_input_t *i, size_t n) {
-  size_t j;
+  
+  static const char classes[16] = { 0, 1, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4 };
+  int c;
   char *p;
   
-  if (n > sizeof(mpc_mem_t)) { return malloc(n); }
+  if (n + MPC_INPUT_POOL_HEAD > (size_t)16 << (MPC_INPUT_POOL_CLASSES-1)) {
+    i->pool_stats.large++;
+    return malloc(n);
+  }
+  
+  c = classes[(n + MPC_INPUT_POOL_HEAD - 1) >> 4];
   
-  j = i->mem_index;
-  do {
-    if (!i->mem_full[i->mem_index]) {
-      p = (void*)(i->mem + i->mem_index);
-      i->mem_full[i->mem_index] = 1;
-      i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-      return p;
-    }
-    i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-  } while (j != i->mem_index);
+  if (i->pool_free[c]) {
+    p = i->pool_free[c];
+    i->pool_free[c] = *(void**)p;
+    i->pool_stats.pool++;
+    return p;
+  }
+  
+  if ((i->pool_num == 0 || i->pool_used + ((size_t)16 << c) > i->pool_size[i->pool_num-1])
+  && !mpc_mem_grow(i)) {
+    i->pool_stats.overflow++;
+    return malloc(n);
+  }
   
-  return malloc(n);
+  p = i->pool[i->pool_num-1] + i->pool_used + MPC_INPUT_POOL_HEAD;
+  p[-MPC_INPUT_POOL_HEAD] = (char)c;
+  i->pool_used += (size_t)16 << c;
+  i->pool_stats.pool++;
+  return p;
 }
 
 static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
@@ -259,10 +454,11 @@ static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
 }
 
 static void mpc_free(mpc_input_t *i, void *p) {
-  size_t j;
+  int c;
   if (!mpc_mem_ptr(i, p)) { free(p); return; }
-  j = ((size_t)(((char*)p) - ((char*)i->mem))) / sizeof(mpc_mem_t);
-  i->mem_full[j] = 0;
+  c = ((char*)p)[-MPC_INPUT_POOL_HEAD];
+  *(void**)p = i->pool_free[c];
+  i->pool_free[c] = p;
 }
 
 static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
@@ -270,26 +466,36 @@ static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
   char *q = NULL;
   
   if (!mpc_mem_ptr(i, p)) { return realloc(p, n); }
+  if (n <= mpc_mem_size(p)) { return p; }
   
-  if (n > sizeof(mpc_mem_t)) {
-    q = malloc(n);
-    memcpy(q, p, sizeof(mpc_mem_t));
-    mpc_free(i, p);
-    return q;
-  }
-  
-  return p;
+  q = mpc_malloc(i, n);
+  memcpy(q, p, mpc_mem_size(p));
+  mpc_free(i, p);
+  return q;
 }
 
 static void *mpc_export(mpc_input_t *i, void *p) {
   char *q = NULL;
   if (!mpc_mem_ptr(i, p)) { return p; }
-  q = malloc(sizeof(mpc_mem_t));
-  memcpy(q, p, sizeof(mpc_mem_t));
+  q = malloc(mpc_mem_size(p));
+  memcpy(q, p, mpc_mem_size(p));
   mpc_free(i, p);
   return q; 
 }
 
+void mpc_mem_pool(size_t min, size_t max) {
+  if (min) { mpc_pool_min = min; }
+  if (max) { mpc_pool_max = max; }
+}
+
+void mpc_mem_stats(mpc_mem_stats_t *s) {
+  *s = mpc_pool_stats;
+}
+
+void mpc_mem_stats_reset(void) {
+  memset(&mpc_pool_stats, 0, sizeof(mpc_mem_stats_t));
+}
+
 static void mpc_input_backtrack_disable(mpc_input_t *i) { i->backtrack--; }
 static void mpc_input_backtrack_enable(mpc_input_t *i) { i->backtrack++; }
 
@@ -323,14 +529,7 @@ static void mpc_input_unmark(mpc_input_t *i) {
   
   i->marks_num--;
   
-  if (i->marks_slots > i->marks_num + i->marks_num / 2
-  &&  i->marks_slots > MPC_INPUT_MARKS_MIN) {
-    i->marks_slots = 
-      i->marks_num > MPC_INPUT_MARKS_MIN ?
-      i->marks_num : MPC_INPUT_MARKS_MIN;
-    i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_slots);
-    i->lasts = realloc(i->lasts, sizeof(char) * i->marks_slots);      
-  }
+  /* Not shrunk, so input nested around one depth doesn't realloc on every mark */
   
   if (i->type == MPC_INPUT_PIPE && i->marks_num == 0) {
     free(i->buffer);
@@ -362,7 +561,8 @@ static char mpc_input_buffer_get(mpc_input_t *i) {
 }
 
 static int mpc_input_terminated(mpc_input_t *i) {
-  if (i->type == MPC_INPUT_STRING && i->state.pos == (long)strlen(i->string)) { return 1; }
+  if (i->type == MPC_INPUT_STRING && i->state.pos >= i->length) { return 1; }
+  if (i->type == MPC_INPUT_MMAP && i->state.pos >= i->length) { return 1; }
   if (i->type == MPC_INPUT_FILE && feof(i->file)) { return 1; }
   if (i->type == MPC_INPUT_PIPE && feof(i->file)) { return 1; }
   return 0;
@@ -374,7 +574,8 @@ static char mpc_input_getc(mpc_input_t *i) {
   
   switch (i->type) {
     
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING:
+    case MPC_INPUT_MMAP: return i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE: c = fgetc(i->file); return c;
     case MPC_INPUT_PIPE:
     
@@ -397,7 +598,8 @@ static char mpc_input_peekc(mpc_input_t *i) {
   char c = '\0';
   
   switch (i->type) {
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING:
+    case MPC_INPUT_MMAP: return i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE: 
       
       c = fgetc(i->file);
@@ -433,6 +635,7 @@ static int mpc_input_failure(mpc_input_t *i, char c) {
 
   switch (i->type) {
     case MPC_INPUT_STRING: { break; }
+    case MPC_INPUT_MMAP: { break; }
     case MPC_INPUT_FILE: fseek(i->file, -1, SEEK_CUR); { break; }
     case MPC_INPUT_PIPE: {
       
@@ -542,6 +745,53 @@ static mpc_state_t *mpc_input_state_copy(mpc_input_t *i) {
   return r;
 }
 
+static void mpc_dfa_delete(mpc_dfa_t *d) {
+  if (d == NULL) { return; }
+  free(d->accept);
+  free(d->trans);
+  free(d);
+}
+
+static mpc_dfa_t *mpc_dfa_copy(mpc_dfa_t *a) {
+  mpc_dfa_t *d = malloc(sizeof(mpc_dfa_t));
+  memcpy(d, a, sizeof(mpc_dfa_t));
+  d->accept = malloc(a->states);
+  memcpy(d->accept, a->accept, a->states);
+  d->trans = malloc(sizeof(int) * a->states * a->classes);
+  memcpy(d->trans, a->trans, sizeof(int) * a->states * a->classes);
+  return d;
+}
+
+/* Runs a DFA over a string input, taking the longest match */
+static int mpc_input_dfa(mpc_input_t *i, mpc_dfa_t *d, char **o) {
+  
+  const unsigned char *s = (const unsigned char*)i->string + i->state.pos;
+  const char *nl;
+  long k, n = i->length - i->state.pos, m = d->accept[d->start] ? 0 : -1;
+  int q = d->start;
+  
+  for (k = 0; k < n; k++) {
+    q = d->trans[q * d->classes + d->cls[s[k]]];
+    if (q == 0) { break; }
+    if (d->accept[q]) { m = k + 1; }
+  }
+  
+  if (m < 0) { return 0; }
+  
+  for (k = 0; (nl = memchr(s + k, '\n', m - k)) != NULL; k = (nl - (const char*)s) + 1) {
+    i->state.row++;
+    i->state.col = 0;
+  }
+  i->state.col += m - k;
+  i->state.pos += m;
+  if (m > 0) { i->last = (char)s[m-1]; }
+  
+  *o = mpc_malloc(i, m + 1);
+  memcpy(*o, s, m);
+  (*o)[m] = '\0';
+  return 1;
+}
+
 /*
 ** Error Type
 */
@@ -637,9 +887,22 @@ char *mpc_err_string(mpc_err_t *x) {
   return realloc(buffer, strlen(buffer) + 1);
 }
 
+/*
+** Parses first run without building any errors, only noting how far the
+** furthest failure got. If that fails the parse is run again exactly,
+** and errors short of that point are skipped as they can't be reported.
+*/
+
+static int mpc_err_skip(mpc_input_t *i) {
+  if (i->suppress) { return 1; }
+  if (i->err_exact) { return i->state.pos < i->err_pos; }
+  if (i->state.pos > i->err_pos) { i->err_pos = i->state.pos; }
+  return 1;
+}
+
 static mpc_err_t *mpc_err_new(mpc_input_t *i, const char *expected) {
   mpc_err_t *x;
-  if (i->suppress) { return NULL; }
+  if (mpc_err_skip(i)) { return NULL; }
   x = mpc_malloc(i, sizeof(mpc_err_t));
   x->filename = mpc_malloc(i, strlen(i->filename) + 1);
   strcpy(x->filename, i->filename);
@@ -655,7 +918,7 @@ static mpc_err_t *mpc_err_new(mpc_input_t *i, const char *expected) {
 
 static mpc_err_t *mpc_err_fail(mpc_input_t *i, const char *failure) {
   mpc_err_t *x;
-  if (i->suppress) { return NULL; }
+  if (mpc_err_skip(i)) { return NULL; }
   x = mpc_malloc(i, sizeof(mpc_err_t));
   x->filename = mpc_malloc(i, strlen(i->filename) + 1);
   strcpy(x->filename, i->filename);
@@ -836,6 +1099,7 @@ static mpc_err_t *mpc_err_count(mpc_input_t *i, mpc_err_t *x, int n) {
   mpc_err_t *y;
   int digits = n/10 + 1;
   char *prefix;
+  if (x == NULL) { return NULL; }
   prefix = mpc_malloc(i, digits + strlen(" of ") + 1);
   sprintf(prefix, "%i of ", n);
   y = mpc_err_repeat(i, x, prefix);
@@ -885,7 +1149,21 @@ enum {
   MPC_TYPE_AND        = 24,
 
   MPC_TYPE_CHECK      = 25,
-  MPC_TYPE_CHECK_WITH = 26
+  MPC_TYPE_CHECK_WITH = 26,
+  
+  MPC_TYPE_DFA        = 27
+};
+
+/*
+** An `or` of two to MPC_PREDICT_MAX alternatives may carry a
+** table, built by `mpc_optimise`, with one entry per byte and one
+** for the end of input. Bit j of an entry is set when alternative
+** j could match starting there, so the others can be skipped.
+*/
+
+enum {
+  MPC_PREDICT_MAX     = 32,
+  MPC_PREDICT_ENTRIES = 257
 };
 
 typedef struct { char *m; } mpc_pdata_fail_t;
@@ -903,8 +1181,9 @@ typedef struct { mpc_parser_t *x; mpc_check_with_t f; void *d; char *e; } mpc_pd
 typedef struct { mpc_parser_t *x; } mpc_pdata_predict_t;
 typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_ctor_t lf; } mpc_pdata_not_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdata_repeat_t;
-typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
+typedef struct { int n; mpc_parser_t **xs; unsigned long *predict; } mpc_pdata_or_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
+typedef struct { mpc_parser_t *x; mpc_dfa_t *d; } mpc_pdata_dfa_t;
 
 typedef union {
   mpc_pdata_fail_t fail;
@@ -924,6 +1203,7 @@ typedef union {
   mpc_pdata_repeat_t repeat;
   mpc_pdata_and_t and;
   mpc_pdata_or_t or;
+  mpc_pdata_dfa_t dfa;
 } mpc_pdata_t;
 
 struct mpc_parser_t {
@@ -931,8 +1211,225 @@ struct mpc_parser_t {
   mpc_pdata_t data;
   char type;
   char retained;
+  char packrat;
+  int rule;
+};
+
+/*
+** AST Arenas
+**
+** Blocks are kept newest first and grow until they reach
+** MPC_AST_ARENA_BLOCK_MAX bytes. Tags are built once for each way
+** a grammar combines them and kept until the arena is deleted, so
+** clearing it leaves them in place for the next parse.
+*/
+
+enum {
+  MPC_AST_ARENA_ALIGN     = 8,
+  MPC_AST_ARENA_BLOCK_MIN = 4096,
+  MPC_AST_ARENA_BLOCK_MAX = 1 << 20,
+  MPC_AST_ARENA_TAGS_MIN  = 64
+};
+
+enum {
+  MPC_AST_TAG_SET  = 0,
+  MPC_AST_TAG_ADD  = 1,
+  MPC_AST_TAG_ROOT = 2
+};
+
+typedef struct mpc_ast_block_t {
+  struct mpc_ast_block_t *next;
+  size_t size;
+} mpc_ast_block_t;
+
+typedef struct {
+  int kind;
+  const char *t;
+  const char *x;
+  char *tag;
+} mpc_ast_tag_t;
+
+struct mpc_ast_arena_t {
+  mpc_ast_block_t *block;
+  size_t used;
+  int tags_num;
+  int tags_slots;
+  mpc_ast_tag_t *tags;
 };
 
+typedef struct {
+  mpc_ast_block_t *block;
+  size_t used;
+} mpc_ast_arena_mark_t;
+
+static char mpc_ast_arena_empty[] = "";
+static char mpc_ast_arena_root[] = ">";
+
+mpc_ast_arena_t *mpc_ast_arena_new(void) {
+  mpc_ast_arena_t *a = malloc(sizeof(mpc_ast_arena_t));
+  a->block = NULL;
+  a->used = 0;
+  a->tags_num = 0;
+  a->tags_slots = MPC_AST_ARENA_TAGS_MIN;
+  a->tags = calloc(a->tags_slots, sizeof(mpc_ast_tag_t));
+  return a;
+}
+
+void mpc_ast_arena_clear(mpc_ast_arena_t *a) {
+  mpc_ast_block_t *b;
+  if (a->block == NULL) { return; }
+  while (a->block->next) {
+    b = a->block->next;
+    a->block->next = b->next;
+    free(b);
+  }
+  a->used = 0;
+}
+
+void mpc_ast_arena_delete(mpc_ast_arena_t *a) {
+  int j;
+  mpc_ast_block_t *b;
+  while (a->block) {
+    b = a->block;
+    a->block = b->next;
+    free(b);
+  }
+  for (j = 0; j < a->tags_slots; j++) { free(a->tags[j].tag); }
+  free(a->tags);
+  free(a);
+}
+
+static mpc_ast_arena_mark_t mpc_ast_arena_mark(mpc_ast_arena_t *a) {
+  mpc_ast_arena_mark_t m;
+  m.block = a->block;
+  m.used = a->used;
+  return m;
+}
+
+static void mpc_ast_arena_rewind(mpc_ast_arena_t *a, mpc_ast_arena_mark_t m) {
+  mpc_ast_block_t *b;
+  while (a->block != m.block) {
+    b = a->block;
+    a->block = b->next;
+    free(b);
+  }
+  a->used = m.used;
+}
+
+static void *mpc_ast_arena_alloc(mpc_ast_arena_t *a, size_t n) {
+  
+  mpc_ast_block_t *b;
+  size_t size;
+  
+  n = (n + MPC_AST_ARENA_ALIGN - 1) & ~(size_t)(MPC_AST_ARENA_ALIGN - 1);
+  
+  if (a->block == NULL || a->used + n > a->block->size) {
+    size = a->block ? a->block->size * 2 : MPC_AST_ARENA_BLOCK_MIN;
+    if (size > MPC_AST_ARENA_BLOCK_MAX) { size = MPC_AST_ARENA_BLOCK_MAX; }
+    if (size < n) { size = n; }
+    b = malloc(sizeof(mpc_ast_block_t) + size);
+    b->next = a->block;
+    b->size = size;
+    a->block = b;
+    a->used = 0;
+  }
+  
+  a->used += n;
+  return (char*)(a->block + 1) + a->used - n;
+}
+
+static char *mpc_ast_arena_str(mpc_ast_arena_t *a, const char *s) {
+  size_t n = strlen(s);
+  char *x;
+  if (n == 0) { return mpc_ast_arena_empty; }
+  x = mpc_ast_arena_alloc(a, n + 1);
+  memcpy(x, s, n + 1);
+  return x;
+}
+
+static mpc_ast_t *mpc_ast_arena_node(mpc_ast_arena_t *a, char *tag, char *contents) {
+  mpc_ast_t *x = mpc_ast_arena_alloc(a, sizeof(mpc_ast_t));
+  x->tag = tag;
+  x->rule = 0;
+  x->contents = contents;
+  x->state = mpc_state_new();
+  x->children_num = 0;
+  x->children = NULL;
+  return x;
+}
+
+/*
+** Packrat parsers share the trees they remember, so while a memo is in
+** use nodes are copied before they are changed. The copy keeps the
+** same children.
+*/
+
+static mpc_ast_t *mpc_ast_arena_own(mpc_input_t *i, mpc_ast_t *x) {
+  mpc_ast_t *y;
+  if (i->memo == NULL) { return x; }
+  y = mpc_ast_arena_alloc(i->ast_arena, sizeof(mpc_ast_t));
+  *y = *x;
+  return y;
+}
+
+/* The tag `kind` makes from `t` and the node's current tag `x` */
+static char *mpc_ast_arena_tag(mpc_ast_arena_t *a, int kind, const char *t, const char *x) {
+  
+  int j;
+  size_t h, lt, lx;
+  mpc_ast_tag_t *old, *e;
+  char *tag;
+  
+  if (a->tags_num * 2 >= a->tags_slots) {
+    old = a->tags;
+    a->tags_slots *= 2;
+    a->tags = calloc(a->tags_slots, sizeof(mpc_ast_tag_t));
+    for (j = 0; j < a->tags_slots / 2; j++) {
+      if (old[j].tag == NULL) { continue; }
+      h = (((size_t)old[j].t >> 3) * 31 + ((size_t)old[j].x >> 3) * 7 + old[j].kind) & (a->tags_slots - 1);
+      while (a->tags[h].tag) { h = (h + 1) & (a->tags_slots - 1); }
+      a->tags[h] = old[j];
+    }
+    free(old);
+  }
+  
+  h = (((size_t)t >> 3) * 31 + ((size_t)x >> 3) * 7 + kind) & (a->tags_slots - 1);
+  while (a->tags[h].tag) {
+    e = &a->tags[h];
+    if (e->kind == kind && e->t == t && e->x == x) { return e->tag; }
+    h = (h + 1) & (a->tags_slots - 1);
+  }
+  
+  lt = strlen(t);
+  lx = x ? strlen(x) : 0;
+  
+  switch (kind) {
+    case MPC_AST_TAG_ADD:
+      tag = malloc(lt + 1 + lx + 1);
+      memcpy(tag, t, lt);
+      tag[lt] = '|';
+      memcpy(tag + lt + 1, x, lx + 1);
+      break;
+    case MPC_AST_TAG_ROOT:
+      tag = malloc(lt - 1 + lx + 1);
+      memcpy(tag, t, lt - 1);
+      memcpy(tag + lt - 1, x, lx + 1);
+      break;
+    default:
+      tag = malloc(lt + 1);
+      memcpy(tag, t, lt + 1);
+      break;
+  }
+  
+  e = &a->tags[h];
+  e->kind = kind;
+  e->t = t;
+  e->x = x;
+  e->tag = tag;
+  a->tags_num++;
+  return tag;
+}
+
 static mpc_val_t *mpcf_input_nth_free(mpc_input_t *i, int n, mpc_val_t **xs, int x) {
   int j;
   for (j = 0; j < n; j++) { if (j != x) { mpc_free(i, xs[j]); } }
@@ -956,12 +1453,58 @@ static mpc_val_t *mpcf_input_strfold(mpc_input_t *i, int n, mpc_val_t **xs) {
 static mpc_val_t *mpcf_input_state_ast(mpc_input_t *i, int n, mpc_val_t **xs) {
   mpc_state_t *s = ((mpc_state_t**)xs)[0];
   mpc_ast_t *a = ((mpc_ast_t**)xs)[1];
+  if (a && i->ast_arena) { a = mpc_ast_arena_own(i, a); }
   a = mpc_ast_state(a, *s);
   mpc_free(i, s);
   (void) n;
   return a;
 }
 
+/* As mpcf_fold_ast, but sizing the children once and leaving the old nodes */
+static mpc_val_t *mpcf_input_fold_ast(mpc_input_t *i, int n, mpc_val_t **xs) {
+  
+  int j, k, m = 0;
+  mpc_ast_t **as = (mpc_ast_t**)xs;
+  mpc_ast_t *r, *c;
+  
+  if (n == 0) { return NULL; }
+  if (n == 1) { return xs[0]; }
+  if (n == 2 && xs[1] == NULL) { return xs[0]; }
+  if (n == 2 && xs[0] == NULL) { return xs[1]; }
+  
+  for (j = 0; j < n; j++) {
+    if (as[j]) { m += as[j]->children_num ? as[j]->children_num : 1; }
+  }
+  
+  r = mpc_ast_arena_node(i->ast_arena, mpc_ast_arena_root, mpc_ast_arena_empty);
+  r->children = m ? mpc_ast_arena_alloc(i->ast_arena, sizeof(mpc_ast_t*) * m) : NULL;
+  
+  for (j = 0; j < n; j++) {
+    
+    if (as[j] == NULL) { continue; }
+    
+    if (as[j]->children_num == 0) {
+      r->children[r->children_num++] = as[j];
+    } else if (as[j]->children_num == 1) {
+      c = mpc_ast_arena_own(i, as[j]->children[0]);
+      if (!c->rule) { c->rule = as[j]->rule; }
+      c->tag = mpc_ast_arena_tag(i->ast_arena, MPC_AST_TAG_ROOT, as[j]->tag, c->tag);
+      r->children[r->children_num++] = c;
+    } else {
+      for (k = 0; k < as[j]->children_num; k++) {
+        r->children[r->children_num++] = as[j]->children[k];
+      }
+    }
+    
+  }
+  
+  if (r->children_num) {
+    r->state = r->children[0]->state;
+  }
+  
+  return r;
+}
+
 static mpc_val_t *mpc_parse_fold(mpc_input_t *i, mpc_fold_t f, int n, mpc_val_t **xs) {
   int j;
   if (f == mpcf_null)      { return mpcf_null(n, xs); }
@@ -973,6 +1516,7 @@ static mpc_val_t *mpc_parse_fold(mpc_input_t *i, mpc_fold_t f, int n, mpc_val_t
   if (f == mpcf_trd_free)  { return mpcf_input_trd_free(i, n, xs); }
   if (f == mpcf_strfold)   { return mpcf_input_strfold(i, n, xs); }
   if (f == mpcf_state_ast) { return mpcf_input_state_ast(i, n, xs); }
+  if (f == mpcf_fold_ast && i->ast_arena) { return mpcf_input_fold_ast(i, n, xs); }
   for (j = 0; j < n; j++) { xs[j] = mpc_export(i, xs[j]); }
   return f(j, xs);
 }
@@ -983,26 +1527,78 @@ static mpc_val_t *mpcf_input_free(mpc_input_t *i, mpc_val_t *x) {
 }
 
 static mpc_val_t *mpcf_input_str_ast(mpc_input_t *i, mpc_val_t *c) {
-  mpc_ast_t *a = mpc_ast_new("", c);
+  mpc_ast_t *a = i->ast_arena
+    ? mpc_ast_arena_node(i->ast_arena, mpc_ast_arena_empty, mpc_ast_arena_str(i->ast_arena, c))
+    : mpc_ast_new("", c);
   mpc_free(i, c);
   return a;
 }
 
+static mpc_val_t *mpcf_input_add_root(mpc_input_t *i, mpc_ast_t *a) {
+  mpc_ast_t *r;
+  if (a == NULL || a->children_num <= 1) { return a; }
+  r = mpc_ast_arena_node(i->ast_arena, mpc_ast_arena_root, mpc_ast_arena_empty);
+  r->children = mpc_ast_arena_alloc(i->ast_arena, sizeof(mpc_ast_t*));
+  r->children[0] = a;
+  r->children_num = 1;
+  return r;
+}
+
 static mpc_val_t *mpc_parse_apply(mpc_input_t *i, mpc_apply_t f, mpc_val_t *x) {
   if (f == mpcf_free)     { return mpcf_input_free(i, x); }
   if (f == mpcf_str_ast)  { return mpcf_input_str_ast(i, x); }
+  if (f == (mpc_apply_t)mpc_ast_add_root && i->ast_arena) { return mpcf_input_add_root(i, x); }
   return f(mpc_export(i, x));
 }
 
+static mpc_ast_t *mpc_ast_add_rule(mpc_ast_t *a, mpc_parser_t *p);
+
+static mpc_val_t *mpcf_input_tag(mpc_input_t *i, int kind, mpc_ast_t *a, const char *t) {
+  if (a == NULL) { return a; }
+  a = mpc_ast_arena_own(i, a);
+  a->tag = mpc_ast_arena_tag(i->ast_arena, kind, t, kind == MPC_AST_TAG_SET ? NULL : a->tag);
+  return a;
+}
+
 static mpc_val_t *mpc_parse_apply_to(mpc_input_t *i, mpc_apply_to_t f, mpc_val_t *x, mpc_val_t *d) {
+  mpc_ast_t *a = x;
+  mpc_parser_t *p = d;
+  if (i->ast_arena) {
+    if (f == (mpc_apply_to_t)mpc_ast_tag)     { return mpcf_input_tag(i, MPC_AST_TAG_SET, a, d); }
+    if (f == (mpc_apply_to_t)mpc_ast_add_tag) { return mpcf_input_tag(i, MPC_AST_TAG_ADD, a, d); }
+    if (f == (mpc_apply_to_t)mpc_ast_add_rule) {
+      if (a && a->rule == 0) {
+        a = mpc_ast_arena_own(i, a);
+        a->rule = p->rule;
+      }
+      return mpcf_input_tag(i, MPC_AST_TAG_ADD, a, p->name);
+    }
+  }
   return f(mpc_export(i, x), d);
 }
 
 static void mpc_parse_dtor(mpc_input_t *i, mpc_dtor_t d, mpc_val_t *x) {
   if (d == free) { mpc_free(i, x); return; }
+  if (d == (mpc_dtor_t)mpc_ast_delete && i->ast_arena) { return; }
   d(mpc_export(i, x));
 }
 
+/*
+** The error pass tries every alternative so that its message lists
+** them all, and file inputs would have to be peeked, so the table
+** is only used when scanning a string or mapped file. Without
+** backtracking a failed alternative keeps what it read, changing
+** where the next one starts, so none can be skipped then either.
+*/
+
+static unsigned long mpc_input_predict(mpc_input_t *i, unsigned long *t) {
+  if (t == NULL || i->err_exact || i->backtrack < 1) { return ~0UL; }
+  if (i->type != MPC_INPUT_STRING && i->type != MPC_INPUT_MMAP) { return ~0UL; }
+  return i->state.pos < i->length
+    ? t[(unsigned char)i->string[i->state.pos]]
+    : t[MPC_PREDICT_ENTRIES-1];
+}
+
 enum {
   MPC_PARSE_STACK_MIN = 4
 };
@@ -1013,9 +1609,12 @@ enum {
   if (x) { MPC_SUCCESS(r->output); } \
   else { MPC_FAILURE(NULL); }
 
-static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e);
+
+static int mpc_parse_run_step(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
   
   int j = 0, k = 0;
+  unsigned long viable;
   mpc_result_t results_stk[MPC_PARSE_STACK_MIN];
   mpc_result_t *results;
   int results_slots = MPC_PARSE_STACK_MIN;
@@ -1210,7 +1809,10 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
         ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
         : results_stk;
       
+      viable = mpc_input_predict(i, p->data.or.predict);
+      
       for (j = 0; j < p->data.or.n; j++) {
+        if (!(viable >> j & 1)) { continue; }
         if (mpc_parse_run(i, p->data.or.xs[j], &results[j], e)) {
           MPC_SUCCESS(results[j].output;
             if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
@@ -1246,6 +1848,22 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
         mpc_parse_fold(i, p->data.and.f, j, (mpc_val_t**)results);
         if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
     
+    /*
+    ** Compiled regexes run as combinators where they need exact errors.
+    ** They also do without backtracking, as in mpc_predictive, because
+    ** the combinators then keep what they read before failing, which a
+    ** DFA can't reproduce.
+    */
+    
+    case MPC_TYPE_DFA:
+      
+      if ((i->type == MPC_INPUT_STRING || i->type == MPC_INPUT_MMAP)
+      && !i->dfa_off && !i->err_exact && i->backtrack > 0) {
+        MPC_PRIMITIVE(mpc_input_dfa(i, p->data.dfa.d, (char**)&r->output));
+      }
+      
+      return mpc_parse_run(i, p->data.dfa.x, r, e);
+    
     /* End */
     
     default:
@@ -1261,20 +1879,210 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
 #undef MPC_FAILURE
 #undef MPC_PRIMITIVE
 
-int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
-  int x;
-  mpc_err_t *e = mpc_err_fail(i, "Unknown Error");
-  e->state = mpc_state_invalid();
-  x = mpc_parse_run(i, p, r, &e);
-  if (x) {
+static mpc_err_t *mpc_err_copy(mpc_input_t *i, mpc_err_t *x) {
+  
+  int j;
+  mpc_err_t *y;
+  
+  if (x == NULL) { return NULL; }
+  
+  y = mpc_malloc(i, sizeof(mpc_err_t));
+  y->state = x->state;
+  y->expected_num = x->expected_num;
+  y->expected = x->expected_num ? mpc_malloc(i, sizeof(char*) * x->expected_num) : NULL;
+  for (j = 0; j < x->expected_num; j++) {
+    y->expected[j] = mpc_malloc(i, strlen(x->expected[j]) + 1);
+    strcpy(y->expected[j], x->expected[j]);
+  }
+  y->filename = mpc_malloc(i, strlen(x->filename) + 1);
+  strcpy(y->filename, x->filename);
+  y->failure = NULL;
+  if (x->failure) {
+    y->failure = mpc_malloc(i, strlen(x->failure) + 1);
+    strcpy(y->failure, x->failure);
+  }
+  y->recieved = x->recieved;
+  return y;
+}
+
+static mpc_ast_t *mpc_ast_copy(mpc_ast_t *a) {
+  
+  int j;
+  mpc_ast_t *b;
+  
+  if (a == NULL) { return NULL; }
+  
+  b = mpc_ast_new(a->tag, a->contents);
+  b->rule = a->rule;
+  b->state = a->state;
+  b->children_num = a->children_num;
+  b->children = a->children_num ? malloc(sizeof(mpc_ast_t*) * a->children_num) : NULL;
+  for (j = 0; j < a->children_num; j++) {
+    b->children[j] = mpc_ast_copy(a->children[j]);
+  }
+  return b;
+}
+
+/*
+** Packrat parsers are run at most once per position. The memo is an
+** open addressed table that doubles once it is half full, so no entry
+** is ever evicted. Whether errors are suppressed and whether
+** backtracking is on change what a parser does, so they are part of the
+** key. What it merges into the furthest error is gathered separately so
+** it can be merged again on a hit.
+*/
+
+static mpc_memo_t *mpc_memo_find(mpc_input_t *i, mpc_parser_t *p, long pos, char flags) {
+  unsigned long h = ((unsigned long)p >> 4) * 2654435761UL + (unsigned long)pos * 40503UL + flags;
+  mpc_memo_t *m;
+  for (;;) {
+    m = &i->memo[h & (i->memo_slots - 1)];
+    if (m->parser == NULL || (m->parser == p && m->pos == pos && m->flags == flags)) { return m; }
+    h++;
+  }
+}
+
+static void mpc_memo_grow(mpc_input_t *i) {
+  
+  int j, slots = i->memo_slots;
+  mpc_memo_t *old = i->memo;
+  
+  if (old && i->memo_num * 2 < slots) { return; }
+  
+  i->memo_slots = slots ? slots * 2 : MPC_INPUT_MEMO_MIN;
+  i->memo = calloc(i->memo_slots, sizeof(mpc_memo_t));
+  for (j = 0; j < slots; j++) {
+    if (old[j].parser) { *mpc_memo_find(i, old[j].parser, old[j].pos, old[j].flags) = old[j]; }
+  }
+  free(old);
+}
+
+/*
+** Outputs are arena trees handed out as they are, so a hit costs the
+** same however large the tree. While a memo is in use the arena copies
+** a node before changing it, so the remembered trees stay as they were.
+*/
+
+static int mpc_parse_memo(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+  
+  long pos = i->state.pos;
+  char flags = (i->suppress > 0) | ((i->backtrack < 1) << 1);
+  mpc_memo_t *m;
+  mpc_err_t *merged = NULL;
+  int x;
+  
+  mpc_memo_grow(i);
+  
+  m = mpc_memo_find(i, p, pos, flags);
+  if (m->parser) {
+    i->state = m->end;
+    i->last = m->last;
+    if (m->merged) { *e = mpc_err_merge(i, *e, mpc_err_copy(i, m->merged)); }
+    if (m->success) {
+      r->output = m->output;
+    } else {
+      r->error = mpc_err_copy(i, m->error);
+    }
+    return m->success;
+  }
+  
+  x = mpc_parse_run_step(i, p, r, &merged);
+  
+  /* Inner packrat parsers may have moved the table in the meantime */
+  mpc_memo_grow(i);
+  m = mpc_memo_find(i, p, pos, flags);
+  if (m->parser == NULL) { i->memo_num++; }
+  if (m->error) { mpc_err_delete(m->error); }
+  if (m->merged) { mpc_err_delete(m->merged); }
+  
+  m->parser = p;
+  m->pos = pos;
+  m->flags = flags;
+  m->success = x;
+  m->last = i->last;
+  m->end = i->state;
+  m->output = x ? r->output : NULL;
+  m->error = !x && r->error ? mpc_err_export(i, mpc_err_copy(i, r->error)) : NULL;
+  m->merged = merged ? mpc_err_export(i, mpc_err_copy(i, merged)) : NULL;
+  
+  *e = mpc_err_merge(i, *e, merged);
+  return x;
+}
+
+static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+  if (p->packrat && i->ast_arena && (i->type == MPC_INPUT_STRING || i->type == MPC_INPUT_MMAP)) {
+    return mpc_parse_memo(i, p, r, e);
+  }
+  return mpc_parse_run_step(i, p, r, e);
+}
+
+/*
+** A failed parse is run again from the start to build its error. DFAs
+** only say whether they matched, so that pass runs regexes as combinators
+** to get the same message. Pipes can't be read twice, and so build their
+** errors exactly from the start.
+*/
+
+static int mpc_parse_input_packrat(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r);
+
+int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
+  int x;
+  mpc_state_t s = i->state;
+  char last = i->last;
+  long offset = i->type == MPC_INPUT_FILE ? ftell(i->file) : 0;
+  mpc_err_t *e = NULL;
+  mpc_ast_arena_mark_t mark;
+  if (p->packrat && i->ast_arena == NULL
+  && (i->type == MPC_INPUT_STRING || i->type == MPC_INPUT_MMAP)) {
+    return mpc_parse_input_packrat(i, p, r);
+  }
+  if (i->ast_arena) { mark = mpc_ast_arena_mark(i->ast_arena); }
+  i->err_exact = i->type == MPC_INPUT_PIPE || offset < 0;
+  i->err_pos = -1;
+  x = mpc_parse_run(i, p, r, &e);
+  if (!x && !i->err_exact) {
+    mpc_input_memo_clear(i);
+    if (i->ast_arena) { mpc_ast_arena_rewind(i->ast_arena, mark); }
+    i->state = s;
+    i->last = last;
+    if (i->type == MPC_INPUT_FILE) { fseek(i->file, offset, SEEK_SET); }
+    i->err_exact = 1;
+    x = mpc_parse_run(i, p, r, &e);
+  }
+  i->err_exact = 1;
+  if (x) {
     mpc_err_delete_internal(i, e);
     r->output = mpc_export(i, r->output);
   } else {
-    r->error = mpc_err_export(i, mpc_err_merge(i, e, r->error));
+    if (i->ast_arena) { mpc_ast_arena_rewind(i->ast_arena, mark); }
+    e = mpc_err_merge(i, e, r->error);
+    if (e == NULL) {
+      i->err_pos = -1;
+      e = mpc_err_fail(i, "Unknown Error");
+      e->state = mpc_state_invalid();
+    }
+    r->error = mpc_err_export(i, e);
   }
   return x;
 }
 
+/*
+** Remembered trees are shared, which only arena trees can be, so a
+** packrat parse run without an arena builds its tree in one of its own
+** and copies it out once at the end.
+*/
+
+static int mpc_parse_input_packrat(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
+  int x;
+  i->ast_arena = mpc_ast_arena_new();
+  x = mpc_parse_input(i, p, r);
+  if (x) { r->output = mpc_ast_copy(r->output); }
+  mpc_input_memo_clear(i);
+  mpc_ast_arena_delete(i->ast_arena);
+  i->ast_arena = NULL;
+  return x;
+}
+
 int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r) {
   int x;
   mpc_input_t *i = mpc_input_new_string(filename, string);
@@ -1307,10 +2115,11 @@ int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result
   return x;
 }
 
-int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
+static int mpc_parse_contents_to(const char *filename, mpc_parser_t *p, mpc_ast_arena_t *a, mpc_result_t *r) {
   
   FILE *f = fopen(filename, "rb");
   int res;
+  mpc_input_t *i = NULL;
   
   if (f == NULL) {
     r->output = NULL;
@@ -1318,11 +2127,35 @@ int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
     return 0;
   }
   
-  res = mpc_parse_file(filename, f, p, r);
+#ifdef MPC_HAVE_MMAP
+  i = mpc_input_new_mmap(filename, f);
+#endif
+  if (i == NULL) { i = mpc_input_new_file(filename, f); }
+  
+  i->ast_arena = a;
+  res = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
   fclose(f);
   return res;
 }
 
+int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
+  return mpc_parse_contents_to(filename, p, NULL, r);
+}
+
+int mpc_parse_arena(const char *filename, const char *string, mpc_parser_t *p, mpc_ast_arena_t *a, mpc_result_t *r) {
+  int x;
+  mpc_input_t *i = mpc_input_new_string(filename, string);
+  i->ast_arena = a;
+  x = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return x;
+}
+
+int mpc_parse_contents_arena(const char *filename, mpc_parser_t *p, mpc_ast_arena_t *a, mpc_result_t *r) {
+  return mpc_parse_contents_to(filename, p, a, r);
+}
+
 /*
 ** Building a Parser
 */
@@ -1336,6 +2169,7 @@ static void mpc_undefine_or(mpc_parser_t *p) {
     mpc_undefine_unretained(p->data.or.xs[i], 0);
   }
   free(p->data.or.xs);
+  free(p->data.or.predict);
   
 }
 
@@ -1397,6 +2231,11 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
       free(p->data.check_with.e);
       break;
 
+    case MPC_TYPE_DFA:
+      mpc_undefine_unretained(p->data.dfa.x, 0);
+      mpc_dfa_delete(p->data.dfa.d);
+      break;
+
     default: break;
   }
   
@@ -1498,6 +2337,10 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       for (i = 0; i < a->data.or.n; i++) {
         p->data.or.xs[i] = mpc_copy(a->data.or.xs[i]);
       }
+      if (a->data.or.predict) {
+        p->data.or.predict = malloc(MPC_PREDICT_ENTRIES * sizeof(unsigned long));
+        memcpy(p->data.or.predict, a->data.or.predict, MPC_PREDICT_ENTRIES * sizeof(unsigned long));
+      }
     break;
     case MPC_TYPE_AND:
       p->data.and.xs = malloc(a->data.and.n * sizeof(mpc_parser_t*));
@@ -1520,6 +2363,11 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       p->data.check_with.e = malloc(strlen(a->data.check_with.e)+1);
       strcpy(p->data.check_with.e, a->data.check_with.e);
       break;
+    
+    case MPC_TYPE_DFA:
+      p->data.dfa.x = mpc_copy(a->data.dfa.x);
+      p->data.dfa.d = mpc_dfa_copy(a->data.dfa.d);
+      break;
 
     default: break;
   }
@@ -1534,6 +2382,11 @@ mpc_parser_t *mpc_undefine(mpc_parser_t *p) {
   return p;
 }
 
+mpc_parser_t *mpc_packrat(mpc_parser_t *a) {
+  a->packrat = 1;
+  return a;
+}
+
 mpc_parser_t *mpc_define(mpc_parser_t *p, mpc_parser_t *a) {
   
   if (p->retained) {
@@ -1890,6 +2743,7 @@ mpc_parser_t *mpc_or(int n, ...) {
   p->type = MPC_TYPE_OR;
   p->data.or.n = n;
   p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+  p->data.or.predict = NULL;
   
   va_start(va, n);  
   for (i = 0; i < n; i++) {
@@ -2117,154 +2971,660 @@ static mpc_val_t *mpcf_re_and(int n, mpc_val_t **xs) {
   for (i = 0; i < n; i++) {
     p = mpc_and(2, mpcf_strfold, p, xs[i], free);
   }
-  return p;
+  return p;
+}
+
+static mpc_val_t *mpcf_re_repeat(int n, mpc_val_t **xs) {
+  int num;
+  (void) n;
+  if (xs[1] == NULL) { return xs[0]; }
+  switch(((char*)xs[1])[0])
+  {
+    case '*': { free(xs[1]); return mpc_many(mpcf_strfold, xs[0]); }; break;
+    case '+': { free(xs[1]); return mpc_many1(mpcf_strfold, xs[0]); }; break;
+    case '?': { free(xs[1]); return mpc_maybe_lift(xs[0], mpcf_ctor_str); }; break;
+    default:
+      num = *(int*)xs[1];
+      free(xs[1]);
+  }
+  
+  return mpc_count(num, mpcf_strfold, xs[0], free);
+}
+
+static mpc_parser_t *mpc_re_escape_char(char c) {
+  switch (c) {
+    case 'a': return mpc_char('\a');
+    case 'f': return mpc_char('\f');
+    case 'n': return mpc_char('\n');
+    case 'r': return mpc_char('\r');
+    case 't': return mpc_char('\t');
+    case 'v': return mpc_char('\v');
+    case 'b': return mpc_and(2, mpcf_snd, mpc_boundary(), mpc_lift(mpcf_ctor_str), free);
+    case 'B': return mpc_not_lift(mpc_boundary(), free, mpcf_ctor_str);
+    case 'A': return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), free);
+    case 'Z': return mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free);
+    case 'd': return mpc_digit();
+    case 'D': return mpc_not_lift(mpc_digit(), free, mpcf_ctor_str);
+    case 's': return mpc_whitespace();
+    case 'S': return mpc_not_lift(mpc_whitespace(), free, mpcf_ctor_str);
+    case 'w': return mpc_alphanum();
+    case 'W': return mpc_not_lift(mpc_alphanum(), free, mpcf_ctor_str);
+    default: return NULL;
+  }
+}
+
+static mpc_val_t *mpcf_re_escape(mpc_val_t *x) {
+  
+  char *s = x;
+  mpc_parser_t *p;
+  
+  /* Regex Special Characters */
+  if (s[0] == '.') { free(s); return mpc_any(); }
+  if (s[0] == '^') { free(s); return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), free); }
+  if (s[0] == '$') { free(s); return mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free); }
+  
+  /* Regex Escape */
+  if (s[0] == '\\') {
+    p = mpc_re_escape_char(s[1]);
+    p = (p == NULL) ? mpc_char(s[1]) : p;
+    free(s);
+    return p;
+  }
+  
+  /* Regex Standard */
+  p = mpc_char(s[0]);
+  free(s);
+  return p;
+}
+
+static const char *mpc_re_range_escape_char(char c) {
+  switch (c) {
+    case '-': return "-";
+    case 'a': return "\a";
+    case 'f': return "\f";
+    case 'n': return "\n";
+    case 'r': return "\r";
+    case 't': return "\t";
+    case 'v': return "\v";
+    case 'b': return "\b";
+    case 'd': return "0123456789";
+    case 's': return " \f\n\r\t\v";
+    case 'w': return "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+    default: return NULL;
+  }
+}
+
+static char *mpc_re_range_chars(const char *s, int comp) {
+  
+  size_t i, j;
+  size_t start, end;
+  const char *tmp = NULL;
+  char *range = calloc(1,1);
+  
+  for (i = comp; i < strlen(s); i++){
+    
+    /* Regex Range Escape */
+    if (s[i] == '\\') {
+      tmp = mpc_re_range_escape_char(s[i+1]);
+      if (tmp != NULL) {
+        range = realloc(range, strlen(range) + strlen(tmp) + 1);
+        strcat(range, tmp);
+      } else {
+        range = realloc(range, strlen(range) + 1 + 1);
+        range[strlen(range) + 1] = '\0';
+        range[strlen(range) + 0] = s[i+1];      
+      }
+      i++;
+    }
+    
+    /* Regex Range...Range */
+    else if (s[i] == '-') {
+      if (s[i+1] == '\0' || i == 0) {
+          range = realloc(range, strlen(range) + strlen("-") + 1);
+          strcat(range, "-");
+      } else {
+        start = s[i-1]+1;
+        end = s[i+1]-1;
+        for (j = start; j <= end; j++) {
+          range = realloc(range, strlen(range) + 1 + 1 + 1);
+          range[strlen(range) + 1] = '\0';
+          range[strlen(range) + 0] = (char)j;
+        }        
+      }
+    }
+    
+    /* Regex Range Normal */
+    else {
+      range = realloc(range, strlen(range) + 1 + 1);
+      range[strlen(range) + 1] = '\0';
+      range[strlen(range) + 0] = s[i];
+    }
+  
+  }
+  
+  return range;
+}
+
+static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
+  
+  mpc_parser_t *out;
+  char *range;
+  const char *s = x;
+  int comp = s[0] == '^' ? 1 : 0;
+  
+  if (s[0] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); } 
+  if (s[0] == '^' && 
+      s[1] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); }
+  
+  range = mpc_re_range_chars(s, comp);
+  out = comp == 1 ? mpc_noneof(range) : mpc_oneof(range);
+  
+  free(x);
+  free(range);
+  
+  return out;
+}
+
+/*
+** Regular Expression DFAs
+**
+** Regexes are also compiled to a table driven DFA where possible, which
+** matches a whole token in one loop over the input with no marks, rewinds
+** or allocations per character. The catch is that mpc regexes are not
+** quite regular expressions: `*`, `+` and `?` are greedy and never give
+** back what they took, and `|` commits to the first alternative that
+** matches. This agrees with the longest match a DFA finds exactly when
+** every such choice can be made from the next character alone, so this
+** is checked first and anything else (ambiguous choices, anchors, `\b`
+** and friends) keeps running as combinators.
+**
+** The DFA comes from subset construction over a Thompson NFA, with bytes
+** that no set tells apart sharing a column, and is then minimised by
+** partition refinement. State 0 is the dead state.
+*/
+
+enum {
+  MPC_RE_SET, MPC_RE_EMPTY, MPC_RE_CAT, MPC_RE_OR,
+  MPC_RE_MANY, MPC_RE_MANY1, MPC_RE_MAYBE, MPC_RE_COUNT
+};
+
+enum { MPC_RE_NFA_EPS, MPC_RE_NFA_SET, MPC_RE_NFA_MATCH };
+
+enum {
+  MPC_RE_NODES_MAX = 1024,
+  MPC_RE_NFA_MAX   = 4096,
+  MPC_RE_DFA_MAX   = 512
+};
+
+#define MPC_RE_SET_ADD(s, c) ((s)[(unsigned char)(c) >> 3] |= (unsigned char)(1 << ((unsigned char)(c) & 7)))
+#define MPC_RE_SET_HAS(s, c) ((s)[(unsigned char)(c) >> 3] &  (1 << ((unsigned char)(c) & 7)))
+
+typedef struct {
+  int type, n, a, b;
+  int nullable;
+  unsigned char set[32];
+  unsigned char first[32];
+} mpc_re_node_t;
+
+typedef struct {
+  int type, set, out, out1;
+} mpc_re_nfa_t;
+
+typedef struct {
+  const char *s;
+  int pos;
+  int failed;
+  int nodes_num;
+  mpc_re_node_t nodes[MPC_RE_NODES_MAX];
+  int nfa_num;
+  mpc_re_nfa_t nfa[MPC_RE_NFA_MAX];
+} mpc_re_comp_t;
+
+static int mpc_re_node(mpc_re_comp_t *c, int type, int a, int b) {
+  mpc_re_node_t *x;
+  if (a < 0 || b < 0 || c->nodes_num == MPC_RE_NODES_MAX) { return -1; }
+  x = &c->nodes[c->nodes_num];
+  memset(x, 0, sizeof(mpc_re_node_t));
+  x->type = type;
+  x->a = a;
+  x->b = b;
+  return c->nodes_num++;
+}
+
+/* DFAs never see a NUL byte so sets leave it out */
+static int mpc_re_node_oneof(mpc_re_comp_t *c, const char *s, int comp) {
+  int j, x = mpc_re_node(c, MPC_RE_SET, 0, 0);
+  if (x < 0) { return -1; }
+  for (j = 0; s[j]; j++) { MPC_RE_SET_ADD(c->nodes[x].set, s[j]); }
+  if (comp) {
+    for (j = 0; j < 32; j++) { c->nodes[x].set[j] = (unsigned char)~c->nodes[x].set[j]; }
+    c->nodes[x].set[0] &= 0xFE;
+  }
+  return x;
+}
+
+static int mpc_re_node_char(mpc_re_comp_t *c, char ch) {
+  int x = mpc_re_node(c, MPC_RE_SET, 0, 0);
+  if (x < 0) { return -1; }
+  MPC_RE_SET_ADD(c->nodes[x].set, ch);
+  return x;
+}
+
+static int mpc_re_regex_node(mpc_re_comp_t *c);
+
+static int mpc_re_base_node(mpc_re_comp_t *c) {
+  
+  const char *s = c->s + c->pos;
+  char *body, *range;
+  int j = 1, x, comp;
+  
+  switch (s[0]) {
+    
+    case '(':
+      c->pos++;
+      x = mpc_re_regex_node(c);
+      if (x < 0 || c->s[c->pos] != ')') { return -1; }
+      c->pos++;
+      return x;
+    
+    case '[':
+      while (s[j] && s[j] != ']') {
+        if (s[j] == '\\') { if (!s[j+1]) { return -1; } j++; }
+        j++;
+      }
+      if (!s[j] || j == 1 || (j == 2 && s[1] == '^')) { return -1; }
+      body = malloc(j);
+      memcpy(body, s + 1, j - 1);
+      body[j-1] = '\0';
+      comp = body[0] == '^' ? 1 : 0;
+      range = mpc_re_range_chars(body, comp);
+      x = mpc_re_node_oneof(c, range, comp);
+      free(range);
+      free(body);
+      c->pos += j + 1;
+      return x;
+    
+    case '\\':
+      c->pos += 2;
+      switch (s[1]) {
+        case '\0': return -1;
+        case 'a': return mpc_re_node_char(c, '\a');
+        case 'f': return mpc_re_node_char(c, '\f');
+        case 'n': return mpc_re_node_char(c, '\n');
+        case 'r': return mpc_re_node_char(c, '\r');
+        case 't': return mpc_re_node_char(c, '\t');
+        case 'v': return mpc_re_node_char(c, '\v');
+        case 'd': return mpc_re_node_oneof(c, "0123456789", 0);
+        case 's': return mpc_re_node_oneof(c, " \f\n\r\t\v", 0);
+        case 'w': return mpc_re_node_oneof(c,
+          "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_", 0);
+        case 'b': case 'B': case 'A': case 'Z':
+        case 'D': case 'S': case 'W': return -1;
+        default: return mpc_re_node_char(c, s[1]);
+      }
+    
+    case '.':
+      c->pos++;
+      x = mpc_re_node(c, MPC_RE_SET, 0, 0);
+      if (x >= 0) { memset(c->nodes[x].set, 0xFF, 32); c->nodes[x].set[0] = 0xFE; }
+      return x;
+    
+    case '^': case '$':
+    case '*': case '+': case '?': case '{':
+      return -1;
+    
+    default:
+      c->pos++;
+      return mpc_re_node_char(c, s[0]);
+  }
+}
+
+static int mpc_re_factor_node(mpc_re_comp_t *c) {
+  
+  int x = mpc_re_base_node(c), n = 0;
+  
+  if (x < 0) { return -1; }
+  
+  switch (c->s[c->pos]) {
+    case '*': c->pos++; return mpc_re_node(c, MPC_RE_MANY, x, 0);
+    case '+': c->pos++; return mpc_re_node(c, MPC_RE_MANY1, x, 0);
+    case '?': c->pos++; return mpc_re_node(c, MPC_RE_MAYBE, x, 0);
+    case '{':
+      c->pos++;
+      while (isdigit((unsigned char)c->s[c->pos]) && n < 1000) {
+        n = n * 10 + (c->s[c->pos++] - '0');
+      }
+      if (c->s[c->pos] != '}' || n < 1 || n > 256) { return -1; }
+      c->pos++;
+      x = mpc_re_node(c, MPC_RE_COUNT, x, 0);
+      if (x >= 0) { c->nodes[x].n = n; }
+      return x;
+    default: return x;
+  }
+}
+
+static int mpc_re_term_node(mpc_re_comp_t *c) {
+  
+  int x = -1, y;
+  
+  while (c->s[c->pos] != '\0' && c->s[c->pos] != ')' && c->s[c->pos] != '|') {
+    y = mpc_re_factor_node(c);
+    if (y < 0) { return -1; }
+    x = x < 0 ? y : mpc_re_node(c, MPC_RE_CAT, x, y);
+    if (x < 0) { return -1; }
+  }
+  
+  return x < 0 ? mpc_re_node(c, MPC_RE_EMPTY, 0, 0) : x;
+}
+
+static int mpc_re_regex_node(mpc_re_comp_t *c) {
+  int x = mpc_re_term_node(c);
+  if (x < 0 || c->s[c->pos] != '|') { return x; }
+  c->pos++;
+  return mpc_re_node(c, MPC_RE_OR, x, mpc_re_regex_node(c));
+}
+
+static int mpc_re_disjoint(const unsigned char *a, const unsigned char *b) {
+  int j;
+  for (j = 0; j < 32; j++) { if (a[j] & b[j]) { return 0; } }
+  return 1;
+}
+
+/* Children always come before their parents so one pass fills these in */
+static void mpc_re_first(mpc_re_comp_t *c) {
+  
+  int j, k;
+  mpc_re_node_t *x, *a, *b;
+  
+  for (j = 0; j < c->nodes_num; j++) {
+    x = &c->nodes[j]; a = &c->nodes[x->a]; b = &c->nodes[x->b];
+    switch (x->type) {
+      case MPC_RE_SET:
+        x->nullable = 0;
+        memcpy(x->first, x->set, 32);
+      break;
+      case MPC_RE_EMPTY:
+        x->nullable = 1;
+      break;
+      case MPC_RE_CAT:
+        x->nullable = a->nullable && b->nullable;
+        for (k = 0; k < 32; k++) { x->first[k] = a->first[k] | (a->nullable ? b->first[k] : 0); }
+      break;
+      case MPC_RE_OR:
+        x->nullable = a->nullable || b->nullable;
+        for (k = 0; k < 32; k++) { x->first[k] = a->first[k] | b->first[k]; }
+      break;
+      default:
+        x->nullable = x->type == MPC_RE_MANY || x->type == MPC_RE_MAYBE || a->nullable;
+        memcpy(x->first, a->first, 32);
+      break;
+    }
+  }
+  
+}
+
+/*
+** Checks every choice in `x` can be made from the next character, given
+** the characters that may follow it. At the top nothing has to follow.
+*/
+
+static int mpc_re_check(mpc_re_comp_t *c, int x, const unsigned char *follow) {
+  
+  int k;
+  unsigned char f[32];
+  mpc_re_node_t *n = &c->nodes[x], *a = &c->nodes[n->a], *b = &c->nodes[n->b];
+  
+  switch (n->type) {
+    
+    case MPC_RE_CAT:
+      for (k = 0; k < 32; k++) { f[k] = b->first[k] | (b->nullable ? follow[k] : 0); }
+      return mpc_re_check(c, n->b, follow) && mpc_re_check(c, n->a, f);
+    
+    case MPC_RE_OR:
+      if (a->nullable || !mpc_re_disjoint(a->first, b->first)) { return 0; }
+      if (b->nullable && !mpc_re_disjoint(a->first, follow)) { return 0; }
+      return mpc_re_check(c, n->a, follow) && mpc_re_check(c, n->b, follow);
+    
+    case MPC_RE_MANY:
+    case MPC_RE_MANY1:
+      if (a->nullable || !mpc_re_disjoint(a->first, follow)) { return 0; }
+      for (k = 0; k < 32; k++) { f[k] = a->first[k] | follow[k]; }
+      return mpc_re_check(c, n->a, f);
+    
+    case MPC_RE_MAYBE:
+      if (a->nullable || !mpc_re_disjoint(a->first, follow)) { return 0; }
+      return mpc_re_check(c, n->a, follow);
+    
+    case MPC_RE_COUNT:
+      if (a->nullable) { return 0; }
+      return mpc_re_check(c, n->a, follow) && (n->n == 1 || mpc_re_check(c, n->a, a->first));
+    
+    default: return 1;
+  }
+  
 }
 
-static mpc_val_t *mpcf_re_repeat(int n, mpc_val_t **xs) {
-  int num;
-  (void) n;
-  if (xs[1] == NULL) { return xs[0]; }
-  switch(((char*)xs[1])[0])
-  {
-    case '*': { free(xs[1]); return mpc_many(mpcf_strfold, xs[0]); }; break;
-    case '+': { free(xs[1]); return mpc_many1(mpcf_strfold, xs[0]); }; break;
-    case '?': { free(xs[1]); return mpc_maybe_lift(xs[0], mpcf_ctor_str); }; break;
-    default:
-      num = *(int*)xs[1];
-      free(xs[1]);
+static int mpc_re_nfa_state(mpc_re_comp_t *c, int type, int set, int out, int out1) {
+  if (c->nfa_num == MPC_RE_NFA_MAX) { c->failed = 1; return 0; }
+  c->nfa[c->nfa_num].type = type;
+  c->nfa[c->nfa_num].set = set;
+  c->nfa[c->nfa_num].out = out;
+  c->nfa[c->nfa_num].out1 = out1;
+  return c->nfa_num++;
+}
+
+/* Builds the NFA for `x` backwards from the state that follows it */
+static int mpc_re_nfa_build(mpc_re_comp_t *c, int x, int next) {
+  
+  int j, s;
+  mpc_re_node_t *n = &c->nodes[x];
+  
+  if (c->failed) { return 0; }
+  
+  switch (n->type) {
+    case MPC_RE_SET:   return mpc_re_nfa_state(c, MPC_RE_NFA_SET, x, next, -1);
+    case MPC_RE_EMPTY: return next;
+    case MPC_RE_CAT:   return mpc_re_nfa_build(c, n->a, mpc_re_nfa_build(c, n->b, next));
+    case MPC_RE_OR:
+      return mpc_re_nfa_state(c, MPC_RE_NFA_EPS, 0,
+        mpc_re_nfa_build(c, n->a, next), mpc_re_nfa_build(c, n->b, next));
+    case MPC_RE_MAYBE:
+      return mpc_re_nfa_state(c, MPC_RE_NFA_EPS, 0, mpc_re_nfa_build(c, n->a, next), next);
+    case MPC_RE_MANY:
+    case MPC_RE_MANY1:
+      s = mpc_re_nfa_state(c, MPC_RE_NFA_EPS, 0, -1, next);
+      j = mpc_re_nfa_build(c, n->a, s);
+      if (c->failed) { return 0; }
+      c->nfa[s].out = j;
+      return n->type == MPC_RE_MANY ? s : j;
+    case MPC_RE_COUNT:
+      for (j = 0; j < n->n; j++) { next = mpc_re_nfa_build(c, n->a, next); }
+      return next;
+    default: c->failed = 1; return 0;
   }
   
-  return mpc_count(num, mpcf_strfold, xs[0], free);
 }
 
-static mpc_parser_t *mpc_re_escape_char(char c) {
-  switch (c) {
-    case 'a': return mpc_char('\a');
-    case 'f': return mpc_char('\f');
-    case 'n': return mpc_char('\n');
-    case 'r': return mpc_char('\r');
-    case 't': return mpc_char('\t');
-    case 'v': return mpc_char('\v');
-    case 'b': return mpc_and(2, mpcf_snd, mpc_boundary(), mpc_lift(mpcf_ctor_str), free);
-    case 'B': return mpc_not_lift(mpc_boundary(), free, mpcf_ctor_str);
-    case 'A': return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), free);
-    case 'Z': return mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free);
-    case 'd': return mpc_digit();
-    case 'D': return mpc_not_lift(mpc_digit(), free, mpcf_ctor_str);
-    case 's': return mpc_whitespace();
-    case 'S': return mpc_not_lift(mpc_whitespace(), free, mpcf_ctor_str);
-    case 'w': return mpc_alphanum();
-    case 'W': return mpc_not_lift(mpc_alphanum(), free, mpcf_ctor_str);
-    default: return NULL;
+static void mpc_re_nfa_closure(mpc_re_comp_t *c, unsigned int *set, int *stack) {
+  
+  int j, s, top = 0;
+  
+  for (j = 0; j < c->nfa_num; j++) {
+    if (set[j >> 5] & (1u << (j & 31))) { stack[top++] = j; }
+  }
+  
+  while (top > 0) {
+    s = stack[--top];
+    if (c->nfa[s].type != MPC_RE_NFA_EPS) { continue; }
+    for (j = 0; j < 2; j++) {
+      int t = j ? c->nfa[s].out1 : c->nfa[s].out;
+      if (t < 0 || (set[t >> 5] & (1u << (t & 31)))) { continue; }
+      set[t >> 5] |= 1u << (t & 31);
+      stack[top++] = t;
+    }
   }
+  
 }
 
-static mpc_val_t *mpcf_re_escape(mpc_val_t *x) {
+/* Merges states until no accepting or transition difference splits them */
+static mpc_dfa_t *mpc_dfa_minimise(int num, int start, int classes,
+  const unsigned char *cls, const char *accept, const int *trans) {
   
-  char *s = x;
-  mpc_parser_t *p;
+  int j, k, g, groups = 2, count;
+  int *part = malloc(sizeof(int) * num);
+  int *next = malloc(sizeof(int) * num);
+  int *reps = malloc(sizeof(int) * num);
+  int *ids  = malloc(sizeof(int) * num);
+  mpc_dfa_t *d;
   
-  /* Regex Special Characters */
-  if (s[0] == '.') { free(s); return mpc_any(); }
-  if (s[0] == '^') { free(s); return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), free); }
-  if (s[0] == '$') { free(s); return mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free); }
+  for (j = 0; j < num; j++) { part[j] = accept[j] ? 1 : 0; }
   
-  /* Regex Escape */
-  if (s[0] == '\\') {
-    p = mpc_re_escape_char(s[1]);
-    p = (p == NULL) ? mpc_char(s[1]) : p;
-    free(s);
-    return p;
+  while (1) {
+    count = 0;
+    for (j = 0; j < num; j++) {
+      for (g = 0; g < count; g++) {
+        int r = reps[g];
+        if (part[r] != part[j]) { continue; }
+        for (k = 0; k < classes; k++) {
+          if (part[trans[r * classes + k]] != part[trans[j * classes + k]]) { break; }
+        }
+        if (k == classes) { break; }
+      }
+      if (g == count) { reps[count++] = j; }
+      next[j] = g;
+    }
+    memcpy(part, next, sizeof(int) * num);
+    if (count == groups) { break; }
+    groups = count;
   }
   
-  /* Regex Standard */
-  p = mpc_char(s[0]);
-  free(s);
-  return p;
-}
-
-static const char *mpc_re_range_escape_char(char c) {
-  switch (c) {
-    case '-': return "-";
-    case 'a': return "\a";
-    case 'f': return "\f";
-    case 'n': return "\n";
-    case 'r': return "\r";
-    case 't': return "\t";
-    case 'v': return "\v";
-    case 'b': return "\b";
-    case 'd': return "0123456789";
-    case 's': return " \f\n\r\t\v";
-    case 'w': return "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
-    default: return NULL;
+  /* The group of the dead state becomes state 0 */
+  for (g = 0; g < count; g++) { ids[g] = -1; }
+  ids[part[0]] = 0;
+  for (g = 0, j = 1; g < count; g++) { if (ids[g] < 0) { ids[g] = j++; } }
+  
+  d = malloc(sizeof(mpc_dfa_t));
+  d->states = count;
+  d->start = ids[part[start]];
+  d->classes = classes;
+  memcpy(d->cls, cls, 256);
+  d->accept = malloc(count);
+  d->trans = malloc(sizeof(int) * count * classes);
+  for (g = 0; g < count; g++) {
+    d->accept[ids[g]] = accept[reps[g]];
+    for (k = 0; k < classes; k++) {
+      d->trans[ids[g] * classes + k] = ids[part[trans[reps[g] * classes + k]]];
+    }
   }
+  
+  free(part); free(next); free(reps); free(ids);
+  return d;
 }
 
-static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
+static mpc_dfa_t *mpc_dfa_build(mpc_re_comp_t *c, int start) {
   
-  mpc_parser_t *out;
-  size_t i, j;
-  size_t start, end;
-  const char *tmp = NULL;
-  const char *s = x;
-  int comp = s[0] == '^' ? 1 : 0;
-  char *range = calloc(1,1);
+  int j, k, s, num, classes = 1, words = (c->nfa_num + 31) / 32;
+  int map[512], rep[256], *stack, *trans;
+  unsigned char cls[256], ncls[256];
+  unsigned int *sets, *cur;
+  char *accept;
+  mpc_dfa_t *d = NULL;
   
-  if (s[0] == '\0') { free(range); free(x); return mpc_fail("Invalid Regex Range Expression"); } 
-  if (s[0] == '^' && 
-      s[1] == '\0') { free(range); free(x); return mpc_fail("Invalid Regex Range Expression"); }
+  /* Split bytes into classes every set treats the same */
+  memset(cls, 0, 256);
+  for (j = 0; j < c->nodes_num; j++) {
+    if (c->nodes[j].type != MPC_RE_SET) { continue; }
+    for (k = 0; k < 512; k++) { map[k] = -1; }
+    for (s = 0, k = 0; k < 256; k++) {
+      int key = cls[k] * 2 + (MPC_RE_SET_HAS(c->nodes[j].set, k) ? 1 : 0);
+      if (map[key] < 0) { map[key] = s++; }
+      ncls[k] = (unsigned char)map[key];
+    }
+    memcpy(cls, ncls, 256);
+    classes = s;
+  }
+  for (k = 255; k >= 0; k--) { rep[cls[k]] = k; }
   
-  for (i = comp; i < strlen(s); i++){
-    
-    /* Regex Range Escape */
-    if (s[i] == '\\') {
-      tmp = mpc_re_range_escape_char(s[i+1]);
-      if (tmp != NULL) {
-        range = realloc(range, strlen(range) + strlen(tmp) + 1);
-        strcat(range, tmp);
-      } else {
-        range = realloc(range, strlen(range) + 1 + 1);
-        range[strlen(range) + 1] = '\0';
-        range[strlen(range) + 0] = s[i+1];      
-      }
-      i++;
+  sets   = calloc((size_t)MPC_RE_DFA_MAX * words, sizeof(unsigned int));
+  trans  = malloc(sizeof(int) * MPC_RE_DFA_MAX * classes);
+  accept = calloc(MPC_RE_DFA_MAX, 1);
+  stack  = malloc(sizeof(int) * c->nfa_num);
+  
+  /* State 0 is the empty set, state 1 the closure of the start */
+  sets[words + (start >> 5)] |= 1u << (start & 31);
+  mpc_re_nfa_closure(c, sets + words, stack);
+  num = 2;
+  
+  for (j = 0; j < num; j++) {
+    for (s = 0; s < c->nfa_num; s++) {
+      if ((sets[j * words + (s >> 5)] & (1u << (s & 31))) && c->nfa[s].type == MPC_RE_NFA_MATCH) { accept[j] = 1; }
     }
-    
-    /* Regex Range...Range */
-    else if (s[i] == '-') {
-      if (s[i+1] == '\0' || i == 0) {
-          range = realloc(range, strlen(range) + strlen("-") + 1);
-          strcat(range, "-");
-      } else {
-        start = s[i-1]+1;
-        end = s[i+1]-1;
-        for (j = start; j <= end; j++) {
-          range = realloc(range, strlen(range) + 1 + 1 + 1);
-          range[strlen(range) + 1] = '\0';
-          range[strlen(range) + 0] = (char)j;
-        }        
+    for (k = 0; k < classes; k++) {
+      cur = sets + num * words;
+      memset(cur, 0, sizeof(unsigned int) * words);
+      for (s = 0; s < c->nfa_num; s++) {
+        if ((sets[j * words + (s >> 5)] & (1u << (s & 31)))
+        &&  c->nfa[s].type == MPC_RE_NFA_SET
+        &&  MPC_RE_SET_HAS(c->nodes[c->nfa[s].set].set, rep[k])) {
+          cur[c->nfa[s].out >> 5] |= 1u << (c->nfa[s].out & 31);
+        }
       }
+      mpc_re_nfa_closure(c, cur, stack);
+      for (s = 0; s < num; s++) {
+        if (memcmp(sets + s * words, cur, sizeof(unsigned int) * words) == 0) { break; }
+      }
+      if (s == num) {
+        if (num + 1 == MPC_RE_DFA_MAX) { goto done; }
+        num++;
+      }
+      trans[j * classes + k] = s;
     }
-    
-    /* Regex Range Normal */
-    else {
-      range = realloc(range, strlen(range) + 1 + 1);
-      range[strlen(range) + 1] = '\0';
-      range[strlen(range) + 0] = s[i];
-    }
-  
   }
   
-  out = comp == 1 ? mpc_noneof(range) : mpc_oneof(range);
+  d = mpc_dfa_minimise(num, 1, classes, cls, accept, trans);
   
-  free(x);
-  free(range);
+done:
+  free(sets); free(trans); free(accept); free(stack);
+  return d;
+}
+
+static mpc_dfa_t *mpc_dfa_compile(const char *re) {
   
-  return out;
+  int x, start;
+  unsigned char none[32];
+  mpc_dfa_t *d = NULL;
+  mpc_re_comp_t *c = calloc(1, sizeof(mpc_re_comp_t));
+  
+  c->s = re;
+  x = mpc_re_regex_node(c);
+  
+  if (x >= 0 && re[c->pos] == '\0') {
+    mpc_re_first(c);
+    memset(none, 0, 32);
+    if (mpc_re_check(c, x, none)) {
+      start = mpc_re_nfa_build(c, x, mpc_re_nfa_state(c, MPC_RE_NFA_MATCH, 0, -1, -1));
+      if (!c->failed) { d = mpc_dfa_build(c, start); }
+    }
+  }
+  
+  free(c);
+  return d;
+}
+
+static mpc_parser_t *mpc_re_dfa(const char *re, mpc_parser_t *a) {
+  mpc_parser_t *p;
+  mpc_dfa_t *d = mpc_dfa_compile(re);
+  if (d == NULL) { return a; }
+  p = mpc_undefined();
+  p->type = MPC_TYPE_DFA;
+  p->data.dfa.x = a;
+  p->data.dfa.d = d;
+  return p;
 }
 
 mpc_parser_t *mpc_re(const char *re) {
   
+  int ok;
   char *err_msg;
   mpc_parser_t *err_out;
   mpc_result_t r;
@@ -2314,7 +3674,8 @@ mpc_parser_t *mpc_re(const char *re) {
   mpc_optimise(Base);
   mpc_optimise(Range);
   
-  if(!mpc_parse("<mpc_re_compiler>", re, RegexEnclose, &r)) {
+  ok = mpc_parse("<mpc_re_compiler>", re, RegexEnclose, &r);
+  if(!ok) {
     err_msg = mpc_err_string(r.error);
     err_out = mpc_failf("Invalid Regex: %s", err_msg);
     mpc_err_delete(r.error);  
@@ -2326,7 +3687,7 @@ mpc_parser_t *mpc_re(const char *re) {
   
   mpc_optimise(r.output);
   
-  return r.output;
+  return ok ? mpc_re_dfa(re, r.output) : r.output;
   
 }
 
@@ -2707,6 +4068,10 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
     mpc_print_unretained(p->data.check_with.x, 0);
     printf("->?");
   }
+  
+  if (p->type == MPC_TYPE_DFA) {
+    mpc_print_unretained(p->data.dfa.x, 0);
+  }
 
 }
 
@@ -2820,6 +4185,7 @@ mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
   strcpy(a->contents, contents);
   
   a->state = mpc_state_new();
+  a->rule = 0;
   
   a->children_num = 0;
   a->children = NULL;
@@ -3131,6 +4497,7 @@ mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
     if        (as[i] && as[i]->children_num == 0) {
       mpc_ast_add_child(r, as[i]);
     } else if (as[i] && as[i]->children_num == 1) {
+      if (!as[i]->children[0]->rule) { as[i]->children[0]->rule = as[i]->rule; }
       mpc_ast_add_child(r, mpc_ast_add_root_tag(as[i]->children[0], as[i]->tag));
       mpc_ast_delete_no_children(as[i]);
     } else if (as[i] && as[i]->children_num >= 2) {
@@ -3176,6 +4543,21 @@ mpc_parser_t *mpca_add_tag(mpc_parser_t *a, const char *t) {
   return mpc_apply_to(a, (mpc_apply_to_t)mpc_ast_add_tag, (void*)t);
 }
 
+/*
+** Tags the result with the rule's name like mpca_add_tag and also
+** records the rule's id, unless an inner rule has already set one.
+*/
+
+static mpc_ast_t *mpc_ast_add_rule(mpc_ast_t *a, mpc_parser_t *p) {
+  if (a == NULL) { return a; }
+  if (a->rule == 0) { a->rule = p->rule; }
+  return mpc_ast_add_tag(a, p->name);
+}
+
+static mpc_parser_t *mpca_add_rule(mpc_parser_t *a) {
+  return mpc_apply_to(a, (mpc_apply_to_t)mpc_ast_add_rule, a);
+}
+
 mpc_parser_t *mpca_root(mpc_parser_t *a) {
   return mpc_apply(a, (mpc_apply_t)mpc_ast_add_root);
 }
@@ -3196,6 +4578,7 @@ mpc_parser_t *mpca_or(int n, ...) {
   p->type = MPC_TYPE_OR;
   p->data.or.n = n;
   p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+  p->data.or.predict = NULL;
   
   va_start(va, n);  
   for (i = 0; i < n; i++) {
@@ -3285,6 +4668,9 @@ typedef struct {
   int flags;
 } mpca_grammar_st_t;
 
+static void mpc_optimise_unretained(mpc_parser_t *p, int force);
+static void mpc_predict(mpc_parser_t **roots, int n);
+
 static mpc_val_t *mpcaf_grammar_or(int n, mpc_val_t **xs) {
   (void) n;
   if (xs[1] == NULL) { return xs[0]; }
@@ -3365,6 +4751,7 @@ static mpc_parser_t *mpca_grammar_find_parser(char *x, mpca_grammar_st_t *st) {
       if (st->parsers[st->parsers_num-1] == NULL) {
         return mpc_failf("No Parser in position %i! Only supplied %i Parsers!", i, st->parsers_num);
       }
+      st->parsers[st->parsers_num-1]->rule = st->parsers_num;
     }
     
     return st->parsers[st->parsers_num-1];
@@ -3389,6 +4776,7 @@ static mpc_parser_t *mpca_grammar_find_parser(char *x, mpca_grammar_st_t *st) {
       st->parsers[st->parsers_num-1] = p;
       
       if (p == NULL || p->name == NULL) { return mpc_failf("Unknown Parser '%s'!", x); }
+      p->rule = st->parsers_num;
       if (p->name && strcmp(p->name, x) == 0) { return p; }
       
     }
@@ -3404,7 +4792,7 @@ static mpc_val_t *mpcaf_grammar_id(mpc_val_t *x, void *s) {
   free(x);
 
   if (p->name) {
-    return mpca_state(mpca_root(mpca_add_tag(p, p->name)));
+    return mpca_state(mpca_root(mpca_add_rule(p)));
   } else {
     return mpca_state(mpca_root(p));
   }
@@ -3553,14 +4941,18 @@ static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
     left = mpca_grammar_find_parser(stmt->ident, st);
     if (st->flags & MPCA_LANG_PREDICTIVE) { stmt->grammar = mpc_predictive(stmt->grammar); }
     if (stmt->name) { stmt->grammar = mpc_expect(stmt->grammar, stmt->name); }
-    mpc_optimise(stmt->grammar);
+    mpc_optimise_unretained(stmt->grammar, 1);
     mpc_define(left, stmt->grammar);
+    if (st->flags & MPCA_LANG_PACKRAT) { mpc_packrat(left); }
     free(stmt->ident);
     free(stmt->name);
     free(stmt);
     stmts++;
   }
   
+  /* Predict once every rule is defined */
+  mpc_predict(st->parsers, st->parsers_num);
+  
   free(x);
   
   return NULL;
@@ -3750,6 +5142,7 @@ static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
 
   if (p->type == MPC_TYPE_CHECK)    { return 1 + mpc_nodecount_unretained(p->data.check.x, 0); }
   if (p->type == MPC_TYPE_CHECK_WITH) { return 1 + mpc_nodecount_unretained(p->data.check_with.x, 0); }
+  if (p->type == MPC_TYPE_DFA)        { return 1 + mpc_nodecount_unretained(p->data.dfa.x, 0); }
 
   if (p->type == MPC_TYPE_NOT)   { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MAYBE) { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
@@ -3778,10 +5171,258 @@ static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
   
 }
 
+/*
+** FIRST Sets
+**
+** Collects every parser reachable from a set of roots, including
+** retained ones, and finds for each the bytes a match can start
+** with and whether it can match without consuming anything. Rules
+** still undefined are assumed to start with anything. An `or` whose
+** alternatives are told apart by these gets a prediction table.
+*/
+
+typedef struct {
+  int num;
+  int slots;
+  mpc_parser_t **ps;
+  unsigned char (*first)[32];
+  char *nullable;
+  int *table;
+} mpc_first_t;
+
+static int mpc_first_children(mpc_parser_t *p, mpc_parser_t ***xs) {
+  switch (p->type) {
+    case MPC_TYPE_EXPECT:     *xs = &p->data.expect.x;     return 1;
+    case MPC_TYPE_APPLY:      *xs = &p->data.apply.x;      return 1;
+    case MPC_TYPE_APPLY_TO:   *xs = &p->data.apply_to.x;   return 1;
+    case MPC_TYPE_CHECK:      *xs = &p->data.check.x;      return 1;
+    case MPC_TYPE_CHECK_WITH: *xs = &p->data.check_with.x; return 1;
+    case MPC_TYPE_DFA:        *xs = &p->data.dfa.x;        return 1;
+    case MPC_TYPE_PREDICT:    *xs = &p->data.predict.x;    return 1;
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:      *xs = &p->data.not.x;        return 1;
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:      *xs = &p->data.repeat.x;     return 1;
+    case MPC_TYPE_OR:         *xs = p->data.or.xs;         return p->data.or.n;
+    case MPC_TYPE_AND:        *xs = p->data.and.xs;        return p->data.and.n;
+    default: return 0;
+  }
+}
+
+static int mpc_first_slot(mpc_first_t *f, mpc_parser_t *p) {
+  int h = (int)(((size_t)p >> 4) & (size_t)(f->slots - 1));
+  while (f->table[h] != -1 && f->ps[f->table[h]] != p) { h = (h + 1) & (f->slots - 1); }
+  return h;
+}
+
+static int mpc_first_index(mpc_first_t *f, mpc_parser_t *p) {
+  return f->table[mpc_first_slot(f, p)];
+}
+
+static void mpc_first_collect(mpc_first_t *f, mpc_parser_t *p) {
+  
+  int i, n, h;
+  mpc_parser_t **xs;
+  
+  if (f->num * 2 >= f->slots) {
+    f->slots *= 2;
+    f->ps = realloc(f->ps, sizeof(mpc_parser_t*) * f->slots);
+    f->table = realloc(f->table, sizeof(int) * f->slots);
+    for (i = 0; i < f->slots; i++) { f->table[i] = -1; }
+    for (i = 0; i < f->num; i++) { f->table[mpc_first_slot(f, f->ps[i])] = i; }
+  }
+  
+  h = mpc_first_slot(f, p);
+  if (f->table[h] != -1) { return; }
+  f->table[h] = f->num;
+  f->ps[f->num++] = p;
+  
+  n = mpc_first_children(p, &xs);
+  for (i = 0; i < n; i++) { mpc_first_collect(f, xs[i]); }
+}
+
+static void mpc_first_init(mpc_first_t *f, mpc_parser_t **roots, int n) {
+  int i;
+  f->num = 0;
+  f->slots = 64;
+  f->ps = malloc(sizeof(mpc_parser_t*) * f->slots);
+  f->table = malloc(sizeof(int) * f->slots);
+  for (i = 0; i < f->slots; i++) { f->table[i] = -1; }
+  for (i = 0; i < n; i++) { if (roots[i]) { mpc_first_collect(f, roots[i]); } }
+  f->first = calloc(f->num, sizeof(*f->first));
+  f->nullable = calloc(f->num, 1);
+}
+
+static void mpc_first_free(mpc_first_t *f) {
+  free(f->ps);
+  free(f->table);
+  free(f->first);
+  free(f->nullable);
+}
+
+static int mpc_first_has(const unsigned char *s, int c) {
+  return s[c >> 3] >> (c & 7) & 1;
+}
+
+/* Recomputes one parser's set from its children, returning if it grew */
+static int mpc_first_step(mpc_first_t *f, int k) {
+  
+  mpc_parser_t *p = f->ps[k];
+  mpc_parser_t **xs;
+  unsigned char s[32];
+  int i, j, n, c, e = 0;
+  
+  memset(s, 0, sizeof(s));
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_UNDEFINED:
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SATISFY:
+      memset(s, 0xFF, sizeof(s));
+      e = p->type == MPC_TYPE_UNDEFINED;
+      break;
+    
+    case MPC_TYPE_SINGLE:
+      c = (unsigned char)p->data.single.x;
+      s[c >> 3] |= 1 << (c & 7);
+      break;
+    
+    case MPC_TYPE_RANGE:
+      for (c = 0; c < 256; c++) {
+        if ((char)c >= p->data.range.x && (char)c <= p->data.range.y) { s[c >> 3] |= 1 << (c & 7); }
+      }
+      break;
+    
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+      for (c = 0; c < 256; c++) {
+        if ((strchr(p->data.string.x, (char)c) != NULL) == (p->type == MPC_TYPE_ONEOF)) { s[c >> 3] |= 1 << (c & 7); }
+      }
+      break;
+    
+    case MPC_TYPE_STRING:
+      c = (unsigned char)p->data.string.x[0];
+      if (c) { s[c >> 3] |= 1 << (c & 7); } else { e = 1; }
+      break;
+    
+    case MPC_TYPE_FAIL:
+      break;
+    
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_LIFT:
+    case MPC_TYPE_LIFT_VAL:
+    case MPC_TYPE_STATE:
+    case MPC_TYPE_ANCHOR:
+    case MPC_TYPE_NOT:
+      e = 1;
+      break;
+    
+    case MPC_TYPE_AND:
+      e = 1;
+      for (i = 0; i < p->data.and.n && e; i++) {
+        j = mpc_first_index(f, p->data.and.xs[i]);
+        for (c = 0; c < 32; c++) { s[c] |= f->first[j][c]; }
+        e = f->nullable[j];
+      }
+      break;
+    
+    default:
+      n = mpc_first_children(p, &xs);
+      for (i = 0; i < n; i++) {
+        j = mpc_first_index(f, xs[i]);
+        for (c = 0; c < 32; c++) { s[c] |= f->first[j][c]; }
+        e = e || f->nullable[j];
+      }
+      if (p->type == MPC_TYPE_MAYBE || p->type == MPC_TYPE_MANY) { e = 1; }
+      if (p->type == MPC_TYPE_COUNT && p->data.repeat.n <= 0) { e = 1; }
+      break;
+  }
+  
+  n = e && !f->nullable[k];
+  f->nullable[k] |= e;
+  for (c = 0; c < 32; c++) {
+    n = n || (s[c] & ~f->first[k][c]);
+    f->first[k][c] |= s[c];
+  }
+  
+  return n;
+}
+
+static void mpc_first_build(mpc_first_t *f) {
+  int k, changed = 1;
+  while (changed) {
+    changed = 0;
+    for (k = f->num-1; k >= 0; k--) { changed |= mpc_first_step(f, k); }
+  }
+}
+
+static void mpc_predict_or(mpc_first_t *f, mpc_parser_t *p) {
+  
+  int j, c, x;
+  unsigned long full = 0, *t;
+  int useful = 0;
+  
+  free(p->data.or.predict);
+  p->data.or.predict = NULL;
+  
+  if (p->data.or.n < 2 || p->data.or.n > MPC_PREDICT_MAX) { return; }
+  
+  t = calloc(MPC_PREDICT_ENTRIES, sizeof(unsigned long));
+  
+  for (j = 0; j < p->data.or.n; j++) {
+    x = mpc_first_index(f, p->data.or.xs[j]);
+    full |= 1UL << j;
+    for (c = 0; c < MPC_PREDICT_ENTRIES; c++) {
+      if (f->nullable[x] || (c < 256 && mpc_first_has(f->first[x], c))) { t[c] |= 1UL << j; }
+    }
+  }
+  
+  for (c = 0; c < MPC_PREDICT_ENTRIES; c++) { useful = useful || t[c] != full; }
+  
+  if (useful) { p->data.or.predict = t; } else { free(t); }
+}
+
+static void mpc_predict(mpc_parser_t **roots, int n) {
+  
+  int k;
+  mpc_first_t f;
+  
+  mpc_first_init(&f, roots, n);
+  mpc_first_build(&f);
+  for (k = 0; k < f.num; k++) {
+    if (f.ps[k]->type == MPC_TYPE_OR) { mpc_predict_or(&f, f.ps[k]); }
+  }
+  mpc_first_free(&f);
+  
+}
+
 void mpc_stats(mpc_parser_t* p) {
+  
+  int k, c, ors = 0, predictive = 0, single;
+  unsigned long *t;
+  mpc_first_t f;
+  
+  mpc_first_init(&f, &p, 1);
+  for (k = 0; k < f.num; k++) {
+    if (f.ps[k]->type != MPC_TYPE_OR) { continue; }
+    ors++;
+    t = f.ps[k]->data.or.predict;
+    single = f.ps[k]->data.or.n < 2;
+    if (t) {
+      single = 1;
+      for (c = 0; c < MPC_PREDICT_ENTRIES; c++) { single = single && (t[c] & (t[c] - 1)) == 0; }
+    }
+    predictive += single;
+  }
+  mpc_first_free(&f);
+  
   printf("Stats\n");
   printf("=====\n");
   printf("Node Count: %i\n", mpc_nodecount_unretained(p, 1));
+  printf("Or Nodes: %i\n", ors);
+  printf("Predictive Or Nodes: %i\n", predictive);
 }
 
 static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
@@ -3798,6 +5439,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_APPLY_TO)   { mpc_optimise_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_CHECK)      { mpc_optimise_unretained(p->data.check.x, 0); }
   if (p->type == MPC_TYPE_CHECK_WITH) { mpc_optimise_unretained(p->data.check_with.x, 0); }
+  if (p->type == MPC_TYPE_DFA)        { mpc_optimise_unretained(p->data.dfa.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)    { mpc_optimise_unretained(p->data.predict.x, 0); }
   if (p->type == MPC_TYPE_NOT)        { mpc_optimise_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MAYBE)      { mpc_optimise_unretained(p->data.not.x, 0); }
@@ -3830,7 +5472,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       p->data.or.n = n + m - 1;
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
       memmove(p->data.or.xs + n - 1, t->data.or.xs, m * sizeof(mpc_parser_t*));
-      free(t->data.or.xs); free(t->name); free(t);
+      free(t->data.or.xs); free(t->data.or.predict); free(t->name); free(t);
       continue;
     }
 
@@ -3844,7 +5486,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
       memmove(p->data.or.xs + m, p->data.or.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
       memmove(p->data.or.xs, t->data.or.xs, m * sizeof(mpc_parser_t*));
-      free(t->data.or.xs); free(t->name); free(t);
+      free(t->data.or.xs); free(t->data.or.predict); free(t->name); free(t);
       continue;
     }
     
@@ -3955,5 +5597,6 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
 
 void mpc_optimise(mpc_parser_t *p) {
   mpc_optimise_unretained(p, 1);
+  mpc_predict(&p, 1);
 }
 
@@ -64,12 +64,39 @@ typedef union {
 struct mpc_parser_t;
 typedef struct mpc_parser_t mpc_parser_t;
 
+/*
+** mpc_parse and mpc_nparse read `string` in place without copying it.
+** mpc_nparse stops at `length` bytes or the first '\0', whichever is first.
+*/
+
 int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r);
 int mpc_nparse(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r);
 
+/*
+** Each parse takes its small allocations from a pool that starts at a
+** sixteenth of the input's length and grows as needed. Its slabs are at
+** least `min` bytes and add up to at most `max`; a zero leaves that bound
+** as it is. mpc_mem_stats totals every parse since the last reset: how
+** many allocations the pool served, and how many fell back to malloc
+** because they were too large for it or it was full.
+*/
+
+typedef struct {
+  unsigned long parses;
+  unsigned long pool;
+  unsigned long large;
+  unsigned long overflow;
+  unsigned long reserved;
+  unsigned long used;
+} mpc_mem_stats_t;
+
+void mpc_mem_pool(size_t min, size_t max);
+void mpc_mem_stats(mpc_mem_stats_t *s);
+void mpc_mem_stats_reset(void);
+
 /*
 ** Function Types
 */
@@ -147,6 +174,17 @@ mpc_parser_t *mpc_and(int n, mpc_fold_t f, ...);
 
 mpc_parser_t *mpc_predictive(mpc_parser_t *a);
 
+/*
+** Remembers what `a` does at each position of a string input so it only
+** runs once there, sharing the tree it built rather than copying it. Its
+** output must be an mpc_ast_t or NULL, and parsers around it must be
+** built with the mpca functions as for arenas. It is only remembered in
+** parses run with an arena or that start at a packrat parser; those
+** build their tree in an arena of their own and copy it out at the end.
+*/
+
+mpc_parser_t *mpc_packrat(mpc_parser_t *a);
+
 /*
 ** Common Parsers
 */
@@ -268,8 +306,15 @@ mpc_parser_t *mpc_re(const char *re);
 ** AST
 */
 
+/*
+** Nodes built by mpca_lang grammars carry the rule id of the innermost
+** named rule that produced them in `rule`. Ids count from 1 in the order
+** the parsers are passed to mpca_lang; other nodes have rule 0.
+*/
+
 typedef struct mpc_ast_t {
   char *tag;
+  int rule;
   char *contents;
   mpc_state_t state;
   int children_num;
@@ -289,6 +334,24 @@ void mpc_ast_delete(mpc_ast_t *a);
 void mpc_ast_print(mpc_ast_t *a);
 void mpc_ast_print_to(mpc_ast_t *a, FILE *fp);
 
+/*
+** Parses run with an arena allocate the nodes, contents and children
+** of their trees from it, and nodes of the same rules share one tag.
+** Such trees are read-only: they must not be changed with the
+** functions above or freed with mpc_ast_delete. Clearing the arena
+** frees every tree built in it and keeps its memory for the next
+** parse. Only grammars built with the mpca functions may be used.
+*/
+
+typedef struct mpc_ast_arena_t mpc_ast_arena_t;
+
+mpc_ast_arena_t *mpc_ast_arena_new(void);
+void mpc_ast_arena_clear(mpc_ast_arena_t *a);
+void mpc_ast_arena_delete(mpc_ast_arena_t *a);
+
+int mpc_parse_arena(const char *filename, const char *string, mpc_parser_t *p, mpc_ast_arena_t *a, mpc_result_t *r);
+int mpc_parse_contents_arena(const char *filename, mpc_parser_t *p, mpc_ast_arena_t *a, mpc_result_t *r);
+
 int mpc_ast_get_index(mpc_ast_t *ast, const char *tag);
 int mpc_ast_get_index_lb(mpc_ast_t *ast, const char *tag, int lb);
 mpc_ast_t *mpc_ast_get_child(mpc_ast_t *ast, const char *tag);
@@ -341,7 +404,8 @@ mpc_parser_t *mpca_and(int n, ...);
 enum {
   MPCA_LANG_DEFAULT              = 0,
   MPCA_LANG_PREDICTIVE           = 1,
-  MPCA_LANG_WHITESPACE_SENSITIVE = 2
+  MPCA_LANG_WHITESPACE_SENSITIVE = 2,
+  MPCA_LANG_PACKRAT              = 4
 };
 
 mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...);
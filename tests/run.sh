@@ -0,0 +1,25 @@
+#!/bin/sh
+# Run each tests/*.lspy after the stdlib, once as usual and once with
+# --lazy, and compare what it prints with the .out file beside it. Pass a
+# Lispy to test, ./Lispy by default
+# Run with: sh tests/run.sh [lispy]
+
+lispy=${1:-./Lispy}
+failed=0
+
+for t in tests/*.lspy; do
+    expected="${t%.lspy}.out"
+    for mode in "" --lazy; do
+        printf 'exit\n' | "$lispy" $mode --no-cache stdlib.lspy "$t" 2>&1 | tail -n +4 | sed 's/^Input> //' > "$expected.got"
+        if cmp -s "$expected" "$expected.got"; then
+            echo "ok   $t $mode"
+            rm -f "$expected.got"
+        else
+            echo "FAIL $t $mode"
+            diff "$expected" "$expected.got"
+            failed=1
+        fi
+    done
+done
+
+exit $failed